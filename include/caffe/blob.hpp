@@ -1,6 +1,8 @@
 #ifndef CAFFE_BLOB_HPP_
 #define CAFFE_BLOB_HPP_
 
+#include <stdint.h>
+
 #include <algorithm>
 #include <string>
 #include <vector>
@@ -228,7 +230,28 @@ class Blob {
   Dtype* mutable_gpu_diff();
   void Update();
   void FromProto(const BlobProto& proto, bool reshape = true);
-  void ToProto(BlobProto* proto, bool write_diff = false) const;
+  /**
+   * @brief Write the blob to proto.
+   *
+   * @param write_diff whether to write the diff as well as the data
+   * @param write_half whether to write the data as half_data; a Blob that
+   *        stores its data as half precision always does
+   */
+  void ToProto(BlobProto* proto, bool write_diff = false,
+      bool write_half = false) const;
+
+  /**
+   * @brief Keep the data only as IEEE half precision values, in half the
+   *        memory, freeing the Dtype data and diff.
+   *
+   * Afterwards the data is read with half_data() and written by FromProto;
+   * cpu_data() and the other data accessors die. The data must not be shared
+   * with other Blob%s, though they may ShareData this one after.
+   */
+  void StoreHalf();
+  inline bool stores_half() const { return static_cast<bool>(half_data_); }
+  const uint16_t* half_data() const;
+  uint16_t* mutable_half_data();
 
   /// @brief Compute the sum of absolute values (L1 norm) of the data.
   Dtype asum_data() const;
@@ -262,12 +285,22 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Set the data_ shared_ptr to memory, which other Blob%s may share
+   *        -- useful to reuse the memory of Blob%s whose data is no longer
+   *        needed.
+   *
+   * memory must be large enough for the current shape. If the Blob is later
+   * reshaped beyond the size of memory, it allocates memory of its own again.
+   */
+  void ShareDataMemory(const shared_ptr<SyncedMemory>& memory);
 
   bool ShapeEquals(const BlobProto& other);
 
  protected:
   shared_ptr<SyncedMemory> data_;
   shared_ptr<SyncedMemory> diff_;
+  shared_ptr<SyncedMemory> half_data_;
   vector<int> shape_;
   int count_;
   int capacity_;
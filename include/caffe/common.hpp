@@ -120,13 +120,9 @@ class Caffe {
     shared_ptr<Generator> generator_;
   };
 
-  // Getters for boost rng, curand, and cublas handles
-  inline static RNG& rng_stream() {
-    if (!Get().random_generator_) {
-      Get().random_generator_.reset(new RNG());
-    }
-    return *(Get().random_generator_);
-  }
+  // Getters for boost rng, curand, and cublas handles. rng_stream() is the
+  // calling thread's own generator if it has one.
+  static RNG& rng_stream();
 #ifndef CPU_ONLY
   inline static cublasHandle_t cublas_handle() { return Get().cublas_handle_; }
   inline static curandGenerator_t curand_generator() {
@@ -142,8 +138,38 @@ class Caffe {
   // freed in a non-pinned way, which may cause problems - I haven't verified
   // it personally but better to note it here in the header file.
   inline static void set_mode(Brew mode) { Get().mode_ = mode; }
+  // Returns the number of threads elementwise CPU loops may use, 0 for the
+  // OpenMP default: the calling thread's own if it has one.
+  static int cpu_threads();
+  // Sets the number of threads elementwise CPU loops may use. 0 leaves it to
+  // OpenMP, whose default follows OMP_NUM_THREADS.
+  inline static void set_cpu_threads(int threads) {
+    CHECK_GE(threads, 0);
+    Get().cpu_threads_ = threads;
+  }
+  // Gives the calling thread a cpu_threads of its own, for threads sharing
+  // the cores with others, like solver replicas; negative to drop it.
+  static void set_thread_cpu_threads(int threads);
+  // The number of processes training one net together (see Communicator),
+  // and which of them this one is. Data layers read only their share of the
+  // training data, and only rank 0 tests, logs and snapshots.
+  inline static int solver_count() { return Get().solver_count_; }
+  inline static int solver_rank() { return Get().solver_rank_; }
+  inline static bool root_solver() { return Get().solver_rank_ == 0; }
+  inline static void set_solver_count(int count) {
+    CHECK_GT(count, 0);
+    Get().solver_count_ = count;
+  }
+  inline static void set_solver_rank(int rank) {
+    CHECK_GE(rank, 0);
+    Get().solver_rank_ = rank;
+  }
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // Gives the calling thread a boost rng of its own, seeded with seed, for
+  // threads that run nets alongside others and must neither race on the
+  // shared one nor draw the same numbers.
+  static void set_thread_random_seed(const unsigned int seed);
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
@@ -158,6 +184,9 @@ class Caffe {
   shared_ptr<RNG> random_generator_;
 
   Brew mode_;
+  int cpu_threads_;
+  int solver_count_;
+  int solver_rank_;
   static shared_ptr<Caffe> singleton_;
 
  private:
@@ -12,6 +12,7 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/csr_matrix.hpp"
 
 namespace caffe {
 
@@ -309,6 +310,9 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "InnerProduct"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool CanStoreParamAsHalf(const int param_id) const {
+    return param_id == 0 && !quantized_;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -325,6 +329,30 @@ class InnerProductLayer : public Layer<Dtype> {
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  // ReLU folded into the layer by the layer fusion pass, for inference only
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
+  // Runs as an int8 GEMM on CPU, as calibrated by quantization_param, which
+  // only the TEST phase does
+  bool quantized_;
+  Dtype input_scale_;
+  // int8 weights and their scale per output, quantized at the first
+  // quantized Forward and again whenever the weights change, and the weights
+  // they were quantized from, and their version then
+  shared_ptr<SyncedMemory> quantized_weights_;
+  Blob<Dtype> weight_scales_;
+  boost::weak_ptr<SyncedMemory> quantized_source_;
+  unsigned int quantized_version_;
+  shared_ptr<SyncedMemory> quantized_input_;
+  Blob<int> quantized_output_;
+  // A panel of rows of the weights unpacked from half precision, and the
+  // columns of the output it gives
+  Blob<Dtype> weight_panel_;
+  Blob<Dtype> panel_output_;
+  // The weights in CSR form, used in the TEST phase on CPU when at least
+  // sparsity_threshold_ of them are zero
+  float sparsity_threshold_;
+  CSRMatrix<Dtype> sparse_weights_;
 };
 
 /**
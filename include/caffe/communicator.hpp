@@ -0,0 +1,130 @@
+#ifndef CAFFE_COMMUNICATOR_HPP_
+#define CAFFE_COMMUNICATOR_HPP_
+
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Connects the processes, or ranks, that train one model together, so
+ *        that the solver can average their gradients every iteration.
+ *
+ * Every rank must make the same calls in the same order.
+ */
+class Communicator {
+ public:
+  virtual ~Communicator() {}
+
+  /**
+   * @brief Connects rank to the others of size ranks as uri says:
+   *        "tcp://HOST:PORT[/TOKEN]", where rank 0 listens on HOST:PORT for
+   *        the others to join, which must give the same TOKEN, or
+   *        "shm://NAME" for ranks on a single host, which share memory under
+   *        NAME.
+   *
+   * Blocks until all ranks have joined.
+   */
+  static shared_ptr<Communicator> Create(const string& uri, int rank,
+      int size);
+
+  inline int rank() const { return rank_; }
+  inline int size() const { return size_; }
+
+  /// @brief Replaces the count values of data by their sum over all ranks.
+  virtual void AllReduce(float* data, int count) = 0;
+  virtual void AllReduce(double* data, int count) = 0;
+  /// @brief Replaces the size bytes of data by those of rank 0.
+  virtual void Broadcast(void* data, size_t size) = 0;
+  /// @brief Returns once all ranks have called it.
+  virtual void Barrier();
+
+ protected:
+  Communicator(int rank, int size);
+
+  int rank_;
+  int size_;
+
+  DISABLE_COPY_AND_ASSIGN(Communicator);
+};
+
+/**
+ * @brief Reduces over a ring of TCP connections, each rank sending to the
+ *        next: the sum of each 1 / size of the values collects on one rank in
+ *        size - 1 steps, and reaches all in size - 1 more.
+ *
+ * Every rank thus sends and receives about twice the data, however many
+ * ranks there are.
+ */
+class TCPCommunicator : public Communicator {
+ public:
+  // Ranks connect only to peers that give the same token.
+  TCPCommunicator(const string& host, int port, const string& token, int rank,
+      int size);
+  virtual ~TCPCommunicator();
+
+  virtual void AllReduce(float* data, int count) { RingAllReduce(data, count); }
+  virtual void AllReduce(double* data, int count) {
+    RingAllReduce(data, count);
+  }
+  virtual void Broadcast(void* data, size_t size);
+
+ protected:
+  template <typename Dtype>
+  void RingAllReduce(Dtype* data, int count);
+  // Sends to the next rank and receives from the previous one at once, so
+  // that no rank blocks on a full socket while its neighbor does too.
+  void SendReceive(const void* send, size_t send_size, void* receive,
+      size_t receive_size);
+
+  // Sockets to the next and from the previous rank in the ring
+  int next_;
+  int previous_;
+  vector<char> buffer_;
+};
+
+/**
+ * @brief Reduces through a segment of shared memory, for ranks on one host:
+ *        ranks copy their values in, each sums 1 / size of them over all
+ *        ranks, and all copy the sums out.
+ *
+ * Rank 0 creates the segment anew and acknowledges each rank that joins, so
+ * that none trains with a segment left by a failed run. The ranks fail once
+ * one of them exits, instead of waiting for it forever. Needs POSIX shared
+ * memory (Linux).
+ */
+class SharedMemoryCommunicator : public Communicator {
+ public:
+  SharedMemoryCommunicator(const string& name, int rank, int size);
+  virtual ~SharedMemoryCommunicator();
+
+  virtual void AllReduce(float* data, int count) { SlotAllReduce(data, count); }
+  virtual void AllReduce(double* data, int count) {
+    SlotAllReduce(data, count);
+  }
+  virtual void Broadcast(void* data, size_t size);
+  virtual void Barrier();
+
+ protected:
+  template <typename Dtype>
+  void SlotAllReduce(Dtype* data, int count);
+  // The slot of each rank, which the sums also collect in for slot 0
+  char* slot(int rank);
+  // Maps the segment open as fd, and closes fd.
+  void Map(int fd);
+
+  // The segment starts with the header, followed by a member for each rank
+  // and the slots.
+  struct Header;
+  struct Member;
+  Header* header_;
+  Member* members_;
+  size_t header_size_;
+  size_t mapped_size_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_COMMUNICATOR_HPP_
@@ -10,11 +10,13 @@
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/data_reader.hpp"
 #include "caffe/data_transformer.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/internal_thread.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 
 namespace caffe {
@@ -50,12 +52,24 @@ class BaseDataLayer : public Layer<Dtype> {
   bool output_labels_;
 };
 
+template <typename Dtype>
+class Batch {
+ public:
+  Blob<Dtype> data_, label_;
+};
+
+/**
+ * @brief Data layer whose batches are loaded by a persistent background
+ *        thread into a ring of DataParameter.prefetch buffers.
+ *
+ * Subclasses implement load_batch(); Forward hands the next completed batch
+ * to the top blobs without copying it on the CPU.
+ */
 template <typename Dtype>
 class BasePrefetchingDataLayer :
     public BaseDataLayer<Dtype>, public InternalThread {
  public:
-  explicit BasePrefetchingDataLayer(const LayerParameter& param)
-      : BaseDataLayer<Dtype>(param) {}
+  explicit BasePrefetchingDataLayer(const LayerParameter& param);
   // LayerSetUp: implements common data layer setup functionality, and calls
   // DataLayerSetUp to do special data layer setup for individual layer types.
   // This method may not be overridden.
@@ -67,22 +81,28 @@ class BasePrefetchingDataLayer :
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  virtual void CreatePrefetchThread();
-  virtual void JoinPrefetchThread();
-  // The thread's function
-  virtual void InternalThreadEntry() {}
+  // Forward_cpu points the tops at the batch.
+  virtual inline bool PointsTopsAtOwnMemory() const { return true; }
 
  protected:
-  Blob<Dtype> prefetch_data_;
-  Blob<Dtype> prefetch_label_;
+  // The thread's function: keeps filling free batches until stopped.
+  virtual void InternalThreadEntry();
+  virtual void load_batch(Batch<Dtype>* batch) = 0;
+
+  vector<shared_ptr<Batch<Dtype> > > prefetch_;
+  BlockingQueue<Batch<Dtype>*> prefetch_free_;
+  BlockingQueue<Batch<Dtype>*> prefetch_full_;
+  // The batch currently exposed through the top blobs; it is only returned
+  // to prefetch_free_ on the next Forward.
+  Batch<Dtype>* prefetch_current_;
+
   Blob<Dtype> transformed_data_;
 };
 
 template <typename Dtype>
 class DataLayer : public BasePrefetchingDataLayer<Dtype> {
  public:
-  explicit DataLayer(const LayerParameter& param)
-      : BasePrefetchingDataLayer<Dtype>(param) {}
+  explicit DataLayer(const LayerParameter& param);
   virtual ~DataLayer();
   virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -93,10 +113,26 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
   virtual inline int MaxTopBlobs() const { return 2; }
 
  protected:
-  virtual void InternalThreadEntry();
-
-  shared_ptr<db::DB> db_;
-  shared_ptr<db::Cursor> cursor_;
+  class TransformWorker;
+
+  virtual void load_batch(Batch<Dtype>* batch);
+  // Transforms datums_[first], datums_[first + stride], ... into the batch
+  // being loaded.
+  void TransformItems(DataTransformer<Dtype>* transformer,
+      Blob<Dtype>* transformed_data, int first, int stride);
+
+  DataReader reader_;
+  // Records of the batch being loaded, taken from reader_ by the prefetch
+  // thread.
+  vector<Datum*> datums_;
+  // Where the batch being loaded goes, from its mutable_cpu_data() on the
+  // prefetch thread; batch_label_ is NULL without labels.
+  Dtype* batch_data_;
+  Dtype* batch_label_;
+  // Threads sharing the transformation of each batch with the prefetch
+  // thread when DataParameter.transform_threads > 1.
+  vector<shared_ptr<TransformWorker> > workers_;
+  BlockingQueue<Batch<Dtype>*> workers_done_;
 };
 
 /**
@@ -235,7 +271,7 @@ class ImageDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   shared_ptr<Caffe::RNG> prefetch_rng_;
   virtual void ShuffleImages();
-  virtual void InternalThreadEntry();
+  virtual void load_batch(Batch<Dtype>* batch);
 
   vector<std::pair<std::string, int> > lines_;
   int lines_id_;
@@ -257,6 +293,7 @@ class MemoryDataLayer : public BaseDataLayer<Dtype> {
   virtual inline const char* type() const { return "MemoryData"; }
   virtual inline int ExactNumBottomBlobs() const { return 0; }
   virtual inline int ExactNumTopBlobs() const { return 2; }
+  virtual inline bool PointsTopsAtOwnMemory() const { return true; }
 
   virtual void AddDatumVector(const vector<Datum>& datum_vector);
   virtual void AddMatVector(const vector<cv::Mat>& mat_vector,
@@ -307,7 +344,7 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual unsigned int PrefetchRand();
-  virtual void InternalThreadEntry();
+  virtual void load_batch(Batch<Dtype>* batch);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
   vector<std::pair<std::string, vector<int> > > image_database_;
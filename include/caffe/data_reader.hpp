@@ -0,0 +1,75 @@
+#ifndef CAFFE_DATA_READER_HPP_
+#define CAFFE_DATA_READER_HPP_
+
+#include <boost/weak_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Reads records from a database on a background thread and hands
+ *        them, parsed, to the data layers consuming it.
+ *
+ * All the readers created for the same layer name, source and shard share a
+ * single database and cursor, and each record goes to exactly one of them, so
+ * consumers of a source partition it instead of each reading every record.
+ * When DataParameter.num_shards > 1, only the records whose index modulo
+ * num_shards equals shard_id are read, which lets several processes stride
+ * the same database. With DataParameter.shuffle, records are fetched by key in
+ * a new random order every epoch.
+ */
+class DataReader {
+ public:
+  explicit DataReader(const LayerParameter& param);
+  ~DataReader();
+
+  // Parsed records, in reading order for this consumer.
+  inline BlockingQueue<Datum*>& full() const {
+    return queue_pair_->full_;
+  }
+  // Returns a record taken from full() once the layer is done with it.
+  void Recycle(Datum* datum);
+
+ protected:
+  // Queue pairs are shared between a body and its readers
+  class QueuePair {
+   public:
+    explicit QueuePair(int size);
+
+    BlockingQueue<Datum*> free_;
+    BlockingQueue<Datum*> full_;
+
+   private:
+    vector<shared_ptr<Datum> > datums_;
+
+    DISABLE_COPY_AND_ASSIGN(QueuePair);
+  };
+
+  // A single body is created per source
+  class Body;
+
+  // Readers of the same layer name, source and shard share a body.
+  static string source_key(const LayerParameter& param);
+
+  const shared_ptr<QueuePair> queue_pair_;
+  shared_ptr<Body> body_;
+  // Index of queue_pair_ within body_
+  int queue_pair_id_;
+
+  static map<const string, boost::weak_ptr<Body> > bodies_;
+
+  DISABLE_COPY_AND_ASSIGN(DataReader);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DATA_READER_HPP_
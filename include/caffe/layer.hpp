@@ -158,9 +158,11 @@ class Layer {
   const LayerParameter& layer_param() const { return layer_param_; }
 
   /**
-   * @brief Writes the layer parameter to a protocol buffer
+   * @brief Writes the layer parameter to a protocol buffer, with the data of
+   *        the param blobs as half precision if write_half
    */
-  virtual void ToProto(LayerParameter* param, bool write_diff = false);
+  virtual void ToProto(LayerParameter* param, bool write_diff = false,
+      bool write_half = false);
 
   /**
    * @brief Returns the scalar loss associated with a top blob at a given index.
@@ -263,6 +265,25 @@ class Layer {
     return true;
   }
 
+  /**
+   * @brief Returns whether the param blob at param_id may keep its data as
+   *        half precision only (see Blob::StoreHalf) in Forward_cpu.
+   *
+   * Layers that return true read that param with Blob::half_data() whenever
+   * it stores_half(); they only do so in the TEST phase.
+   */
+  virtual inline bool CanStoreParamAsHalf(const int param_id) const {
+    return false;
+  }
+
+  /**
+   * @brief Returns whether Forward points the top blobs at memory of the
+   *        layer's own (see Blob::set_cpu_data) rather than writing to theirs.
+   *
+   * Net::Init never lets such tops share memory with other blobs.
+   */
+  virtual inline bool PointsTopsAtOwnMemory() const { return false; }
+
   /**
    * @brief Specifies whether the layer should compute gradients w.r.t. a
    *        parameter at a particular index given by param_id.
@@ -456,12 +477,13 @@ inline void Layer<Dtype>::Backward(const vector<Blob<Dtype>*>& top,
 
 // Serialize LayerParameter to protocol buffer
 template <typename Dtype>
-void Layer<Dtype>::ToProto(LayerParameter* param, bool write_diff) {
+void Layer<Dtype>::ToProto(LayerParameter* param, bool write_diff,
+    bool write_half) {
   param->Clear();
   param->CopyFrom(layer_param_);
   param->clear_blobs();
   for (int i = 0; i < blobs_.size(); ++i) {
-    blobs_[i]->ToProto(param->add_blobs(), write_diff);
+    blobs_[i]->ToProto(param->add_blobs(), write_diff, write_half);
   }
 }
 
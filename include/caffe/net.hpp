@@ -73,6 +73,31 @@ class Net {
   void BackwardFrom(int start);
   void BackwardTo(int end);
 
+  /**
+   * @brief Told by Backward as soon as the gradients of some learnable params
+   *        are final, while the layers below are still to run, e.g. to send
+   *        them to other solvers meanwhile.
+   */
+  class ParamDiffsReadyCallback {
+   public:
+    virtual ~ParamDiffsReadyCallback() {}
+    /// Called on the thread running Backward once layer layer_id is done
+    /// with it; see params_final_after.
+    virtual void ParamDiffsReady(int layer_id) = 0;
+  };
+  /// @brief Calls callback back, which must outlive the net, from Backward.
+  void add_param_diffs_ready_callback(ParamDiffsReadyCallback* callback) {
+    param_diffs_ready_callbacks_.push_back(callback);
+  }
+  /**
+   * @brief The learnable params (indices into learnable_params) whose diffs
+   *        are final once layer layer_id has run Backward: those that no
+   *        layer below it shares.
+   */
+  inline const vector<int>& params_final_after(int layer_id) const {
+    return params_final_after_[layer_id];
+  }
+
   /**
    * @brief Reshape all layers from bottom to top.
    *
@@ -217,13 +242,38 @@ class Net {
   void AppendTop(const NetParameter& param, const int layer_id,
                  const int top_id, set<string>* available_blobs,
                  map<string, int>* blob_name_to_idx);
-  /// @brief Append a new bottom blob to the net.
+  /// @brief Append a new bottom blob to the net; fused nets may read blobs
+  ///        already consumed.
   int AppendBottom(const NetParameter& param, const int layer_id,
-                   const int bottom_id, set<string>* available_blobs,
+                   const int bottom_id, bool fused,
+                   set<string>* available_blobs,
                    map<string, int>* blob_name_to_idx);
   /// @brief Append a new parameter blob to the net.
   void AppendParam(const NetParameter& param, const int layer_id,
                    const int param_id);
+  /**
+   * @brief Let blobs whose lifetimes do not overlap share a few buffers,
+   *        assigned by a liveness analysis over the layers.
+   */
+  void ReuseBlobMemory(const NetParameter& param);
+  /**
+   * @brief Keep the params that layers can read as half precision only as
+   *        such, unless they are shared.
+   */
+  void StoreParamsAsHalf();
+  /// @brief Group the blobs sharing data, identified by their first blob.
+  void DataSharingGroups(vector<int>* group) const;
+  /// @brief Plan which blob groups recompute_layer lets the net drop.
+  void InitRecomputation(const NetParameter& param);
+  /**
+   * @brief Recompute the data of a dropped blob group, as it was before
+   *        layer end ran, by replaying the layers writing it.
+   */
+  void Recompute(int group, int end);
+  /// @brief The number of layers writing a blob group before layer end.
+  int GroupWritersBefore(int group, int end) const;
+  /// @brief Free the data, and optionally the diffs, of a blob group.
+  void ReleaseGroup(int group, bool diff);
 
   /// @brief Helper for displaying debug info in Forward about input Blobs.
   void InputDebugInfo(const int layer_id);
@@ -287,10 +337,25 @@ class Net {
   /// the weight decay multipliers for learnable_params_
   vector<float> params_weight_decay_;
   vector<bool> has_params_decay_;
+  /// Per layer: the learnable params whose diffs are final after its Backward
+  vector<vector<int> > params_final_after_;
+  vector<ParamDiffsReadyCallback*> param_diffs_ready_callbacks_;
+  /// The data sharing group of each blob, when recomputing layers
+  vector<int> blob_group_;
+  /// Per group: whether it may be dropped, how many of the layers writing it
+  /// its data reflects, and those layers, in order
+  vector<bool> group_droppable_;
+  vector<int> group_written_;
+  vector<vector<int> > group_writers_;
+  /// Per layer: the groups dropped after its Forward and its Backward
+  vector<vector<int> > forward_release_;
+  vector<vector<int> > backward_release_;
   /// The bytes of memory used by this net
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether to write the params as half precision
+  bool half_params_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -2,8 +2,10 @@
 #define CAFFE_OPTIMIZATION_SOLVER_HPP_
 
 #include <string>
+#include <typeinfo>
 #include <vector>
 
+#include "caffe/communicator.hpp"
 #include "caffe/net.hpp"
 
 namespace caffe {
@@ -37,6 +39,12 @@ class Solver {
     return test_nets_;
   }
   int iter() { return iter_; }
+  // The copies of net() the replicas, if any, run on, sharing its weights
+  vector<shared_ptr<Net<Dtype> > > replica_nets();
+  // Trains together with the solvers of the other ranks of communicator,
+  // which must all be set up alike: each step starts from the weights of
+  // rank 0 and averages the gradients of all ranks.
+  void set_communicator(shared_ptr<Communicator> communicator);
 
  protected:
   // Make and apply the update value for the current iteration.
@@ -49,6 +57,24 @@ class Solver {
   string SnapshotFilename(const string extension);
   string SnapshotToBinaryProto();
   string SnapshotToHDF5();
+  // Writes proto, a part of the snapshot, to filename, or has it written once
+  // the snapshot is complete for async_snapshot.
+  void WriteSnapshotProto(shared_ptr<google::protobuf::Message> proto,
+      const string& filename);
+  // Runs the forward and backward passes of an iteration, on the replicas and
+  // the other ranks too if any, leaves the summed gradients in net_ and
+  // returns the loss, averaged over the ranks.
+  Dtype ForwardBackward();
+  // Sums piece piece, of as many as there are nets, of the gradients of the
+  // replicas into net_.
+  void ReduceDiffs(int piece);
+  // Sums the gradients of the learnable params param_ids of net_, and *loss
+  // unless NULL, over the ranks of communicator_, through buffer, and sets
+  // *loss to their average.
+  void AllReduceDiffs(const vector<int>& param_ids, Dtype* loss,
+      vector<Dtype>* buffer);
+  // Sets the weights of net_ to those of rank 0.
+  void BroadcastParams();
   // The test routine
   void TestAll();
   void Test(const int test_net_id = 0);
@@ -62,6 +88,27 @@ class Solver {
   int current_step_;
   shared_ptr<Net<Dtype> > net_;
   vector<shared_ptr<Net<Dtype> > > test_nets_;
+  // Copies of net_ sharing its weights, each computing on its own thread
+  class Replica;
+  vector<shared_ptr<Replica> > replicas_;
+  // The OpenMP threads each net gets when there are replicas, which their
+  // convolutions are tuned for too, and their share of Caffe::cpu_threads,
+  // or -1 to keep it
+  int replica_threads_;
+  int replica_cpu_threads_;
+  // The gradients of each learnable param in net_ and in each replica, for
+  // ReduceDiffs
+  vector<Dtype*> diffs_;
+  vector<vector<const Dtype*> > replica_diffs_;
+  // The other ranks, if any, and the buffer their gradients are summed in
+  shared_ptr<Communicator> communicator_;
+  vector<Dtype> communicator_buffer_;
+  // Sums the gradients over the ranks layer by layer during backward
+  class Reducer;
+  shared_ptr<Reducer> reducer_;
+  // Writes the snapshots for async_snapshot
+  class SnapshotWriter;
+  shared_ptr<SnapshotWriter> snapshot_writer_;
 
   DISABLE_COPY_AND_ASSIGN(Solver);
 };
@@ -89,6 +136,52 @@ class SGDSolver : public Solver<Dtype> {
   virtual void Regularize(int param_id);
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
   virtual void ClipGradients();
+  void MaskPrunedWeights(int param_id);
+  // The factor that averages gradients accumulated over iter_size, replicas
+  // and ranks
+  Dtype AccumulationScale();
+
+  // What the fused update of a learnable param needs
+  struct FusedUpdateArgs {
+    Dtype* data;
+    Dtype* diff;
+    Dtype* history;
+    // 1 for the weights to keep, for keep_pruned_weights, or NULL
+    const Dtype* mask;
+    // The factor of the gradient, the weight decay (L1 if l1, else L2) and
+    // the learning rate of the param
+    Dtype scale;
+    Dtype decay;
+    bool l1;
+    Dtype rate;
+  };
+  // Whether ComputeUpdateFused does what this solver's updates do. Solvers
+  // deriving from one here must say so themselves, or take the unfused path.
+  virtual inline bool SupportsFusedUpdate() const {
+    return typeid(*this) == typeid(SGDSolver<Dtype>);
+  }
+  // Updates all params on CPU, as ComputeUpdateFused over pieces of them in
+  // parallel.
+  void ApplyFusedUpdate(Dtype rate);
+  // Does for elements [begin, end) of a param in one pass what Normalize,
+  // Regularize, ComputeUpdateValue, MaskPrunedWeights and Net::Update do in
+  // turn, leaving the update in its diff too.
+  virtual void ComputeUpdateFused(const FusedUpdateArgs& args, int begin,
+      int end);
+  // The gradient of element i, scaled and regularized
+  static inline Dtype FusedGradient(const FusedUpdateArgs& args, int i) {
+    const Dtype data = args.data[i];
+    return args.diff[i] * args.scale + args.decay *
+        (args.l1 ? Dtype((0 < data) - (data < 0)) : data);
+  }
+  // Applies update to element i, unless pruned
+  static inline void FusedApply(const FusedUpdateArgs& args, int i,
+      Dtype update) {
+    if (args.mask) { update *= args.mask[i]; }
+    args.diff[i] = update;
+    args.data[i] -= update;
+  }
+
   virtual void SnapshotSolverState(const string& model_filename);
   virtual void SnapshotSolverStateToBinaryProto(const string& model_filename);
   virtual void SnapshotSolverStateToHDF5(const string& model_filename);
@@ -99,6 +192,9 @@ class SGDSolver : public Solver<Dtype> {
   // temp maintains other information that might be needed in computation
   //   of gradients/updates and is not needed in snapshots
   vector<shared_ptr<Blob<Dtype> > > history_, update_, temp_;
+  // prune_masks are 1 where weights were nonzero when training started, for
+  //   keep_pruned_weights; params not masked have none.
+  vector<shared_ptr<Blob<Dtype> > > prune_masks_;
 
   DISABLE_COPY_AND_ASSIGN(SGDSolver);
 };
@@ -113,6 +209,12 @@ class NesterovSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline bool SupportsFusedUpdate() const {
+    return typeid(*this) == typeid(NesterovSolver<Dtype>);
+  }
+  virtual void ComputeUpdateFused(
+      const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+      int end);
 
   DISABLE_COPY_AND_ASSIGN(NesterovSolver);
 };
@@ -127,6 +229,12 @@ class AdaGradSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline bool SupportsFusedUpdate() const {
+    return typeid(*this) == typeid(AdaGradSolver<Dtype>);
+  }
+  virtual void ComputeUpdateFused(
+      const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+      int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with AdaGrad.";
@@ -146,6 +254,12 @@ class RMSPropSolver : public SGDSolver<Dtype> {
 
  protected:
   virtual void ComputeUpdateValue(int param_id, Dtype rate);
+  virtual inline bool SupportsFusedUpdate() const {
+    return typeid(*this) == typeid(RMSPropSolver<Dtype>);
+  }
+  virtual void ComputeUpdateFused(
+      const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+      int end);
   void constructor_sanity_check() {
     CHECK_EQ(0, this->param_.momentum())
         << "Momentum cannot be used with RMSProp.";
@@ -0,0 +1,39 @@
+#ifndef CAFFE_TEST_TEST_DATA_UTIL_H_
+#define CAFFE_TEST_TEST_DATA_UTIL_H_
+
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+// Points data_param at a new LevelDB of a single 1x1x1 record, read in
+// batches of 1, for tests that only need a Data layer to be creatable: it
+// starts reading its database as soon as it is constructed.
+inline void SetUpSingleRecordSource(DataParameter* data_param) {
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  boost::scoped_ptr<db::DB> db(db::GetDB(DataParameter_DB_LEVELDB));
+  db->Open(source, db::NEW);
+  boost::scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  Datum datum;
+  datum.set_channels(1);
+  datum.set_height(1);
+  datum.set_width(1);
+  datum.add_float_data(0);
+  txn->Put("0", datum.SerializeAsString());
+  txn->Commit();
+  db->Close();
+  data_param->set_source(source);
+  data_param->set_backend(DataParameter_DB_LEVELDB);
+  data_param->set_batch_size(1);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_TEST_TEST_DATA_UTIL_H_
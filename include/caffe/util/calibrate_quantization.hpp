@@ -0,0 +1,22 @@
+#ifndef _CAFFE_UTIL_CALIBRATE_QUANTIZATION_HPP_
+#define _CAFFE_UTIL_CALIBRATE_QUANTIZATION_HPP_
+
+#include <set>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Runs iterations batches through the net of param in floating point, in the
+// TEST phase and with the weights of weights_file unless it is empty, and
+// sets the quantization_param of its Convolution and InnerProduct layers not
+// named in exclude to the largest input magnitude seen. Layers that saw only
+// zeros are left without one, in floating point.
+void CalibrateQuantization(const string& weights_file, int iterations,
+    const std::set<string>& exclude, NetParameter* param);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_CALIBRATE_QUANTIZATION_HPP_
@@ -0,0 +1,23 @@
+#ifndef CAFFE_UTIL_CPU_TUNING_HPP_
+#define CAFFE_UTIL_CPU_TUNING_HPP_
+
+#include <string>
+
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+// Benchmarks the CPU variants of every convolution layer of net, on its blob
+// shapes and including the backward pass where the net needs it, and runs
+// each layer with the fastest. If cache_file is not empty, results are looked
+// up in it first and new ones added to it, keyed by layer shape, precision and
+// CPU model.
+template <typename Dtype>
+void TuneCPUConvolutions(Net<Dtype>* net, const string& cache_file);
+
+// Model name of the CPU, as /proc/cpuinfo reports it.
+string CPUModelName();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CPU_TUNING_HPP_
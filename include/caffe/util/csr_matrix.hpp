@@ -0,0 +1,58 @@
+#ifndef CAFFE_UTIL_CSR_MATRIX_HPP_
+#define CAFFE_UTIL_CSR_MATRIX_HPP_
+
+#include <boost/weak_ptr.hpp>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The nonzeros of the data of a Blob, viewed as a matrix, in
+ *        compressed sparse row (CSR) form, for multiplying by the sparse
+ *        matrix (see caffe_cpu_csr_gemm and caffe_cpu_gemm_csr_t).
+ */
+template <typename Dtype>
+class CSRMatrix {
+ public:
+  CSRMatrix()
+      : version_(0), threshold_(0), rows_(0), cols_(0), sparse_(false) {}
+
+  /**
+   * @brief Converts the data of blob, as a matrix of rows rows, unless it is
+   *        unchanged since the last call, and returns whether at least the
+   *        fraction threshold of it is zero.
+   *
+   * Nothing is kept for blobs that are not that sparse.
+   */
+  bool Update(const Blob<Dtype>& blob, int rows, float threshold);
+
+  inline int rows() const { return rows_; }
+  inline int cols() const { return cols_; }
+  inline int nnz() const { return val_.size(); }
+  /// @brief The offsets in col() and val() of each row, and of their end
+  inline const int* row_ptr() const { return &row_ptr_[0]; }
+  inline const int* col() const { return col_.empty() ? NULL : &col_[0]; }
+  inline const Dtype* val() const { return val_.empty() ? NULL : &val_[0]; }
+
+ private:
+  // The data converted, and its version then
+  boost::weak_ptr<SyncedMemory> source_;
+  unsigned int version_;
+  float threshold_;
+  int rows_, cols_;
+  bool sparse_;
+  vector<int> row_ptr_;
+  vector<int> col_;
+  vector<Dtype> val_;
+
+  DISABLE_COPY_AND_ASSIGN(CSRMatrix);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CSR_MATRIX_HPP_
@@ -16,9 +16,20 @@ class Cursor {
   virtual ~Cursor() { }
   virtual void SeekToFirst() = 0;
   virtual void Next() = 0;
+  // Moves to the first record whose key is not less than key.
+  virtual void Seek(const string& key) = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // Views the current value without copying it out of the database. The
+  // data stays valid until the cursor is moved.
+  virtual const void* value_data() = 0;
+  virtual size_t value_size() = 0;
   virtual bool valid() = 0;
+  // Reads the current record into datum. Values are serialized Datums by
+  // default, backends storing raw records fill datum without parsing.
+  virtual void ReadDatum(Datum* datum) {
+    datum->ParseFromArray(value_data(), value_size());
+  }
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -0,0 +1,123 @@
+#ifndef CAFFE_UTIL_DB_PACKED_HPP
+#define CAFFE_UTIL_DB_PACKED_HPP
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+// A packed database is a single append-only file of fixed-size, decoded
+// records, all of the same shape:
+//
+//   header   PackedHeader, padded to kPackedHeaderSize bytes
+//   records  num_records x record_size bytes, each an int32 label followed
+//            by channels x height x width uint8 or float values
+//   index    (num_records + 1) x uint64 key offsets, followed by the keys
+//
+// Keys must be put in increasing order so that Seek can binary search them.
+// The file is mapped read-only for reading and cursors copy records straight
+// into Datums, without protobuf parsing. Values are in native byte order.
+struct PackedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t type;
+  int32_t channels;
+  int32_t height;
+  int32_t width;
+  uint32_t record_size;
+  uint64_t num_records;
+  uint64_t index_offset;
+};
+
+enum PackedType { PACKED_UINT8 = 0, PACKED_FLOAT = 1 };
+
+const size_t kPackedHeaderSize = 64;
+
+class Packed;
+
+class PackedCursor : public Cursor {
+ public:
+  explicit PackedCursor(const Packed* db)
+    : db_(db), index_(0), value_index_(-1) { }
+  virtual void SeekToFirst() { index_ = 0; }
+  virtual void Next() { ++index_; }
+  virtual void Seek(const string& key);
+  virtual string key();
+  // Values are Datums serialized on demand, for compatibility. Data layers
+  // use ReadDatum instead.
+  virtual string value();
+  virtual const void* value_data();
+  virtual size_t value_size();
+  virtual bool valid();
+  virtual void ReadDatum(Datum* datum);
+
+ private:
+  void SerializeValue();
+
+  const Packed* db_;
+  uint64_t index_;
+  string value_;
+  uint64_t value_index_;
+};
+
+class PackedTransaction : public Transaction {
+ public:
+  explicit PackedTransaction(Packed* db) : db_(db) { CHECK_NOTNULL(db_); }
+  // value must be a serialized, decoded Datum of the database's shape.
+  virtual void Put(const string& key, const string& value);
+  virtual void Commit();
+
+ private:
+  Packed* db_;
+  vector<string> keys_;
+  string records_;
+
+  DISABLE_COPY_AND_ASSIGN(PackedTransaction);
+};
+
+class Packed : public DB {
+ public:
+  Packed() : fd_(-1), map_(NULL), map_size_(0) { }
+  virtual ~Packed() { Close(); }
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual PackedCursor* NewCursor();
+  virtual PackedTransaction* NewTransaction() {
+    return new PackedTransaction(this);
+  }
+
+  inline const PackedHeader& header() const { return header_; }
+  // Read mode only, views into the mapped file
+  inline const char* record(uint64_t i) const {
+    return map_ + kPackedHeaderSize + i * header_.record_size;
+  }
+  void key(uint64_t i, const char** data, size_t* size) const;
+  // Index of the first record whose key is not less than key
+  uint64_t LowerBound(const string& key) const;
+
+ protected:
+  friend class PackedTransaction;
+  // Write mode: checks datum matches the shape of the records, which the
+  // first datum put defines, and appends its record to records.
+  void PackRecord(const Datum& datum, string* records);
+  const string& last_key() const;
+  void Append(const vector<string>& keys, const string& records);
+  void WriteHeaderAndIndex();
+
+  string source_;
+  int fd_;
+  char* map_;
+  size_t map_size_;
+  PackedHeader header_;
+  // Write mode: every key of the database
+  vector<string> keys_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DB_PACKED_HPP
@@ -0,0 +1,29 @@
+#ifndef _CAFFE_UTIL_FACTORIZE_HPP_
+#define _CAFFE_UTIL_FACTORIZE_HPP_
+
+#include <vector>
+
+namespace caffe {
+
+// Orthonormalizes the rows of the rows x cols matrix A in place by modified
+// Gram-Schmidt, twice over for accuracy in float. Rows that depend on those
+// before become zero.
+void OrthonormalizeRows(int rows, int cols, float* A);
+
+// Eigendecomposes the symmetric n x n matrix A, leaving its eigenvectors in
+// its rows and the eigenvalues in d, by Householder reduction to tridiagonal
+// form and the implicit QL method (after the EISPACK routines tred2 and tql2).
+void SymmetricEigen(int n, std::vector<double>* A, std::vector<double>* d);
+
+// Factorizes the N x K matrix W as about U * L, for the N x rank matrix U and
+// the rank x K matrix L, by a randomized truncated SVD (Halko et al., 2011):
+// subspace iteration from a random start, searching oversampling dimensions
+// beyond the rank and refined power_iterations times, finds the span of the
+// top left singular vectors, Q, and the small matrix Q^T W is decomposed
+// exactly. Returns the fraction of the squared Frobenius norm of W kept.
+double Factorize(int N, int K, int rank, int oversampling,
+    int power_iterations, const float* W, float* U, float* L);
+
+}  // namespace caffe
+
+#endif  // _CAFFE_UTIL_FACTORIZE_HPP_
@@ -0,0 +1,109 @@
+#ifndef CAFFE_UTIL_FAST_MATH_HPP_
+#define CAFFE_UTIL_FAST_MATH_HPP_
+
+#include <cmath>
+#include <limits>
+
+namespace caffe {
+
+// exp, log and tanh of one value. The float versions evaluate the Cephes
+// single precision polynomials with selects instead of branches or library
+// calls, so that loops over them vectorize, and stay within a few ulp of the
+// library functions; the double versions are the library functions.
+
+namespace fast_math {
+
+union FloatBits {
+  float f;
+  int i;
+};
+
+// 2^n for n in [-126, 127]
+inline float exp2i(int n) {
+  FloatBits bits;
+  bits.i = (n + 127) << 23;
+  return bits.f;
+}
+
+}  // namespace fast_math
+
+inline float fast_exp(float x) {
+  // exp(x) = 2^n exp(r) with n = round(x / ln 2) and |r| <= ln 2 / 2
+  // Out of range (or NaN) x is clamped here and its result selected below.
+  const float lo = x > -103.972084f ? x : -103.972084f;
+  const float t = lo < 88.7228394f ? lo : 88.7228394f;
+  const float n = std::floor(t * 1.44269504088896341f + 0.5f);
+  const float r = t - n * 0.693359375f + n * 2.12194440e-4f;
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  p = p * r * r + r + 1.f;
+  // 2^n in two halves, which keeps both normal down to denormal results
+  const int n1 = static_cast<int>(n) >> 1;
+  const int n2 = static_cast<int>(n) - n1;
+  const float y = p * fast_math::exp2i(n1) * fast_math::exp2i(n2);
+  return x > 88.7228394f ? std::numeric_limits<float>::infinity() :
+      (x == x ? y : x);
+}
+
+inline double fast_exp(double x) {
+  return std::exp(x);
+}
+
+inline float fast_log(float x) {
+  // Denormals are scaled into the normal range first.
+  const bool denormal = x < std::numeric_limits<float>::min();
+  fast_math::FloatBits bits;
+  bits.f = denormal ? x * 8388608.f : x;
+  // x = m 2^e with m in [sqrt(1/2), sqrt(2))
+  int e = ((bits.i >> 23) & 0xff) - (denormal ? 149 : 126);
+  bits.i = (bits.i & 0x007fffff) | 0x3f000000;
+  const bool small = bits.f < 0.707106781186547524f;
+  e -= small ? 1 : 0;
+  const float m = (small ? bits.f + bits.f : bits.f) - 1.f;
+  const float z = m * m;
+  float p = 7.0376836292e-2f;
+  p = p * m - 1.1514610310e-1f;
+  p = p * m + 1.1676998740e-1f;
+  p = p * m - 1.2420140846e-1f;
+  p = p * m + 1.4249322787e-1f;
+  p = p * m - 1.6668057665e-1f;
+  p = p * m + 2.0000714765e-1f;
+  p = p * m - 2.4999993993e-1f;
+  p = p * m + 3.3333331174e-1f;
+  const float fe = static_cast<float>(e);
+  const float y = m + (p * m * z - 2.12194440e-4f * fe - 0.5f * z) +
+      0.693359375f * fe;
+  return x > 0 ? (x < std::numeric_limits<float>::infinity() ? y : x) :
+      (x == 0 ? -std::numeric_limits<float>::infinity() :
+       std::numeric_limits<float>::quiet_NaN());
+}
+
+inline double fast_log(double x) {
+  return std::log(x);
+}
+
+inline float fast_tanh(float x) {
+  // Near 0 an odd polynomial, elsewhere 1 - 2 / (exp(2|x|) + 1)
+  const float z = x * x;
+  float p = -5.70498872745e-3f;
+  p = p * z + 2.06390887954e-2f;
+  p = p * z - 5.37397155531e-2f;
+  p = p * z + 1.33314422036e-1f;
+  p = p * z - 3.33332819422e-1f;
+  const float near = p * z * x + x;
+  const float a = std::fabs(x);
+  const float far = 1.f - 2.f / (fast_exp(a + a) + 1.f);
+  return a < 0.625f ? near : (x < 0 ? -far : far);
+}
+
+inline double fast_tanh(double x) {
+  return std::tanh(x);
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FAST_MATH_HPP_
@@ -0,0 +1,16 @@
+#ifndef _CAFFE_UTIL_FUSE_LAYERS_HPP_
+#define _CAFFE_UTIL_FUSE_LAYERS_HPP_
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters, with splits already inserted, into fewer layers that
+// compute the same outputs without backward: ReLUs folded into the
+// Convolution or InnerProduct layer writing their bottom, Dropout layers
+// removed, and Split layers removed where no consumer writes their tops.
+void FuseLayers(const NetParameter& param, NetParameter* param_fused);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_FUSE_LAYERS_HPP_
@@ -0,0 +1,66 @@
+#ifndef CAFFE_UTIL_HALF_HPP_
+#define CAFFE_UTIL_HALF_HPP_
+
+#include <stdint.h>
+
+namespace caffe {
+
+// Conversions between float and IEEE 754 half precision (binary16) values,
+// held as their bits in a uint16_t. Floats round to the nearest half, ties to
+// even; out of range values become infinities and NaNs stay NaNs.
+
+namespace half_precision {
+
+union FloatBits {
+  float f;
+  uint32_t u;
+};
+
+}  // namespace half_precision
+
+inline uint16_t float_to_half(float x) {
+  half_precision::FloatBits bits;
+  bits.f = x;
+  const uint16_t sign = (bits.u >> 16) & 0x8000;
+  bits.u &= 0x7fffffff;
+  uint16_t h;
+  if (bits.u >= 0x47800000) {
+    // 2^16 and up overflow, and NaNs keep a mantissa bit
+    h = bits.u > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (bits.u < 0x38800000) {
+    // Below 2^-14 the result is denormal. Adding 0.5 rounds the float so that
+    // its low mantissa bits are the half mantissa.
+    bits.f += 0.5f;
+    h = bits.u - 0x3f000000;
+  } else {
+    // Rebias the exponent and round the 13 dropped mantissa bits to even;
+    // a carry out of the mantissa rightly bumps the exponent.
+    const uint32_t odd = (bits.u >> 13) & 1;
+    bits.u += 0xc8000fff + odd;
+    h = bits.u >> 13;
+  }
+  return sign | h;
+}
+
+inline float half_to_float(uint16_t h) {
+  half_precision::FloatBits bits;
+  bits.u = (h & 0x7fff) << 13;
+  const uint32_t exponent = bits.u & 0x0f800000;
+  bits.u += 0x38000000;
+  if (exponent == 0x0f800000) {
+    // infinity or NaN
+    bits.u += 0x38000000;
+  } else if (exponent == 0) {
+    // denormal: renormalize through the FPU
+    bits.u += 0x00800000;
+    half_precision::FloatBits magic;
+    magic.u = 0x38800000;
+    bits.f -= magic.f;
+  }
+  bits.u |= static_cast<uint32_t>(h & 0x8000) << 16;
+  return bits.f;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HALF_HPP_
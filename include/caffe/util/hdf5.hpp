@@ -20,10 +20,12 @@ void hdf5_load_nd_dataset(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
     Blob<Dtype>* blob);
 
+// Saves the data or diff of blob; the data as 16 bit IEEE floats if
+// write_half or if blob stores it so, which loads as float or double.
 template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob,
-    bool write_diff = false);
+    bool write_diff = false, bool write_half = false);
 
 int hdf5_load_int(hid_t loc_id, const string& dataset_name);
 void hdf5_save_int(hid_t loc_id, const string& dataset_name, int i);
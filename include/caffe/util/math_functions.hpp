@@ -3,12 +3,14 @@
 
 #include <stdint.h>
 #include <cmath>  // for std::fabs and std::signbit
+#include <cstring>  // for memset
 
 #include "glog/logging.h"
 
 #include "caffe/common.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include "caffe/util/mkl_alternate.hpp"
+#include "caffe/util/openmp.hpp"
 
 namespace caffe {
 
@@ -125,6 +127,7 @@ inline int8_t caffe_sign(Dtype val) {
   template<typename Dtype> \
   void caffe_cpu_##name(const int n, const Dtype* x, Dtype* y) { \
     CHECK_GT(n, 0); CHECK(x); CHECK(y); \
+    CAFFE_PARALLEL_FOR(n) \
     for (int i = 0; i < n; ++i) { \
       operation; \
     } \
@@ -145,6 +148,41 @@ DEFINE_CAFFE_CPU_UNARY_FUNC(fabs, y[i] = std::fabs(x[i]));
 template <typename Dtype>
 void caffe_cpu_scale(const int n, const Dtype alpha, const Dtype *x, Dtype* y);
 
+// Quantizes y = x / scale, rounded and saturated to [-127, 127].
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y);
+
+// Quantizes each row of the rows x cols matrix x with its own scale, the
+// largest magnitude of the row over 127, returned in scales.
+template <typename Dtype>
+void caffe_cpu_quantize_rows(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scales);
+
+// C = A * op(B) for int8 A (M x K) and op(B) (K x N), accumulated exactly in
+// int32 as long as K stays below INT_MAX / 127^2.
+void caffe_cpu_gemm_s8(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int* C);
+
+// C = A * B for the M x K matrix A in CSR form (see util/csr_matrix.hpp),
+// given by its row_ptr, col and val arrays, and the K x N matrix B.
+template <typename Dtype>
+void caffe_cpu_csr_gemm(const int M, const int N, const int* row_ptr,
+    const int* col, const Dtype* val, const Dtype* B, Dtype* C);
+
+// C = A * B^T for the M x K matrix A and the N x K matrix B in CSR form.
+template <typename Dtype>
+void caffe_cpu_gemm_csr_t(const int M, const int N, const int K,
+    const Dtype* A, const int* row_ptr, const int* col, const Dtype* val,
+    Dtype* C);
+
+// Converts to and from IEEE half precision values (see util/half.hpp).
+template <typename Dtype>
+void caffe_cpu_to_half(const int n, const Dtype* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_from_half(const int n, const uint16_t* x, Dtype* y);
+
 #ifndef CPU_ONLY  // GPU
 
 // Decaf gpu gemm provides an interface that is almost the same as the cpu
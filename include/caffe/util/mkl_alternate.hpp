@@ -12,7 +12,11 @@ extern "C" {
 }
 #include <math.h>
 
-// Functions that caffe uses but are not present if MKL is not linked.
+#include "caffe/util/fast_math.hpp"
+#include "caffe/util/openmp.hpp"
+
+// Functions that caffe uses but are not present if MKL is not linked. Like
+// MKL's, they split long vectors over threads.
 
 // A simple way to define the vsl unary functions. The operation should
 // be in the form e.g. y[i] = sqrt(a[i])
@@ -20,6 +24,7 @@ extern "C" {
   template<typename Dtype> \
   void v##name(const int n, const Dtype* a, Dtype* y) { \
     CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    CAFFE_PARALLEL_FOR(n) \
     for (int i = 0; i < n; ++i) { operation; } \
   } \
   inline void vs##name( \
@@ -32,8 +37,8 @@ extern "C" {
   }
 
 DEFINE_VSL_UNARY_FUNC(Sqr, y[i] = a[i] * a[i]);
-DEFINE_VSL_UNARY_FUNC(Exp, y[i] = exp(a[i]));
-DEFINE_VSL_UNARY_FUNC(Ln, y[i] = log(a[i]));
+DEFINE_VSL_UNARY_FUNC(Exp, y[i] = caffe::fast_exp(a[i]));
+DEFINE_VSL_UNARY_FUNC(Ln, y[i] = caffe::fast_log(a[i]));
 DEFINE_VSL_UNARY_FUNC(Abs, y[i] = fabs(a[i]));
 
 // A simple way to define the vsl unary functions with singular parameter b.
@@ -42,6 +47,7 @@ DEFINE_VSL_UNARY_FUNC(Abs, y[i] = fabs(a[i]));
   template<typename Dtype> \
   void v##name(const int n, const Dtype* a, const Dtype b, Dtype* y) { \
     CHECK_GT(n, 0); CHECK(a); CHECK(y); \
+    CAFFE_PARALLEL_FOR(n) \
     for (int i = 0; i < n; ++i) { operation; } \
   } \
   inline void vs##name( \
@@ -61,6 +67,7 @@ DEFINE_VSL_UNARY_FUNC_WITH_PARAM(Powx, y[i] = pow(a[i], b));
   template<typename Dtype> \
   void v##name(const int n, const Dtype* a, const Dtype* b, Dtype* y) { \
     CHECK_GT(n, 0); CHECK(a); CHECK(b); CHECK(y); \
+    CAFFE_PARALLEL_FOR(n) \
     for (int i = 0; i < n; ++i) { operation; } \
   } \
   inline void vs##name( \
@@ -0,0 +1,78 @@
+#ifndef CAFFE_UTIL_OPENMP_HPP_
+#define CAFFE_UTIL_OPENMP_HPP_
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+// Elements an elementwise loop gives each thread at least, below which
+// waking more threads costs more than it saves.
+const int kParallelGrain = 16384;
+
+// Number of threads OpenMP loops run on by default, 1 without OpenMP.
+inline int openmp_max_threads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// Number of threads an elementwise loop over n elements runs on: the
+// Caffe::cpu_threads() setting or the OpenMP default, as far as every thread
+// gets kParallelGrain elements.
+inline int parallel_threads(int n) {
+  const int threads = Caffe::cpu_threads() > 0 ?
+      Caffe::cpu_threads() : openmp_max_threads();
+  return std::max(1, std::min(threads, n / kParallelGrain));
+}
+
+// Precedes a for loop over n independent elements to split it over
+// parallel_threads(n) threads, e.g.
+//   CAFFE_PARALLEL_FOR(count)
+//   for (int i = 0; i < count; ++i) { y[i] = a[i] * b[i]; }
+#ifdef _OPENMP
+#define CAFFE_PRAGMA(x) _Pragma(#x)
+#define CAFFE_PARALLEL_FOR(n) \
+  CAFFE_PRAGMA(omp parallel for num_threads(caffe::parallel_threads(n)) \
+      if (caffe::parallel_threads(n) > 1))
+#else
+#define CAFFE_PARALLEL_FOR(n)
+#endif
+
+// Sets the number of threads of the OpenMP loops of the calling thread, which
+// BLAS libraries built with OpenMP follow too, until it goes out of scope.
+// 0 keeps the current number.
+class OpenMPThreads {
+ public:
+  explicit OpenMPThreads(int threads)
+      : previous_(threads > 0 ? openmp_max_threads() : 0) {
+#ifdef _OPENMP
+    if (threads > 0) {
+      omp_set_num_threads(threads);
+    }
+#endif
+  }
+  ~OpenMPThreads() {
+#ifdef _OPENMP
+    if (previous_ > 0) {
+      omp_set_num_threads(previous_);
+    }
+#endif
+  }
+
+ private:
+  int previous_;
+
+  DISABLE_COPY_AND_ASSIGN(OpenMPThreads);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_OPENMP_HPP_
@@ -13,9 +13,28 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/csr_matrix.hpp"
 
 namespace caffe {
 
+/**
+ * @brief A way of running a convolution on CPU. Net benchmarks the variants of
+ *        each convolution layer at init when cpu_tuning is set, see
+ *        TuneCPUConvolutions.
+ */
+struct ConvolutionCPUVariant {
+  ConvolutionCPUVariant() : algorithm(-1), batch(0), threads(0) {}
+  ConvolutionCPUVariant(int algorithm, int batch, int threads)
+      : algorithm(algorithm), batch(batch), threads(threads) {}
+
+  // 0 for im2col + GEMM, others as defined by the layer, -1 for its default
+  int algorithm;
+  // Images lowered at once, 0 for as many as cpu_batch_memory allows
+  int batch;
+  // OpenMP threads, which BLAS built with OpenMP follows too, 0 for the default
+  int threads;
+};
+
 /**
  * @brief Abstract base class that factors out the BLAS code common to
  *        ConvolutionLayer and DeconvolutionLayer.
@@ -34,6 +53,17 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
 
+  // CPU variants worth benchmarking for the current shape
+  virtual vector<ConvolutionCPUVariant> cpu_variants();
+  inline const ConvolutionCPUVariant& cpu_variant() const {
+    return cpu_variant_;
+  }
+  // Runs on CPU with variant from the next Reshape on, releasing the buffers
+  // of the previous one.
+  void set_cpu_variant(const ConvolutionCPUVariant& variant);
+  // Whether the layer runs as int8 GEMMs, one image at a time, on CPU
+  inline bool quantized() const { return quantized_; }
+
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
@@ -41,11 +71,24 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
+  // Adds the bias, if any, and applies the fused ReLU, if any, to the output
+  // of one image in a single pass.
+  void forward_cpu_epilogue(Dtype* output);
+  // Forward of one image as int8 GEMMs, without the bias.
+  void forward_cpu_quantized(const Dtype* input, Dtype* output);
+  // Forward of one image by the weights in sparse_weights_, without the bias.
+  void forward_cpu_sparse(const Dtype* input, Dtype* output);
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Batched forward and weight gradient for batch consecutive images, which
+  // are lowered side by side so that each group does a single GEMM.
+  void forward_cpu_gemm_batch(const Dtype* input, int batch,
+      const Dtype* weights, Dtype* output);
+  void weight_cpu_gemm_batch(const Dtype* input, const Dtype* output,
+      int batch, Dtype* weights);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -75,6 +118,22 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  // ReLU folded into the layer by the layer fusion pass, for inference only
+  bool fused_relu_;
+  Dtype relu_negative_slope_;
+  // Runs as int8 GEMMs on CPU, as calibrated by quantization_param, which
+  // only the TEST phase does
+  bool quantized_;
+  Dtype input_scale_;
+  // The weights as Dtype during a Forward_cpu, when stored as half precision
+  Blob<Dtype> half_weights_;
+  // The weights in CSR form, used in the TEST phase on CPU when at least
+  // sparsity_threshold_ of them are zero
+  float sparsity_threshold_;
+  CSRMatrix<Dtype> sparse_weights_;
+  // Number of images lowered at once on CPU, within cpu_batch_memory
+  int cpu_batch_;
+  ConvolutionCPUVariant cpu_variant_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -82,6 +141,12 @@ class BaseConvolutionLayer : public Layer<Dtype> {
     im2col_cpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
         kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, col_buff);
   }
+  inline void conv_im2col_cpu(const Dtype* data, int col_stride,
+      Dtype* col_buff) {
+    im2col_cpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+        col_stride, col_buff);
+  }
   inline void conv_col2im_cpu(const Dtype* col_buff, Dtype* data) {
     col2im_cpu(col_buff, conv_in_channels_, conv_in_height_, conv_in_width_,
         kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, data);
@@ -109,6 +174,21 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  // Columns and outputs of cpu_batch_ images, each row holding the images
+  // side by side
+  shared_ptr<Blob<Dtype> > batch_col_buffer_;
+  shared_ptr<Blob<Dtype> > batch_output_buffer_;
+  // int8 weights and their scale per output channel, quantized at the first
+  // quantized Forward and again whenever the weights change, and the weights
+  // they were quantized from, and their version then
+  shared_ptr<SyncedMemory> quantized_weights_;
+  Blob<Dtype> weight_scales_;
+  boost::weak_ptr<SyncedMemory> quantized_source_;
+  unsigned int quantized_version_;
+  // int8 input and columns of one image, and its int32 output
+  shared_ptr<SyncedMemory> quantized_input_;
+  shared_ptr<SyncedMemory> quantized_col_buffer_;
+  Blob<int> quantized_output_;
 };
 
 /**
@@ -155,13 +235,17 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
    *  first group and input channels 3-4 and output channels 5-8 into the second
    *  group.
    *  - bias_term (\b optional, default true). Whether to have a bias.
-   *  - engine: convolution has CAFFE (matrix multiplication) and CUDNN (library
-   *    kernels + stream parallelism) engines.
+   *  - engine: convolution has CAFFE (matrix multiplication), CUDNN (library
+   *    kernels + stream parallelism) and DIRECT (Winograd and direct CPU
+   *    kernels) engines.
    */
   explicit ConvolutionLayer(const LayerParameter& param)
       : BaseConvolutionLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "Convolution"; }
+  virtual inline bool CanStoreParamAsHalf(const int param_id) const {
+    return param_id == 0 && !this->quantized_;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -256,6 +340,55 @@ class CuDNNConvolutionLayer : public ConvolutionLayer<Dtype> {
 };
 #endif
 
+/**
+ * @brief Convolves on CPU with Winograd or direct kernels where they apply,
+ *        and by matrix multiplication like ConvolutionLayer otherwise.
+ *
+ * 3x3 convolutions with stride 1 use Winograd F(4x4, 3x3), or F(2x2, 3x3)
+ * for outputs smaller than 4x4: each group reduces to 16 or 36 GEMMs over the
+ * transformed input tiles, with fewer multiplies and no im2col buffer.
+ * Depthwise and grouped convolutions with at most 4 input channels per group
+ * are computed directly. The backward pass and the GPU always go through
+ * ConvolutionLayer.
+ */
+template <typename Dtype>
+class DirectConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit DirectConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), algorithm_(GEMM) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Adds the Winograd or direct kernel, as algorithm 1, where it applies
+  virtual vector<ConvolutionCPUVariant> cpu_variants();
+  virtual inline bool CanStoreParamAsHalf(const int param_id) const {
+    return false;
+  }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  enum Algorithm { GEMM, WINOGRAD_2X2, WINOGRAD_4X4, DIRECT };
+  // The fastest kernel for the current shape
+  Algorithm shape_algorithm() const;
+  // Transforms the weights of every group into winograd_weights_
+  void winograd_cpu_weights(const Dtype* weights);
+  // Convolves one image
+  void winograd_cpu_gemm(const Dtype* input, Dtype* output);
+  void direct_cpu_conv(const Dtype* input, const Dtype* weights,
+      Dtype* output);
+
+  Algorithm algorithm_;
+  // Output tile size m of F(m x m, 3x3), and tile counts
+  int tile_m_, tiles_h_, tiles_w_;
+  // (group, tile element, output channel, input channel)
+  Blob<Dtype> winograd_weights_;
+  // (tile element, input channel, tile) and (tile element, output channel,
+  // tile) for one group of one image
+  Blob<Dtype> winograd_input_;
+  Blob<Dtype> winograd_output_;
+};
+
 /**
  * @brief A helper for image operations that rearranges image regions into
  *        column vectors.  Used by ConvolutionLayer to perform convolution
@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <climits>
+#include <string>
 #include <vector>
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -35,6 +38,9 @@ void Blob<Dtype>::Reshape(const vector<int>& shape) {
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
     diff_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
   }
+  if (half_data_ && half_data_->size() < count_ * sizeof(uint16_t)) {
+    half_data_.reset(new SyncedMemory(count_ * sizeof(uint16_t)));
+  }
 }
 
 template <typename Dtype>
@@ -70,18 +76,21 @@ Blob<Dtype>::Blob(const vector<int>& shape)
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_data() const {
   CHECK(data_);
+  CHECK(!half_data_) << "The data is stored as half precision";
   return (const Dtype*)data_->cpu_data();
 }
 
 template <typename Dtype>
 void Blob<Dtype>::set_cpu_data(Dtype* data) {
   CHECK(data);
+  CHECK(!half_data_) << "The data is stored as half precision";
   data_->set_cpu_data(data);
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_data() const {
   CHECK(data_);
+  CHECK(!half_data_) << "The data is stored as half precision";
   return (const Dtype*)data_->gpu_data();
 }
 
@@ -100,12 +109,14 @@ const Dtype* Blob<Dtype>::gpu_diff() const {
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_data() {
   CHECK(data_);
+  CHECK(!half_data_) << "The data is stored as half precision";
   return static_cast<Dtype*>(data_->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_data() {
   CHECK(data_);
+  CHECK(!half_data_) << "The data is stored as half precision";
   return static_cast<Dtype*>(data_->mutable_gpu_data());
 }
 
@@ -125,6 +136,7 @@ template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
   data_ = other.data();
+  half_data_ = other.half_data_;
 }
 
 template <typename Dtype>
@@ -133,6 +145,42 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareDataMemory(const shared_ptr<SyncedMemory>& memory) {
+  CHECK_GE(memory->size(), count_ * sizeof(Dtype));
+  data_ = memory;
+  // diff_ keeps its size, which must stay within the capacity
+  capacity_ = std::min<size_t>(capacity_, memory->size() / sizeof(Dtype));
+}
+
+template <typename Dtype>
+const uint16_t* Blob<Dtype>::half_data() const {
+  CHECK(half_data_);
+  return static_cast<const uint16_t*>(half_data_->cpu_data());
+}
+
+template <typename Dtype>
+uint16_t* Blob<Dtype>::mutable_half_data() {
+  CHECK(half_data_);
+  return static_cast<uint16_t*>(half_data_->mutable_cpu_data());
+}
+
+template <> void Blob<unsigned int>::StoreHalf() { NOT_IMPLEMENTED; }
+template <> void Blob<int>::StoreHalf() { NOT_IMPLEMENTED; }
+
+template <typename Dtype>
+void Blob<Dtype>::StoreHalf() {
+  if (half_data_) {
+    return;
+  }
+  shared_ptr<SyncedMemory> half(new SyncedMemory(count_ * sizeof(uint16_t)));
+  caffe_cpu_to_half(count_, cpu_data(),
+      static_cast<uint16_t*>(half->mutable_cpu_data()));
+  half_data_ = half;
+  data_->Release();
+  diff_->Release();
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -455,14 +503,39 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
     CHECK(ShapeEquals(proto)) << "shape mismatch (reshape not set)";
   }
   // copy data
-  Dtype* data_vec = mutable_cpu_data();
-  if (proto.double_data_size() > 0) {
+  if (half_data_) {
+    uint16_t* half_vec = mutable_half_data();
+    if (proto.has_half_data()) {
+      CHECK_EQ(2 * count_, proto.half_data().size());
+      const unsigned char* bytes =
+          reinterpret_cast<const unsigned char*>(proto.half_data().data());
+      for (int i = 0; i < count_; ++i) {
+        half_vec[i] = bytes[2 * i] | (bytes[2 * i + 1] << 8);
+      }
+    } else if (proto.double_data_size() > 0) {
+      CHECK_EQ(count_, proto.double_data_size());
+      caffe_cpu_to_half(count_, proto.double_data().data(), half_vec);
+    } else {
+      CHECK_EQ(count_, proto.data_size());
+      caffe_cpu_to_half(count_, proto.data().data(), half_vec);
+    }
+  } else if (proto.has_half_data()) {
+    CHECK_EQ(2 * count_, proto.half_data().size());
+    const unsigned char* bytes =
+        reinterpret_cast<const unsigned char*>(proto.half_data().data());
+    Dtype* data_vec = mutable_cpu_data();
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = half_to_float(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    }
+  } else if (proto.double_data_size() > 0) {
     CHECK_EQ(count_, proto.double_data_size());
+    Dtype* data_vec = mutable_cpu_data();
     for (int i = 0; i < count_; ++i) {
       data_vec[i] = proto.double_data(i);
     }
   } else {
     CHECK_EQ(count_, proto.data_size());
+    Dtype* data_vec = mutable_cpu_data();
     for (int i = 0; i < count_; ++i) {
       data_vec[i] = proto.data(i);
     }
@@ -482,17 +555,39 @@ void Blob<Dtype>::FromProto(const BlobProto& proto, bool reshape) {
   }
 }
 
+// Writes the data as little-endian half precision values, taken from half if
+// the blob stores them, and otherwise converted from data.
+template <typename Dtype>
+static void HalfDataToProto(const int count, const uint16_t* half,
+    const Dtype* data, BlobProto* proto) {
+  string* bytes = proto->mutable_half_data();
+  bytes->resize(2 * count);
+  for (int i = 0; i < count; ++i) {
+    const uint16_t h = half ? half[i] : float_to_half(data[i]);
+    (*bytes)[2 * i] = static_cast<char>(h & 0xff);
+    (*bytes)[2 * i + 1] = static_cast<char>(h >> 8);
+  }
+}
+
 template <>
-void Blob<double>::ToProto(BlobProto* proto, bool write_diff) const {
+void Blob<double>::ToProto(BlobProto* proto, bool write_diff,
+    bool write_half) const {
   proto->clear_shape();
   for (int i = 0; i < shape_.size(); ++i) {
     proto->mutable_shape()->add_dim(shape_[i]);
   }
   proto->clear_double_data();
   proto->clear_double_diff();
-  const double* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_double_data(data_vec[i]);
+  proto->clear_half_data();
+  if (half_data_) {
+    HalfDataToProto<double>(count_, half_data(), NULL, proto);
+  } else if (write_half) {
+    HalfDataToProto(count_, NULL, cpu_data(), proto);
+  } else {
+    const double* data_vec = cpu_data();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_double_data(data_vec[i]);
+    }
   }
   if (write_diff) {
     const double* diff_vec = cpu_diff();
@@ -503,16 +598,24 @@ void Blob<double>::ToProto(BlobProto* proto, bool write_diff) const {
 }
 
 template <>
-void Blob<float>::ToProto(BlobProto* proto, bool write_diff) const {
+void Blob<float>::ToProto(BlobProto* proto, bool write_diff,
+    bool write_half) const {
   proto->clear_shape();
   for (int i = 0; i < shape_.size(); ++i) {
     proto->mutable_shape()->add_dim(shape_[i]);
   }
   proto->clear_data();
   proto->clear_diff();
-  const float* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
+  proto->clear_half_data();
+  if (half_data_) {
+    HalfDataToProto<float>(count_, half_data(), NULL, proto);
+  } else if (write_half) {
+    HalfDataToProto(count_, NULL, cpu_data(), proto);
+  } else {
+    const float* data_vec = cpu_data();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_data(data_vec[i]);
+    }
   }
   if (write_diff) {
     const float* diff_vec = cpu_diff();
@@ -1,3 +1,4 @@
+#include <boost/thread.hpp>
 #include <glog/logging.h>
 #include <cstdio>
 #include <ctime>
@@ -9,6 +10,35 @@ namespace caffe {
 
 shared_ptr<Caffe> Caffe::singleton_;
 
+// Generators of the threads that have their own
+static boost::thread_specific_ptr<Caffe::RNG> thread_random_generator_;
+
+Caffe::RNG& Caffe::rng_stream() {
+  if (thread_random_generator_.get()) {
+    return *thread_random_generator_;
+  }
+  if (!Get().random_generator_) {
+    Get().random_generator_.reset(new RNG());
+  }
+  return *(Get().random_generator_);
+}
+
+void Caffe::set_thread_random_seed(const unsigned int seed) {
+  thread_random_generator_.reset(new RNG(seed));
+}
+
+// cpu_threads of the threads that have their own
+static boost::thread_specific_ptr<int> thread_cpu_threads_;
+
+int Caffe::cpu_threads() {
+  return thread_cpu_threads_.get() ? *thread_cpu_threads_ :
+      Get().cpu_threads_;
+}
+
+void Caffe::set_thread_cpu_threads(int threads) {
+  thread_cpu_threads_.reset(threads >= 0 ? new int(threads) : NULL);
+}
+
 // random seeding
 int64_t cluster_seedgen(void) {
   int64_t s, seed, pid;
@@ -42,7 +72,8 @@ void GlobalInit(int* pargc, char*** pargv) {
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU) { }
+    : random_generator_(), mode_(Caffe::CPU), cpu_threads_(0),
+    solver_count_(1), solver_rank_(0) { }
 
 Caffe::~Caffe() { }
 
@@ -86,7 +117,7 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU) {
+    mode_(Caffe::CPU), cpu_threads_(0), solver_count_(1), solver_rank_(0) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
@@ -0,0 +1,701 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "boost/lexical_cast.hpp"
+
+#include "caffe/communicator.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// How long ranks wait for each other to join, in milliseconds
+static const int kJoinTimeout = 300000;
+static const int kJoinRetry = 10;
+// Bytes each rank reduces through at a time
+static const size_t kChunkSize = 1 << 22;
+
+Communicator::Communicator(int rank, int size)
+    : rank_(rank), size_(size) {
+  CHECK_GT(size, 0) << "A communicator needs at least one rank";
+  CHECK_GE(rank, 0) << "Ranks start at 0";
+  CHECK_LT(rank, size) << "Rank " << rank << " of only " << size;
+}
+
+void Communicator::Barrier() {
+  float token = 0;
+  AllReduce(&token, 1);
+}
+
+shared_ptr<Communicator> Communicator::Create(const string& uri, int rank,
+    int size) {
+  const size_t scheme_end = uri.find("://");
+  CHECK_NE(scheme_end, string::npos) << "Expected tcp://HOST:PORT[/TOKEN] or "
+      << "shm://NAME, got " << uri;
+  const string scheme = uri.substr(0, scheme_end);
+  const string address = uri.substr(scheme_end + 3);
+  if (scheme == "tcp") {
+    const size_t slash = address.find('/');
+    const string host_port = address.substr(0, slash);
+    const string token = slash == string::npos ? "" :
+        address.substr(slash + 1);
+    const size_t colon = host_port.rfind(':');
+    CHECK_NE(colon, string::npos) << "Expected tcp://HOST:PORT[/TOKEN], got "
+        << uri;
+    return shared_ptr<Communicator>(new TCPCommunicator(
+        host_port.substr(0, colon),
+        boost::lexical_cast<int>(host_port.substr(colon + 1)), token, rank,
+        size));
+  }
+  CHECK_EQ(scheme, "shm") << "Unknown communicator " << uri;
+  return shared_ptr<Communicator>(
+      new SharedMemoryCommunicator(address, rank, size));
+}
+
+// TCP
+
+namespace {
+
+void WriteAll(int fd, const void* data, size_t size) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Lost a connection to another rank: "
+        << strerror(errno);
+    p += n;
+    size -= n;
+  }
+}
+
+// Reads size bytes, or returns false if the connection fails or times out
+// first.
+bool TryReadAll(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+void ReadAll(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(n, 0) << "Lost a connection to another rank: "
+        << (n == 0 ? "closed" : strerror(errno));
+    p += n;
+    size -= n;
+  }
+}
+
+// Identifies a rank to the one it connects to, followed by the token of the
+// run, which must match: other runs or strangers on the port cannot join.
+struct Hello {
+  int32_t magic;
+  int32_t size;
+  int32_t rank;
+  // The port the rank listens on for its previous rank
+  int32_t port;
+  int32_t token_size;
+};
+
+const int32_t kHelloMagic = 0x43414646;
+// How long a peer that connected has to say hello, in milliseconds
+const int kHelloTimeout = 10000;
+
+void SendHello(int fd, int rank, int size, int port, const string& token) {
+  Hello hello = {kHelloMagic, size, rank, port,
+      static_cast<int32_t>(token.size())};
+  WriteAll(fd, &hello, sizeof(hello));
+  WriteAll(fd, token.data(), token.size());
+}
+
+// Reads the hello of a rank of this run within timeout milliseconds, or
+// returns false if the peer sends anything else.
+bool ReceiveHello(int fd, int size, const string& token, int timeout,
+    Hello* hello) {
+  timeval limit = {timeout / 1000, (timeout % 1000) * 1000};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+  bool valid = TryReadAll(fd, hello, sizeof(*hello)) &&
+      hello->magic == kHelloMagic && hello->size == size &&
+      hello->rank >= 0 && hello->rank < size &&
+      hello->token_size == static_cast<int32_t>(token.size());
+  if (valid) {
+    vector<char> received(token.size() + 1);
+    valid = TryReadAll(fd, &received[0], token.size()) &&
+        string(&received[0], token.size()) == token;
+  }
+  limit.tv_sec = 0;
+  limit.tv_usec = 0;
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &limit, sizeof(limit));
+  return valid;
+}
+
+// Returns a socket listening on ip (in network order) and port (0 for any),
+// and sets port to it.
+int Listen(uint32_t ip, int* port, int backlog) {
+  const int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0) << "socket: " << strerror(errno);
+  const int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in addr = sockaddr_in();
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(*port);
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "Cannot listen on port " << *port << ": " << strerror(errno);
+  CHECK_EQ(listen(fd, backlog), 0) << "listen: " << strerror(errno);
+  socklen_t length = sizeof(addr);
+  getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length);
+  *port = ntohs(addr.sin_port);
+  return fd;
+}
+
+int Accept(int listener, uint32_t* peer_ip) {
+  sockaddr_in addr;
+  socklen_t length = sizeof(addr);
+  pollfd p = {listener, POLLIN, 0};
+  CHECK_GT(poll(&p, 1, kJoinTimeout), 0) << "Timed out waiting for ranks";
+  const int fd = accept(listener, reinterpret_cast<sockaddr*>(&addr),
+      &length);
+  CHECK_GE(fd, 0) << "accept: " << strerror(errno);
+  if (peer_ip) {
+    *peer_ip = addr.sin_addr.s_addr;
+  }
+  return fd;
+}
+
+// Connects to ip (in network order) and port, retrying while the other side
+// is not listening yet.
+int Connect(uint32_t ip, int port) {
+  sockaddr_in addr = sockaddr_in();
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = htons(port);
+  for (int waited = 0; ; waited += kJoinRetry) {
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0) << "socket: " << strerror(errno);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0) {
+      return fd;
+    }
+    close(fd);
+    CHECK_LT(waited, kJoinTimeout) << "Cannot connect to port " << port
+        << ": " << strerror(errno);
+    usleep(kJoinRetry * 1000);
+  }
+}
+
+uint32_t Resolve(const string& host) {
+  addrinfo hints = addrinfo();
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result;
+  CHECK_EQ(getaddrinfo(host.c_str(), NULL, &hints, &result), 0)
+      << "Cannot resolve " << host;
+  const uint32_t ip =
+      reinterpret_cast<sockaddr_in*>(result->ai_addr)->sin_addr.s_addr;
+  freeaddrinfo(result);
+  return ip;
+}
+
+}  // namespace
+
+TCPCommunicator::TCPCommunicator(const string& host, int port,
+    const string& token, int rank, int size)
+    : Communicator(rank, size), next_(-1), previous_(-1) {
+  if (size == 1) {
+    return;
+  }
+  // Every rank listens for its previous one on a port of its own, on the
+  // address it reaches rank 0 from. Rank 0 collects the addresses of all of
+  // them and sends everyone the list.
+  const uint32_t master_ip = Resolve(host);
+  vector<uint32_t> ips(size);
+  vector<int32_t> ports(size);
+  int ring_port = 0;
+  int ring_listener;
+  if (rank == 0) {
+    const int master = Listen(master_ip, &port, size);
+    ring_listener = Listen(master_ip, &ring_port, 1);
+    ips[0] = master_ip;
+    ports[0] = ring_port;
+    vector<int> joined(size, -1);
+    for (int i = 1; i < size; ) {
+      uint32_t ip;
+      const int fd = Accept(master, &ip);
+      Hello hello;
+      if (!ReceiveHello(fd, size, token, kHelloTimeout, &hello) ||
+          hello.rank == 0 ||
+          joined[hello.rank] >= 0) {
+        in_addr addr = {ip};
+        LOG(WARNING) << "Dropped a connection from " << inet_ntoa(addr)
+            << " that is not a rank of this run";
+        close(fd);
+        continue;
+      }
+      joined[hello.rank] = fd;
+      ips[hello.rank] = ip;
+      ports[hello.rank] = hello.port;
+      ++i;
+    }
+    close(master);
+    for (int i = 1; i < size; ++i) {
+      SendHello(joined[i], 0, size, ring_port, token);
+      WriteAll(joined[i], &ips[0], size * sizeof(ips[0]));
+      WriteAll(joined[i], &ports[0], size * sizeof(ports[0]));
+      close(joined[i]);
+    }
+  } else {
+    const int fd = Connect(master_ip, port);
+    sockaddr_in addr;
+    socklen_t length = sizeof(addr);
+    CHECK_EQ(getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &length), 0)
+        << "getsockname: " << strerror(errno);
+    ring_listener = Listen(addr.sin_addr.s_addr, &ring_port, 1);
+    SendHello(fd, rank, size, ring_port, token);
+    Hello hello;
+    // Rank 0 answers once all ranks have joined.
+    CHECK(ReceiveHello(fd, size, token, kJoinTimeout, &hello) &&
+        hello.rank == 0)
+        << "Rank 0 of another run, or not a rank at all, listens on " << host
+        << ":" << port;
+    ReadAll(fd, &ips[0], size * sizeof(ips[0]));
+    ReadAll(fd, &ports[0], size * sizeof(ports[0]));
+    close(fd);
+  }
+  const int next = (rank + 1) % size;
+  next_ = Connect(ips[next], ports[next]);
+  SendHello(next_, rank, size, ring_port, token);
+  const int previous = (rank - 1 + size) % size;
+  for (;;) {
+    previous_ = Accept(ring_listener, NULL);
+    Hello hello;
+    if (ReceiveHello(previous_, size, token, kHelloTimeout, &hello) &&
+        hello.rank == previous) {
+      break;
+    }
+    LOG(WARNING) << "Dropped a connection that is not from rank " << previous;
+    close(previous_);
+  }
+  close(ring_listener);
+  const int yes = 1;
+  setsockopt(next_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  setsockopt(previous_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+  fcntl(next_, F_SETFL, fcntl(next_, F_GETFL) | O_NONBLOCK);
+  fcntl(previous_, F_SETFL, fcntl(previous_, F_GETFL) | O_NONBLOCK);
+  LOG(INFO) << "Rank " << rank << " of " << size << " joined " << host
+      << ":" << port;
+}
+
+TCPCommunicator::~TCPCommunicator() {
+  if (next_ >= 0) {
+    close(next_);
+  }
+  if (previous_ >= 0) {
+    close(previous_);
+  }
+}
+
+void TCPCommunicator::SendReceive(const void* send_data, size_t send_size,
+    void* receive_data, size_t receive_size) {
+  const char* send_p = static_cast<const char*>(send_data);
+  char* receive_p = static_cast<char*>(receive_data);
+  while (send_size > 0 || receive_size > 0) {
+    pollfd fds[2] = {{next_, 0, 0}, {previous_, 0, 0}};
+    fds[0].events = send_size ? POLLOUT : 0;
+    fds[1].events = receive_size ? POLLIN : 0;
+    const int ready = poll(fds, 2, -1);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    CHECK_GT(ready, 0) << "poll: " << strerror(errno);
+    if (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)) {
+      const ssize_t n = send(next_, send_p, send_size, MSG_NOSIGNAL);
+      CHECK(n > 0 || errno == EAGAIN || errno == EINTR)
+          << "Lost the connection to the next rank: " << strerror(errno);
+      if (n > 0) {
+        send_p += n;
+        send_size -= n;
+      }
+    }
+    if (fds[1].revents & (POLLIN | POLLERR | POLLHUP)) {
+      const ssize_t n = recv(previous_, receive_p, receive_size, 0);
+      CHECK(n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR)))
+          << "Lost the connection to the previous rank: "
+          << (n == 0 ? "closed" : strerror(errno));
+      if (n > 0) {
+        receive_p += n;
+        receive_size -= n;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void TCPCommunicator::RingAllReduce(Dtype* data, int count) {
+  const int size = size_;
+  if (size == 1) {
+    return;
+  }
+  // Piece i of the values is [count * i / size, count * (i + 1) / size).
+  vector<int> begin(size + 1);
+  for (int i = 0; i <= size; ++i) {
+    begin[i] = static_cast<int64_t>(count) * i / size;
+  }
+  buffer_.resize((count / size + 1) * sizeof(Dtype));
+  Dtype* received = reinterpret_cast<Dtype*>(&buffer_[0]);
+  // Reduce: at step s, each rank passes on its partial sum of piece
+  // rank - s and adds its values to the one of piece rank - s - 1 coming in.
+  for (int s = 0; s < size - 1; ++s) {
+    const int send = (rank_ - s + size) % size;
+    const int receive = (rank_ - s - 1 + size) % size;
+    SendReceive(data + begin[send],
+        (begin[send + 1] - begin[send]) * sizeof(Dtype), received,
+        (begin[receive + 1] - begin[receive]) * sizeof(Dtype));
+    caffe_axpy<Dtype>(begin[receive + 1] - begin[receive], 1, received,
+        data + begin[receive]);
+  }
+  // Gather: each rank now has the whole sum of piece rank + 1, and passes
+  // on the sums it gets.
+  for (int s = 0; s < size - 1; ++s) {
+    const int send = (rank_ + 1 - s + size) % size;
+    const int receive = (rank_ - s + size) % size;
+    SendReceive(data + begin[send],
+        (begin[send + 1] - begin[send]) * sizeof(Dtype),
+        data + begin[receive],
+        (begin[receive + 1] - begin[receive]) * sizeof(Dtype));
+  }
+}
+
+void TCPCommunicator::Broadcast(void* data, size_t size) {
+  if (size_ == 1) {
+    return;
+  }
+  // Pass the data along the ring from rank 0, a chunk at a time so that the
+  // ranks forward in parallel.
+  char* p = static_cast<char*>(data);
+  for (size_t offset = 0; offset < size; offset += kChunkSize) {
+    const size_t chunk = std::min(kChunkSize, size - offset);
+    if (rank_ > 0) {
+      SendReceive(NULL, 0, p + offset, chunk);
+    }
+    if (rank_ < size_ - 1) {
+      SendReceive(p + offset, chunk, NULL, 0);
+    }
+  }
+}
+
+// Shared memory
+
+#ifdef __linux__
+
+struct SharedMemoryCommunicator::Header {
+  // The barrier: how many ranks wait in it, and how many times all did
+  volatile int waiting;
+  volatile int generation;
+  // Set once rank 0 has set up the segment
+  volatile int ready;
+};
+
+// What each rank tells the others about itself
+struct SharedMemoryCommunicator::Member {
+  volatile pid_t pid;
+  // A joining rank sets nonce to a value of its own, and rank 0 copies it to
+  // ack once it knows about the rank. A segment left by a failed run may
+  // hold any acks, but not the new nonce.
+  volatile uint64_t nonce;
+  volatile uint64_t ack;
+};
+
+namespace {
+
+// Barrier yields kBarrierSpins times, then sleeps kBarrierSleep microseconds
+// at a time, and makes sure that the other ranks still run every
+// kBarrierSleeps sleeps.
+const int kBarrierSpins = 1000;
+const int kBarrierSleep = 100;
+const int kBarrierSleeps = 10000;
+
+// A value no other rank, or earlier run, picks
+uint64_t Nonce() {
+  static int calls = 0;
+  timeval now;
+  gettimeofday(&now, NULL);
+  return ((static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_usec) << 24 ^
+      static_cast<uint64_t>(getpid()) << 8 ^
+      __sync_add_and_fetch(&calls, 1)) | 1;
+}
+
+// Whether the process pid exists and has not exited, even if its parent
+// has not waited for it yet
+bool Running(pid_t pid) {
+  if (kill(pid, 0) != 0 && errno == ESRCH) {
+    return false;
+  }
+  const string stat_file = "/proc/" + boost::lexical_cast<string>(pid) +
+      "/stat";
+  FILE* file = fopen(stat_file.c_str(), "r");
+  if (!file) {
+    return true;
+  }
+  char state = 0;
+  const int read = fscanf(file, "%*d (%*[^)]) %c", &state);
+  fclose(file);
+  return read != 1 || (state != 'Z' && state != 'X');
+}
+
+// The inode under name, or 0 if there is none
+ino_t SharedMemoryInode(const string& path) {
+  const int fd = shm_open(path.c_str(), O_RDONLY, 0600);
+  if (fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  const ino_t inode = fstat(fd, &st) == 0 ? st.st_ino : 0;
+  close(fd);
+  return inode;
+}
+
+}  // namespace
+
+SharedMemoryCommunicator::SharedMemoryCommunicator(const string& name,
+    int rank, int size)
+    : Communicator(rank, size), header_(NULL), members_(NULL),
+      header_size_(0), mapped_size_(0) {
+  if (size == 1) {
+    return;
+  }
+  const string path = "/" + name;
+  // Rounded up to keep the slots aligned
+  header_size_ = (sizeof(Header) + size * sizeof(Member) + 63) / 64 * 64;
+  mapped_size_ = header_size_ + size * kChunkSize;
+  if (rank == 0) {
+    shm_unlink(path.c_str());
+    const int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    CHECK_GE(fd, 0) << "Cannot create shared memory " << path << ": "
+        << strerror(errno);
+    CHECK_EQ(ftruncate(fd, mapped_size_), 0) << strerror(errno);
+    Map(fd);
+    members_[0].pid = getpid();
+    __sync_synchronize();
+    header_->ready = 1;
+    // Acknowledge the ranks as they join
+    int joined = 1;
+    for (int waited = 0; joined < size; waited += kJoinRetry) {
+      joined = 1;
+      for (int r = 1; r < size; ++r) {
+        const uint64_t nonce = members_[r].nonce;
+        if (nonce) {
+          members_[r].ack = nonce;
+          ++joined;
+        }
+      }
+      if (joined < size) {
+        CHECK_LT(waited, kJoinTimeout) << "Timed out waiting for ranks to "
+            << "join shared memory " << path;
+        usleep(kJoinRetry * 1000);
+      }
+    }
+    __sync_synchronize();
+    // Everyone has the segment mapped, so its name can go.
+    shm_unlink(path.c_str());
+  } else {
+    const uint64_t nonce = Nonce();
+    for (int waited = 0; ; waited += kJoinRetry) {
+      CHECK_LT(waited, kJoinTimeout) << "Timed out waiting for rank 0 to "
+          << "create shared memory " << path;
+      // Wait for rank 0 to create and size the segment
+      const int fd = shm_open(path.c_str(), O_RDWR, 0600);
+      struct stat st;
+      if (fd < 0 || fstat(fd, &st) != 0 ||
+          static_cast<size_t>(st.st_size) != mapped_size_) {
+        if (fd >= 0) {
+          close(fd);
+        }
+        usleep(kJoinRetry * 1000);
+        continue;
+      }
+      Map(fd);
+      // Join, and wait for rank 0 to take note, unless the segment turns
+      // out to be a stale one that rank 0 replaces.
+      bool acked = false;
+      for (; waited < kJoinTimeout; waited += kJoinRetry) {
+        if (header_->ready) {
+          members_[rank].pid = getpid();
+          __sync_synchronize();
+          members_[rank].nonce = nonce;
+        }
+        if (members_[rank].ack == nonce) {
+          acked = true;
+          break;
+        }
+        usleep(kJoinRetry * 1000);
+        if (SharedMemoryInode(path) != st.st_ino) {
+          // Rank 0 may have acknowledged the rank and removed the name.
+          acked = members_[rank].ack == nonce;
+          break;
+        }
+      }
+      if (acked) {
+        break;
+      }
+      munmap(header_, mapped_size_);
+      header_ = NULL;
+    }
+    __sync_synchronize();
+  }
+  Barrier();
+  LOG(INFO) << "Rank " << rank << " of " << size << " joined shared memory "
+      << path;
+}
+
+SharedMemoryCommunicator::~SharedMemoryCommunicator() {
+  if (header_) {
+    munmap(header_, mapped_size_);
+  }
+}
+
+void SharedMemoryCommunicator::Map(int fd) {
+  void* memory = mmap(NULL, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+  close(fd);
+  CHECK(memory != MAP_FAILED) << "mmap: " << strerror(errno);
+  header_ = static_cast<Header*>(memory);
+  members_ = reinterpret_cast<Member*>(header_ + 1);
+}
+
+char* SharedMemoryCommunicator::slot(int rank) {
+  return reinterpret_cast<char*>(header_) + header_size_ + rank * kChunkSize;
+}
+
+void SharedMemoryCommunicator::Barrier() {
+  if (size_ == 1) {
+    return;
+  }
+  const int generation = header_->generation;
+  if (__sync_add_and_fetch(&header_->waiting, 1) == size_) {
+    header_->waiting = 0;
+    __sync_add_and_fetch(&header_->generation, 1);
+    return;
+  }
+  // Spin briefly, as the others are usually close behind, then sleep, and
+  // make sure now and then that they can still come.
+  for (int i = 0; header_->generation == generation; ++i) {
+    if (i < kBarrierSpins) {
+      sched_yield();
+      continue;
+    }
+    usleep(kBarrierSleep);
+    if ((i - kBarrierSpins) % kBarrierSleeps == kBarrierSleeps - 1) {
+      for (int r = 0; r < size_; ++r) {
+        CHECK(Running(members_[r].pid)) << "Rank " << r << " (process "
+            << members_[r].pid << ") exited.";
+      }
+    }
+  }
+  __sync_synchronize();
+}
+
+template <typename Dtype>
+void SharedMemoryCommunicator::SlotAllReduce(Dtype* data, int count) {
+  if (size_ == 1) {
+    return;
+  }
+  const int chunk_count = kChunkSize / sizeof(Dtype);
+  Dtype* sum = reinterpret_cast<Dtype*>(slot(0));
+  for (int offset = 0; offset < count; offset += chunk_count) {
+    const int n = std::min(chunk_count, count - offset);
+    std::copy(data + offset, data + offset + n,
+        reinterpret_cast<Dtype*>(slot(rank_)));
+    Barrier();
+    // Sum piece rank of all slots into slot 0
+    const int begin = static_cast<int64_t>(n) * rank_ / size_;
+    const int end = static_cast<int64_t>(n) * (rank_ + 1) / size_;
+    for (int r = 1; r < size_; ++r) {
+      caffe_axpy<Dtype>(end - begin, 1,
+          reinterpret_cast<Dtype*>(slot(r)) + begin, sum + begin);
+    }
+    Barrier();
+    std::copy(sum, sum + n, data + offset);
+    // Nobody may overwrite the slots before everyone has read the sums.
+    Barrier();
+  }
+}
+
+void SharedMemoryCommunicator::Broadcast(void* data, size_t size) {
+  if (size_ == 1) {
+    return;
+  }
+  char* p = static_cast<char*>(data);
+  for (size_t offset = 0; offset < size; offset += kChunkSize) {
+    const size_t chunk = std::min(kChunkSize, size - offset);
+    if (rank_ == 0) {
+      std::copy(p + offset, p + offset + chunk, slot(0));
+    }
+    Barrier();
+    if (rank_ > 0) {
+      std::copy(slot(0), slot(0) + chunk, p + offset);
+    }
+    Barrier();
+  }
+}
+
+#else  // !__linux__
+
+struct SharedMemoryCommunicator::Header {};
+struct SharedMemoryCommunicator::Member {};
+
+SharedMemoryCommunicator::SharedMemoryCommunicator(const string& name,
+    int rank, int size)
+    : Communicator(rank, size), header_(NULL), members_(NULL),
+      header_size_(0), mapped_size_(0) {
+  CHECK_EQ(size, 1) << "Shared memory communicators need Linux; use tcp://";
+}
+
+SharedMemoryCommunicator::~SharedMemoryCommunicator() {}
+
+void SharedMemoryCommunicator::Map(int fd) {}
+
+char* SharedMemoryCommunicator::slot(int rank) { return NULL; }
+
+void SharedMemoryCommunicator::Barrier() {}
+
+template <typename Dtype>
+void SharedMemoryCommunicator::SlotAllReduce(Dtype* data, int count) {}
+
+void SharedMemoryCommunicator::Broadcast(void* data, size_t size) {}
+
+#endif  // __linux__
+
+}  // namespace caffe
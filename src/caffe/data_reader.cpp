@@ -0,0 +1,291 @@
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/data_reader.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
+
+namespace caffe {
+
+// Reads the records of one source and distributes them to every reader
+// registered for it. A reader receives a record whenever one of its datums
+// is free, so a consumer that stops pulling, e.g. a test net between test
+// runs, never stalls the others.
+class DataReader::Body : public InternalThread {
+ public:
+  explicit Body(const LayerParameter& param);
+  virtual ~Body();
+
+  // Registers a queue pair whose datums are all free, returns its id.
+  int AddQueuePair(const shared_ptr<QueuePair>& queue_pair, int size);
+
+  const LayerParameter param_;
+  // One entry per free datum, holding the id of the queue pair it belongs to.
+  BlockingQueue<int> free_ids_;
+
+ protected:
+  virtual void InternalThreadEntry();
+  // Moves the cursor to the next record of this shard, wrapping around at
+  // the end of the database.
+  void Next(db::Cursor* cursor);
+  // Shuffle mode: lists the keys of this shard, draws the order of an epoch
+  // and moves the cursor to the record at order_pos_.
+  void LoadKeys(db::Cursor* cursor);
+  void ShuffleKeys();
+  void SeekKey(db::Cursor* cursor);
+
+  boost::mutex mutex_;
+  vector<shared_ptr<QueuePair> > queue_pairs_;
+  int index_;
+  unsigned int skip_;
+  // Keys of this shard in database order, and the order of the current epoch
+  // as indices into keys_
+  vector<string> keys_;
+  vector<int> order_;
+  int order_pos_;
+  shared_ptr<Caffe::RNG> rng_;
+};
+
+map<const string, boost::weak_ptr<DataReader::Body> > DataReader::bodies_;
+static boost::mutex bodies_mutex_;
+
+// Splits each shard of the training data further among the processes that
+// train together, so that each of them reads its own records.
+static LayerParameter ShardForSolver(const LayerParameter& param) {
+  LayerParameter sharded(param);
+  const int count = Caffe::solver_count();
+  if (param.phase() == TRAIN && count > 1) {
+    DataParameter* data_param = sharded.mutable_data_param();
+    data_param->set_shard_id(data_param->shard_id() * count +
+        Caffe::solver_rank());
+    data_param->set_num_shards(data_param->num_shards() * count);
+  }
+  return sharded;
+}
+
+string DataReader::source_key(const LayerParameter& param) {
+  const DataParameter& data_param = param.data_param();
+  return param.name() + ":" + data_param.source() + ":" +
+      boost::lexical_cast<string>(data_param.shard_id()) + "/" +
+      boost::lexical_cast<string>(data_param.num_shards());
+}
+
+DataReader::DataReader(const LayerParameter& param)
+    : queue_pair_(new QueuePair(
+        param.data_param().prefetch() * param.data_param().batch_size())) {
+  // Get or create a body, keyed by the shard this solver reads
+  const LayerParameter sharded = ShardForSolver(param);
+  boost::mutex::scoped_lock lock(bodies_mutex_);
+  string key = source_key(sharded);
+  body_ = bodies_[key].lock();
+  if (!body_) {
+    body_.reset(new Body(sharded));
+    bodies_[key] = boost::weak_ptr<Body>(body_);
+  } else {
+    LOG(INFO) << "Sharing the reader of " << param.data_param().source()
+        << " with another " << param.name() << " layer";
+  }
+  queue_pair_id_ = body_->AddQueuePair(queue_pair_,
+      param.data_param().prefetch() * param.data_param().batch_size());
+  if (!body_->is_started()) {
+    CHECK(body_->StartInternalThread()) << "Thread execution failed";
+  }
+}
+
+DataReader::~DataReader() {
+  string key = source_key(body_->param_);
+  body_.reset();
+  boost::mutex::scoped_lock lock(bodies_mutex_);
+  if (bodies_[key].expired()) {
+    bodies_.erase(key);
+  }
+}
+
+void DataReader::Recycle(Datum* datum) {
+  queue_pair_->free_.push(datum);
+  body_->free_ids_.push(queue_pair_id_);
+}
+
+DataReader::QueuePair::QueuePair(int size)
+    : datums_(size) {
+  CHECK_GT(size, 0) << "prefetch and batch_size must be positive";
+  for (int i = 0; i < size; ++i) {
+    datums_[i].reset(new Datum());
+    free_.push(datums_[i].get());
+  }
+}
+
+DataReader::Body::Body(const LayerParameter& param)
+    : param_(param),
+      index_(0),
+      skip_(0),
+      order_pos_(0) {
+  const DataParameter& data_param = param.data_param();
+  CHECK_GT(data_param.num_shards(), 0) << "num_shards must be positive";
+  CHECK_LT(data_param.shard_id(), data_param.num_shards())
+      << "shard_id must be lower than num_shards";
+  if (data_param.shuffle()) {
+    CHECK_GT(data_param.shuffle_block(), 0) << "shuffle_block must be positive";
+    rng_.reset(new Caffe::RNG(caffe_rng_rand()));
+  } else if (data_param.rand_skip()) {
+    // Check if we should randomly skip a few data points
+    skip_ = caffe_rng_rand() % data_param.rand_skip();
+  }
+}
+
+DataReader::Body::~Body() {
+  StopInternalThread();
+}
+
+int DataReader::Body::AddQueuePair(const shared_ptr<QueuePair>& queue_pair,
+    int size) {
+  boost::mutex::scoped_lock lock(mutex_);
+  const int id = queue_pairs_.size();
+  queue_pairs_.push_back(queue_pair);
+  for (int i = 0; i < size; ++i) {
+    free_ids_.push(id);
+  }
+  return id;
+}
+
+void DataReader::Body::InternalThreadEntry() {
+  const DataParameter& data_param = param_.data_param();
+  shared_ptr<db::DB> db(db::GetDB(data_param.backend()));
+  db->Open(data_param.source(), db::READ);
+  shared_ptr<db::Cursor> cursor(db->NewCursor());
+  if (data_param.num_shards() > 1) {
+    LOG(INFO) << "Reading shard " << data_param.shard_id() << " of "
+        << data_param.num_shards() << " from " << data_param.source();
+  }
+  if (data_param.shuffle()) {
+    LoadKeys(cursor.get());
+    ShuffleKeys();
+    SeekKey(cursor.get());
+  } else {
+    // Position the cursor on the first record of this shard
+    for (index_ = 0; index_ < static_cast<int>(data_param.shard_id());
+         ++index_) {
+      cursor->Next();
+      CHECK(cursor->valid()) << "Not enough records in "
+          << data_param.source() << " for shard " << data_param.shard_id();
+    }
+    if (skip_) {
+      LOG(INFO) << "Skipping first " << skip_ << " data points.";
+      for (unsigned int i = 0; i < skip_; ++i) {
+        Next(cursor.get());
+      }
+    }
+  }
+  try {
+    while (!must_stop()) {
+      const int id = free_ids_.pop();
+      QueuePair* queue_pair;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_pair = queue_pairs_[id].get();
+      }
+      // The id guarantees this datum is available
+      Datum* datum = queue_pair->free_.pop();
+      // Read straight from the database's memory
+      cursor->ReadDatum(datum);
+      queue_pair->full_.push(datum);
+      Next(cursor.get());
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  }
+}
+
+void DataReader::Body::Next(db::Cursor* cursor) {
+  if (param_.data_param().shuffle()) {
+    const int previous = order_[order_pos_];
+    if (++order_pos_ == static_cast<int>(order_.size())) {
+      DLOG(INFO) << "Reshuffling data prefetching order.";
+      ShuffleKeys();
+      order_pos_ = 0;
+    }
+    // Consecutive records of a single shard are read without seeking
+    if (param_.data_param().num_shards() == 1 &&
+        order_[order_pos_] == previous + 1) {
+      cursor->Next();
+      CHECK(cursor->valid() && cursor->key() == keys_[order_[order_pos_]])
+          << "Key index out of date for " << param_.data_param().source();
+    } else {
+      SeekKey(cursor);
+    }
+    return;
+  }
+  const int shard_id = param_.data_param().shard_id();
+  const int num_shards = param_.data_param().num_shards();
+  do {
+    cursor->Next();
+    ++index_;
+    if (!cursor->valid()) {
+      DLOG(INFO) << "Restarting data prefetching from start.";
+      cursor->SeekToFirst();
+      index_ = 0;
+    }
+  } while (index_ % num_shards != shard_id);
+}
+
+void DataReader::Body::LoadKeys(db::Cursor* cursor) {
+  const DataParameter& data_param = param_.data_param();
+  const string& key_index = data_param.key_index();
+  DBKeyIndex index;
+  if (!key_index.empty() && std::ifstream(key_index.c_str()).good()) {
+    LOG(INFO) << "Loading key index " << key_index;
+    CHECK(ReadProtoFromBinaryFile(key_index, &index))
+        << "Failed to parse key index " << key_index;
+  } else {
+    LOG(INFO) << "Listing the keys of " << data_param.source();
+    for (cursor->SeekToFirst(); cursor->valid(); cursor->Next()) {
+      index.add_key(cursor->key());
+    }
+    if (!key_index.empty()) {
+      LOG(INFO) << "Saving key index " << key_index;
+      WriteProtoToBinaryFile(index, key_index);
+    }
+  }
+  for (int i = data_param.shard_id(); i < index.key_size();
+       i += data_param.num_shards()) {
+    keys_.push_back(index.key(i));
+  }
+  CHECK(!keys_.empty()) << "Not enough records in " << data_param.source()
+      << " for shard " << data_param.shard_id();
+  LOG(INFO) << "Shuffling " << keys_.size() << " records in blocks of "
+      << data_param.shuffle_block();
+}
+
+void DataReader::Body::ShuffleKeys() {
+  const int block = param_.data_param().shuffle_block();
+  const int num_keys = keys_.size();
+  vector<int> blocks((num_keys + block - 1) / block);
+  for (int i = 0; i < blocks.size(); ++i) {
+    blocks[i] = i;
+  }
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+  shuffle(blocks.begin(), blocks.end(), rng);
+  order_.clear();
+  for (int i = 0; i < blocks.size(); ++i) {
+    const int end = std::min((blocks[i] + 1) * block, num_keys);
+    for (int k = blocks[i] * block; k < end; ++k) {
+      order_.push_back(k);
+    }
+  }
+}
+
+void DataReader::Body::SeekKey(db::Cursor* cursor) {
+  const string& key = keys_[order_[order_pos_]];
+  cursor->Seek(key);
+  CHECK(cursor->valid() && cursor->key() == key)
+      << "Key index out of date for " << param_.data_param().source();
+}
+
+}  // namespace caffe
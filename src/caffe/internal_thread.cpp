@@ -4,13 +4,17 @@
 namespace caffe {
 
 InternalThread::~InternalThread() {
-  WaitForInternalThreadToExit();
+  StopInternalThread();
 }
 
 bool InternalThread::is_started() const {
   return thread_.get() != NULL && thread_->joinable();
 }
 
+bool InternalThread::must_stop() {
+  return thread_.get() != NULL && thread_->interruption_requested();
+}
+
 
 bool InternalThread::StartInternalThread() {
   if (!WaitForInternalThreadToExit()) {
@@ -37,4 +41,11 @@ bool InternalThread::WaitForInternalThreadToExit() {
   return true;
 }
 
+bool InternalThread::StopInternalThread() {
+  if (is_started()) {
+    thread_->interrupt();
+  }
+  return WaitForInternalThreadToExit();
+}
+
 }  // namespace caffe
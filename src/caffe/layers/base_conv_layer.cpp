@@ -1,13 +1,19 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// Memory, in MB, that CPU tuning may spend on lowering several images at once
+// when cpu_batch_memory is lower
+const size_t kTuningBatchMemory = 256;
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -72,6 +78,19 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // - blobs_[0] holds the filter weights
   // - blobs_[1] holds the biases (optional)
   bias_term_ = this->layer_param_.convolution_param().bias_term();
+  fused_relu_ = this->layer_param_.has_relu_param();
+  relu_negative_slope_ = this->layer_param_.relu_param().negative_slope();
+  quantized_ = this->layer_param_.has_quantization_param() &&
+      this->phase_ == TEST;
+  if (quantized_) {
+    CHECK(!reverse_dimensions()) << "Deconvolution cannot be quantized";
+    const float input_max =
+        this->layer_param_.quantization_param().input_max();
+    CHECK_GT(input_max, 0) << "Quantization needs a calibrated input_max";
+    input_scale_ = input_max / 127;
+  }
+  sparsity_threshold_ =
+      this->layer_param_.convolution_param().sparsity_threshold();
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
   } else {
@@ -146,6 +165,42 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   } else {
     col_buffer_.Reshape(1, kernel_dim_, height_out_, width_out_);
   }
+  // Lower several images at once on CPU if the memory budget, or the tuned
+  // variant, allows it. Deconvolution keeps lowering one image at a time.
+  const size_t image_size = (kernel_dim_ + conv_out_channels_) *
+      conv_out_spatial_dim_ * sizeof(Dtype);
+  const size_t budget = static_cast<size_t>(
+      this->layer_param_.convolution_param().cpu_batch_memory()) << 20;
+  if (reverse_dimensions() || quantized_) {
+    cpu_batch_ = 1;
+  } else if (cpu_variant_.batch > 0) {
+    cpu_batch_ = std::min(cpu_variant_.batch, num_);
+  } else {
+    cpu_batch_ = std::max<int>(1, std::min<size_t>(num_, budget / image_size));
+  }
+  if (cpu_batch_ > 1) {
+    if (!batch_col_buffer_) {
+      batch_col_buffer_.reset(new Blob<Dtype>());
+      batch_output_buffer_.reset(new Blob<Dtype>());
+    }
+    batch_col_buffer_->Reshape(cpu_batch_, kernel_dim_, height_out_,
+        width_out_);
+    batch_output_buffer_->Reshape(cpu_batch_, conv_out_channels_,
+        height_out_, width_out_);
+  }
+  if (quantized_) {
+    const size_t input_dim = conv_in_channels_ * conv_in_height_ *
+        conv_in_width_;
+    if (!quantized_input_ || quantized_input_->size() != input_dim) {
+      quantized_input_.reset(new SyncedMemory(input_dim));
+    }
+    const size_t col_dim = kernel_dim_ * conv_out_spatial_dim_;
+    if (!is_1x1_ && (!quantized_col_buffer_ ||
+        quantized_col_buffer_->size() != col_dim)) {
+      quantized_col_buffer_.reset(new SyncedMemory(col_dim));
+    }
+    quantized_output_.Reshape(1, conv_out_channels_, height_out_, width_out_);
+  }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
     vector<int> bias_multiplier_shape(1, height_out_ * width_out_);
@@ -155,6 +210,46 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+vector<ConvolutionCPUVariant> BaseConvolutionLayer<Dtype>::cpu_variants() {
+  // Batches of 1, 2, 4... images up to num_, within the larger of
+  // cpu_batch_memory and kTuningBatchMemory
+  vector<int> batches(1, 1);
+  if (!reverse_dimensions()) {
+    const size_t image_size = (kernel_dim_ + conv_out_channels_) *
+        conv_out_spatial_dim_ * sizeof(Dtype);
+    const size_t budget = std::max<size_t>(
+        this->layer_param_.convolution_param().cpu_batch_memory(),
+        kTuningBatchMemory) << 20;
+    for (int batch = 2; batches.back() < num_; batch *= 2) {
+      if (std::min(batch, num_) * image_size > budget) {
+        break;
+      }
+      batches.push_back(std::min(batch, num_));
+    }
+  }
+  // All threads, half of them... down to one
+  vector<int> threads;
+  for (int t = openmp_max_threads(); t > 0; t /= 2) {
+    threads.push_back(t);
+  }
+  vector<ConvolutionCPUVariant> variants;
+  for (int i = 0; i < batches.size(); ++i) {
+    for (int j = 0; j < threads.size(); ++j) {
+      variants.push_back(ConvolutionCPUVariant(0, batches[i], threads[j]));
+    }
+  }
+  return variants;
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::set_cpu_variant(
+    const ConvolutionCPUVariant& variant) {
+  cpu_variant_ = variant;
+  batch_col_buffer_.reset();
+  batch_output_buffer_.reset();
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
@@ -181,6 +276,93 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
       (Dtype)1., output);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_epilogue(Dtype* output) {
+  if (!fused_relu_) {
+    if (bias_term_) {
+      forward_cpu_bias(output, this->blobs_[1]->cpu_data());
+    }
+    return;
+  }
+  const int spatial_dim = height_out_ * width_out_;
+  const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int c = 0; c < num_output_; ++c) {
+    const Dtype b = bias ? bias[c] : Dtype(0);
+    Dtype* out = output + spatial_dim * c;
+    for (int i = 0; i < spatial_dim; ++i) {
+      const Dtype value = out[i] + b;
+      out[i] = std::max(value, Dtype(0))
+          + relu_negative_slope_ * std::min(value, Dtype(0));
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_sparse(const Dtype* input,
+    Dtype* output) {
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    col_buff = col_buffer_.cpu_data();
+  }
+  const int rows = conv_out_channels_ / group_;
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_csr_gemm(rows, conv_out_spatial_dim_,
+        sparse_weights_.row_ptr() + rows * g, sparse_weights_.col(),
+        sparse_weights_.val(), col_buff + col_offset_ * g,
+        output + output_offset_ * g);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_quantized(const Dtype* input,
+    Dtype* output) {
+  // Weights loaded or shared after the first Forward, as when tuning runs
+  // it at init, are quantized anew.
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  if (!quantized_weights_ || quantized_source_.lock() != weights.data() ||
+      quantized_version_ != weights.data()->version()) {
+    quantized_weights_.reset(new SyncedMemory(weights.count()));
+    weight_scales_.Reshape(vector<int>(1, conv_out_channels_));
+    caffe_cpu_quantize_rows(conv_out_channels_,
+        weights.count() / conv_out_channels_, weights.cpu_data(),
+        static_cast<int8_t*>(quantized_weights_->mutable_cpu_data()),
+        weight_scales_.mutable_cpu_data());
+    quantized_source_ = weights.data();
+    quantized_version_ = weights.data()->version();
+  }
+  int8_t* input_q = static_cast<int8_t*>(quantized_input_->mutable_cpu_data());
+  caffe_cpu_quantize(conv_in_channels_ * conv_in_height_ * conv_in_width_,
+      input, input_scale_, input_q);
+  const int8_t* col_q = input_q;
+  if (!is_1x1_) {
+    int8_t* col_buff =
+        static_cast<int8_t*>(quantized_col_buffer_->mutable_cpu_data());
+    im2col_cpu(input_q, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, col_buff);
+    col_q = col_buff;
+  }
+  const int8_t* weights_q =
+      static_cast<const int8_t*>(quantized_weights_->cpu_data());
+  int* output_q = quantized_output_.mutable_cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm_s8(CblasNoTrans, conv_out_channels_ / group_,
+        conv_out_spatial_dim_, kernel_dim_ / group_,
+        weights_q + weight_offset_ * g, col_q + col_offset_ * g,
+        output_q + output_offset_ * g);
+  }
+  // Back to real values, by the scales of the input and the output channel
+  const Dtype* weight_scales = weight_scales_.cpu_data();
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    const Dtype scale = input_scale_ * weight_scales[c];
+    const int* in = output_q + conv_out_spatial_dim_ * c;
+    Dtype* out = output + conv_out_spatial_dim_ * c;
+    for (int i = 0; i < conv_out_spatial_dim_; ++i) {
+      out[i] = in[i] * scale;
+    }
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
@@ -222,6 +404,65 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_batch(const Dtype* input,
+    int batch, const Dtype* weights, Dtype* output) {
+  CHECK_LE(batch, cpu_batch_);
+  const int input_dim = conv_in_channels_ * conv_in_height_ * conv_in_width_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  const int width = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_->mutable_cpu_data();
+  for (int n = 0; n < batch; ++n) {
+    conv_im2col_cpu(input + input_dim * n, width,
+        col_buff + conv_out_spatial_dim_ * n);
+  }
+  Dtype* output_buff = batch_output_buffer_->mutable_cpu_data();
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+        group_, width, kernel_dim_ / group_,
+        (Dtype)1., weights + weight_offset_ * g, col_buff + col_offset_ *
+        batch * g, (Dtype)0., output_buff + output_offset_ * batch * g);
+  }
+  // Scatter the output rows back to their images
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    for (int n = 0; n < batch; ++n) {
+      caffe_copy(conv_out_spatial_dim_, output_buff + width * c +
+          conv_out_spatial_dim_ * n,
+          output + output_dim * n + conv_out_spatial_dim_ * c);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_gemm_batch(const Dtype* input,
+    const Dtype* output, int batch, Dtype* weights) {
+  CHECK_LE(batch, cpu_batch_);
+  const int input_dim = conv_in_channels_ * conv_in_height_ * conv_in_width_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  const int width = batch * conv_out_spatial_dim_;
+  Dtype* col_buff = batch_col_buffer_->mutable_cpu_data();
+  for (int n = 0; n < batch; ++n) {
+    conv_im2col_cpu(input + input_dim * n, width,
+        col_buff + conv_out_spatial_dim_ * n);
+  }
+  // Gather the output rows of the images side by side
+  Dtype* output_buff = batch_output_buffer_->mutable_cpu_data();
+  for (int c = 0; c < conv_out_channels_; ++c) {
+    for (int n = 0; n < batch; ++n) {
+      caffe_copy(conv_out_spatial_dim_,
+          output + output_dim * n + conv_out_spatial_dim_ * c,
+          output_buff + width * c + conv_out_spatial_dim_ * n);
+    }
+  }
+  for (int g = 0; g < group_; ++g) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
+        kernel_dim_ / group_, width,
+        (Dtype)1., output_buff + output_offset_ * batch * g,
+        col_buff + col_offset_ * batch * g,
+        (Dtype)1., weights + weight_offset_ * g);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
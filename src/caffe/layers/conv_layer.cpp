@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -19,24 +21,63 @@ void ConvolutionLayer<Dtype>::compute_output_shape() {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  const Dtype* weight = this->blobs_[0]->cpu_data();
+  OpenMPThreads threads(this->cpu_variant_.threads);
+  const Blob<Dtype>& weights = *this->blobs_[0];
+  const Dtype* weight;
+  if (weights.stores_half()) {
+    // Unpacked for this Forward only
+    this->half_weights_.ReshapeLike(weights);
+    caffe_cpu_from_half(weights.count(), weights.half_data(),
+        this->half_weights_.mutable_cpu_data());
+    weight = this->half_weights_.cpu_data();
+  } else {
+    weight = weights.cpu_data();
+  }
+  // Pruned weights are multiplied in sparse form, outside of training.
+  const bool sparse = !this->quantized_ && !weights.stores_half() &&
+      this->phase_ == TEST && this->sparse_weights_.Update(weights,
+      this->num_output_, this->sparsity_threshold_);
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
-    for (int n = 0; n < this->num_; ++n) {
-      this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
-          top_data + top[i]->offset(n));
-      if (this->bias_term_) {
-        const Dtype* bias = this->blobs_[1]->cpu_data();
-        this->forward_cpu_bias(top_data + top[i]->offset(n), bias);
+    if (this->quantized_ || sparse) {
+      for (int n = 0; n < this->num_; ++n) {
+        if (sparse) {
+          this->forward_cpu_sparse(bottom_data + bottom[i]->offset(n),
+              top_data + top[i]->offset(n));
+        } else {
+          this->forward_cpu_quantized(bottom_data + bottom[i]->offset(n),
+              top_data + top[i]->offset(n));
+        }
+        this->forward_cpu_epilogue(top_data + top[i]->offset(n));
+      }
+      continue;
+    }
+    for (int n = 0; n < this->num_; n += this->cpu_batch_) {
+      const int batch = std::min(this->cpu_batch_, this->num_ - n);
+      if (batch > 1) {
+        this->forward_cpu_gemm_batch(bottom_data + bottom[i]->offset(n),
+            batch, weight, top_data + top[i]->offset(n));
+      } else {
+        this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
+            top_data + top[i]->offset(n));
+      }
+      for (int b = n; b < n + batch; ++b) {
+        this->forward_cpu_epilogue(top_data + top[i]->offset(b));
       }
     }
   }
+  if (weights.stores_half()) {
+    this->half_weights_.data()->Release();
+  }
 }
 
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->fused_relu_) << "Layers with a fused ReLU have no Backward";
+  CHECK(!this->quantized_) << "Quantized layers have no Backward";
+  OpenMPThreads threads(this->cpu_variant_.threads);
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   for (int i = 0; i < top.size(); ++i) {
@@ -51,16 +92,24 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       }
     }
     if (this->param_propagate_down_[0] || propagate_down[i]) {
-      for (int n = 0; n < this->num_; ++n) {
+      for (int n = 0; n < this->num_; n += this->cpu_batch_) {
+        const int batch = std::min(this->cpu_batch_, this->num_ - n);
         // gradient w.r.t. weight. Note that we will accumulate diffs.
         if (this->param_propagate_down_[0]) {
-          this->weight_cpu_gemm(bottom_data + bottom[i]->offset(n),
-              top_diff + top[i]->offset(n), weight_diff);
+          if (batch > 1) {
+            this->weight_cpu_gemm_batch(bottom_data + bottom[i]->offset(n),
+                top_diff + top[i]->offset(n), batch, weight_diff);
+          } else {
+            this->weight_cpu_gemm(bottom_data + bottom[i]->offset(n),
+                top_diff + top[i]->offset(n), weight_diff);
+          }
         }
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
-          this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
-              bottom_diff + bottom[i]->offset(n));
+          for (int b = n; b < n + batch; ++b) {
+            this->backward_cpu_gemm(top_diff + top[i]->offset(b), weight,
+                bottom_diff + bottom[i]->offset(b));
+          }
         }
       }
     }
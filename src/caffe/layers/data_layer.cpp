@@ -1,3 +1,4 @@
+#include <boost/thread.hpp>
 #include <opencv2/core/core.hpp>
 
 #include <stdint.h>
@@ -16,38 +17,72 @@
 
 namespace caffe {
 
+// Transforms its share of every batch on its own thread, with its own
+// DataTransformer so that random crops and mirrors use an independent RNG.
+template <typename Dtype>
+class DataLayer<Dtype>::TransformWorker : public InternalThread {
+ public:
+  TransformWorker(DataLayer<Dtype>* layer, int id)
+      : layer_(layer), id_(id),
+        transformer_(layer->transform_param_, layer->phase_) {
+    transformer_.InitRand();
+  }
+  virtual ~TransformWorker() {
+    StopInternalThread();
+  }
+
+  BlockingQueue<Batch<Dtype>*> todo_;
+  Blob<Dtype> transformed_data_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    try {
+      while (!must_stop()) {
+        Batch<Dtype>* batch = todo_.pop();
+        layer_->TransformItems(&transformer_, &transformed_data_, id_,
+            layer_->workers_.size() + 1);
+        layer_->workers_done_.push(batch);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  DataLayer<Dtype>* layer_;
+  int id_;
+  DataTransformer<Dtype> transformer_;
+};
+
+template <typename Dtype>
+DataLayer<Dtype>::DataLayer(const LayerParameter& param)
+    : BasePrefetchingDataLayer<Dtype>(param),
+      reader_(param), batch_data_(NULL), batch_label_(NULL) {
+}
+
 template <typename Dtype>
 DataLayer<Dtype>::~DataLayer<Dtype>() {
-  this->JoinPrefetchThread();
+  this->StopInternalThread();
+  // Workers may still be finishing their share of an interrupted batch, and
+  // report to workers_done_, so they must exit before it is destroyed.
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->StopInternalThread();
+  }
 }
 
 template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  // Initialize DB
-  db_.reset(db::GetDB(this->layer_param_.data_param().backend()));
-  db_->Open(this->layer_param_.data_param().source(), db::READ);
-  cursor_.reset(db_->NewCursor());
-
-  // Check if we should randomly skip a few data points
-  if (this->layer_param_.data_param().rand_skip()) {
-    unsigned int skip = caffe_rng_rand() %
-                        this->layer_param_.data_param().rand_skip();
-    LOG(INFO) << "Skipping first " << skip << " data points.";
-    while (skip-- > 0) {
-      cursor_->Next();
-    }
-  }
   // Read a data point, to initialize the prefetch and top blobs.
-  Datum datum;
-  datum.ParseFromString(cursor_->value());
+  Datum& datum = *(reader_.full().peek());
   // Use data_transformer to infer the expected blob shape from datum.
   vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
   this->transformed_data_.Reshape(top_shape);
   // Reshape top[0] and prefetch_data according to the batch_size.
   top_shape[0] = this->layer_param_.data_param().batch_size();
-  this->prefetch_data_.Reshape(top_shape);
-  top[0]->ReshapeLike(this->prefetch_data_);
+  top[0]->Reshape(top_shape);
+  for (int i = 0; i < this->prefetch_.size(); ++i) {
+    this->prefetch_[i]->data_.Reshape(top_shape);
+  }
 
   LOG(INFO) << "output data size: " << top[0]->num() << ","
       << top[0]->channels() << "," << top[0]->height() << ","
@@ -56,62 +91,74 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (this->output_labels_) {
     vector<int> label_shape(1, this->layer_param_.data_param().batch_size());
     top[1]->Reshape(label_shape);
-    this->prefetch_label_.Reshape(label_shape);
+    for (int i = 0; i < this->prefetch_.size(); ++i) {
+      this->prefetch_[i]->label_.Reshape(label_shape);
+    }
+  }
+  datums_.resize(this->layer_param_.data_param().batch_size());
+  // Start the threads helping the prefetch thread to transform batches.
+  const int transform_threads =
+      this->layer_param_.data_param().transform_threads();
+  CHECK_GT(transform_threads, 0) << "transform_threads must be positive";
+  if (transform_threads > 1) {
+    LOG(INFO) << "Transforming data on " << transform_threads << " threads";
+  }
+  for (int i = 1; i < transform_threads; ++i) {
+    workers_.push_back(shared_ptr<TransformWorker>(
+        new TransformWorker(this, i)));
+    CHECK(workers_.back()->StartInternalThread())
+        << "Thread execution failed";
   }
 }
 
-// This function is used to create a thread that prefetches the data.
+// This function is called on prefetch thread
 template <typename Dtype>
-void DataLayer<Dtype>::InternalThreadEntry() {
+void DataLayer<Dtype>::load_batch(Batch<Dtype>* batch) {
   CPUTimer batch_timer;
   batch_timer.Start();
   double read_time = 0;
   double trans_time = 0;
   CPUTimer timer;
-  CHECK(this->prefetch_data_.count());
+  CHECK(batch->data_.count());
   CHECK(this->transformed_data_.count());
+  const int batch_size = this->layer_param_.data_param().batch_size();
+
+  // Take the records of the whole batch from the reader.
+  timer.Start();
+  for (int item_id = 0; item_id < batch_size; ++item_id) {
+    datums_[item_id] = reader_.full().pop("Waiting for data");
+  }
+  read_time += timer.MicroSeconds();
 
   // Reshape according to the first datum of each batch
   // on single input batches allows for inputs of varying dimension.
-  const int batch_size = this->layer_param_.data_param().batch_size();
-  Datum datum;
-  datum.ParseFromString(cursor_->value());
   // Use data_transformer to infer the expected blob shape from datum.
-  vector<int> top_shape = this->data_transformer_->InferBlobShape(datum);
+  vector<int> top_shape =
+      this->data_transformer_->InferBlobShape(*datums_[0]);
   this->transformed_data_.Reshape(top_shape);
-  // Reshape prefetch_data according to the batch_size.
+  // Reshape batch according to the batch_size.
   top_shape[0] = batch_size;
-  this->prefetch_data_.Reshape(top_shape);
-
-  Dtype* top_data = this->prefetch_data_.mutable_cpu_data();
-  Dtype* top_label = NULL;  // suppress warnings about uninitialized variables
+  batch->data_.Reshape(top_shape);
+  // Take the batch to the CPU here, once, for the workers to write into.
+  batch_data_ = batch->data_.mutable_cpu_data();
+  batch_label_ = this->output_labels_ ? batch->label_.mutable_cpu_data() :
+      NULL;
 
-  if (this->output_labels_) {
-    top_label = this->prefetch_label_.mutable_cpu_data();
-  }
+  // Apply data transformations (mirror, scale, crop...), with the prefetch
+  // thread taking the first share of the items.
   timer.Start();
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_[i]->transformed_data_.ReshapeLike(this->transformed_data_);
+    workers_[i]->todo_.push(batch);
+  }
+  TransformItems(this->data_transformer_.get(), &this->transformed_data_,
+      0, workers_.size() + 1);
+  for (int i = 0; i < workers_.size(); ++i) {
+    workers_done_.pop();
+  }
+  trans_time += timer.MicroSeconds();
   for (int item_id = 0; item_id < batch_size; ++item_id) {
-    // get a datum
-    Datum datum;
-    datum.ParseFromString(cursor_->value());
-    read_time += timer.MicroSeconds();
-    timer.Start();
-    // Apply data transformations (mirror, scale, crop...)
-    int offset = this->prefetch_data_.offset(item_id);
-    this->transformed_data_.set_cpu_data(top_data + offset);
-    this->data_transformer_->Transform(datum, &(this->transformed_data_));
-    // Copy label.
-    if (this->output_labels_) {
-      top_label[item_id] = datum.label();
-    }
-    trans_time += timer.MicroSeconds();
-    timer.Start();
-    // go to the next item.
-    cursor_->Next();
-    if (!cursor_->valid()) {
-      DLOG(INFO) << "Restarting data prefetching from start.";
-      cursor_->SeekToFirst();
-    }
+    reader_.Recycle(datums_[item_id]);
   }
   timer.Stop();
   batch_timer.Stop();
@@ -120,6 +167,20 @@ void DataLayer<Dtype>::InternalThreadEntry() {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+template <typename Dtype>
+void DataLayer<Dtype>::TransformItems(DataTransformer<Dtype>* transformer,
+    Blob<Dtype>* transformed_data, int first, int stride) {
+  const int item_count = transformed_data->count();
+  for (int item_id = first; item_id < datums_.size(); item_id += stride) {
+    transformed_data->set_cpu_data(batch_data_ + item_id * item_count);
+    transformer->Transform(*datums_[item_id], transformed_data);
+    // Copy label.
+    if (batch_label_) {
+      batch_label_[item_id] = datums_[item_id]->label();
+    }
+  }
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
@@ -0,0 +1,329 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Grouped convolutions with up to this many input channels per group are
+// computed directly, as their GEMMs are too thin to pay off.
+const int kDirectMaxGroupChannels = 4;
+
+// Winograd F(m x m, 3x3) transforms: the input tile is BT d B, the weights
+// G g GT and the output AT M A. See Lavin & Gray, "Fast Algorithms for
+// Convolutional Neural Networks", 2015.
+static const double kBT2[4 * 4] = {
+  1,  0, -1,  0,
+  0,  1,  1,  0,
+  0, -1,  1,  0,
+  0,  1,  0, -1
+};
+static const double kG2[4 * 3] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1
+};
+static const double kAT2[2 * 4] = {
+  1, 1,  1,  0,
+  0, 1, -1, -1
+};
+static const double kBT4[6 * 6] = {
+  4,  0, -5,  0, 1, 0,
+  0, -4, -4,  1, 1, 0,
+  0,  4, -4, -1, 1, 0,
+  0, -2, -1,  2, 1, 0,
+  0,  2, -1, -2, 1, 0,
+  0,  4,  0, -5, 0, 1
+};
+static const double kG4[6 * 3] = {
+  1. / 4,         0,        0,
+  -1. / 6,  -1. / 6,  -1. / 6,
+  -1. / 6,   1. / 6,  -1. / 6,
+  1. / 24,  1. / 12,   1. / 6,
+  1. / 24, -1. / 12,   1. / 6,
+  0,              0,        1
+};
+static const double kAT4[4 * 6] = {
+  1, 1,  1, 1,  1, 0,
+  0, 1, -1, 2, -2, 0,
+  0, 1,  1, 4,  4, 0,
+  0, 1, -1, 8, -8, 1
+};
+
+// Y = L X LT, for a rows x cols matrix L and a cols x cols matrix X.
+template <typename Dtype>
+inline void winograd_transform(const double* L, const int rows, const int cols,
+    const Dtype* X, Dtype* Y) {
+  Dtype LX[6 * 6];
+  for (int r = 0; r < rows; ++r) {
+    for (int j = 0; j < cols; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += L[r * cols + k] * X[k * cols + j];
+      }
+      LX[r * cols + j] = sum;
+    }
+  }
+  for (int r = 0; r < rows; ++r) {
+    for (int s = 0; s < rows; ++s) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += LX[r * cols + k] * L[s * cols + k];
+      }
+      Y[r * rows + s] = sum;
+    }
+  }
+}
+
+template <typename Dtype>
+typename DirectConvolutionLayer<Dtype>::Algorithm
+DirectConvolutionLayer<Dtype>::shape_algorithm() const {
+  const int group_channels = this->channels_ / this->group_;
+  if (this->group_ > 1 && group_channels <= kDirectMaxGroupChannels) {
+    return DIRECT;
+  } else if (this->kernel_h_ == 3 && this->kernel_w_ == 3 &&
+      this->stride_h_ == 1 && this->stride_w_ == 1) {
+    return (this->height_out_ >= 4 && this->width_out_ >= 4) ?
+        WINOGRAD_4X4 : WINOGRAD_2X2;
+  }
+  return GEMM;
+}
+
+template <typename Dtype>
+vector<ConvolutionCPUVariant> DirectConvolutionLayer<Dtype>::cpu_variants() {
+  vector<ConvolutionCPUVariant> variants =
+      ConvolutionLayer<Dtype>::cpu_variants();
+  if (shape_algorithm() != GEMM) {
+    // The kernel convolves one image at a time
+    for (int t = openmp_max_threads(); t > 0; t /= 2) {
+      variants.push_back(ConvolutionCPUVariant(1, 1, t));
+    }
+  }
+  return variants;
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  const int group_channels = this->channels_ / this->group_;
+  const Algorithm previous = algorithm_;
+  algorithm_ = this->cpu_variant_.algorithm == 0 ? GEMM : shape_algorithm();
+  if (algorithm_ != previous) {
+    const char* names[] = {"GEMM", "Winograd F(2x2, 3x3)",
+        "Winograd F(4x4, 3x3)", "direct"};
+    LOG(INFO) << this->layer_param_.name() << " convolves on CPU with "
+        << names[algorithm_];
+  }
+  if (algorithm_ == WINOGRAD_2X2 || algorithm_ == WINOGRAD_4X4) {
+    tile_m_ = algorithm_ == WINOGRAD_2X2 ? 2 : 4;
+    const int tile_size = (tile_m_ + 2) * (tile_m_ + 2);
+    tiles_h_ = (this->height_out_ + tile_m_ - 1) / tile_m_;
+    tiles_w_ = (this->width_out_ + tile_m_ - 1) / tile_m_;
+    vector<int> shape(4);
+    shape[0] = this->group_;
+    shape[1] = tile_size;
+    shape[2] = this->num_output_ / this->group_;
+    shape[3] = group_channels;
+    winograd_weights_.Reshape(shape);
+    shape.resize(3);
+    shape[0] = tile_size;
+    shape[1] = group_channels;
+    shape[2] = tiles_h_ * tiles_w_;
+    winograd_input_.Reshape(shape);
+    shape[1] = this->num_output_ / this->group_;
+    winograd_output_.Reshape(shape);
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (algorithm_ == GEMM || this->quantized_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  OpenMPThreads threads(this->cpu_variant_.threads);
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  if (algorithm_ != DIRECT) {
+    winograd_cpu_weights(weight);
+  }
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      if (algorithm_ == DIRECT) {
+        direct_cpu_conv(bottom_data + bottom[i]->offset(n), weight,
+            top_data + top[i]->offset(n));
+      } else {
+        winograd_cpu_gemm(bottom_data + bottom[i]->offset(n),
+            top_data + top[i]->offset(n));
+      }
+      this->forward_cpu_epilogue(top_data + top[i]->offset(n));
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::winograd_cpu_weights(
+    const Dtype* weights) {
+  const double* G = tile_m_ == 2 ? kG2 : kG4;
+  const int a = tile_m_ + 2;
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+  const int filters = out_channels * in_channels;
+  Dtype* U = winograd_weights_.mutable_cpu_data();
+  for (int g = 0; g < this->group_; ++g) {
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int f = 0; f < filters; ++f) {
+      Dtype u[6 * 6];
+      winograd_transform(G, a, 3, weights + (g * filters + f) * 9, u);
+      for (int e = 0; e < a * a; ++e) {
+        U[(g * a * a + e) * filters + f] = u[e];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::winograd_cpu_gemm(const Dtype* input,
+    Dtype* output) {
+  const double* BT = tile_m_ == 2 ? kBT2 : kBT4;
+  const double* AT = tile_m_ == 2 ? kAT2 : kAT4;
+  const int m = tile_m_;
+  const int a = m + 2;
+  const int height = this->height_;
+  const int width = this->width_;
+  const int height_out = this->height_out_;
+  const int width_out = this->width_out_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+  const int tiles = tiles_h_ * tiles_w_;
+  const Dtype* U = winograd_weights_.cpu_data();
+  Dtype* V = winograd_input_.mutable_cpu_data();
+  Dtype* M = winograd_output_.mutable_cpu_data();
+  for (int g = 0; g < this->group_; ++g) {
+    // Transform the input tiles, which overlap by 2
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int c = 0; c < in_channels; ++c) {
+      const Dtype* im = input + (g * in_channels + c) * height * width;
+      Dtype d[6 * 6], v[6 * 6];
+      for (int t = 0; t < tiles; ++t) {
+        const int y0 = (t / tiles_w_) * m - this->pad_h_;
+        const int x0 = (t % tiles_w_) * m - this->pad_w_;
+        for (int i = 0; i < a; ++i) {
+          for (int j = 0; j < a; ++j) {
+            const int y = y0 + i;
+            const int x = x0 + j;
+            d[i * a + j] = (y >= 0 && y < height && x >= 0 && x < width) ?
+                im[y * width + x] : Dtype(0);
+          }
+        }
+        winograd_transform(BT, a, a, d, v);
+        for (int e = 0; e < a * a; ++e) {
+          V[(e * in_channels + c) * tiles + t] = v[e];
+        }
+      }
+    }
+    // One GEMM per tile element, over all tiles of the image
+    for (int e = 0; e < a * a; ++e) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels, tiles,
+          in_channels, (Dtype)1.,
+          U + (g * a * a + e) * out_channels * in_channels,
+          V + e * in_channels * tiles, (Dtype)0.,
+          M + e * out_channels * tiles);
+    }
+    // Transform back and write the tiles, clipped to the output
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int o = 0; o < out_channels; ++o) {
+      Dtype* out = output + (g * out_channels + o) * height_out * width_out;
+      Dtype mt[6 * 6], y[4 * 4];
+      for (int t = 0; t < tiles; ++t) {
+        for (int e = 0; e < a * a; ++e) {
+          mt[e] = M[(e * out_channels + o) * tiles + t];
+        }
+        winograd_transform(AT, m, a, mt, y);
+        const int y0 = (t / tiles_w_) * m;
+        const int x0 = (t % tiles_w_) * m;
+        const int rows = std::min(m, height_out - y0);
+        const int cols = std::min(m, width_out - x0);
+        for (int i = 0; i < rows; ++i) {
+          for (int j = 0; j < cols; ++j) {
+            out[(y0 + i) * width_out + x0 + j] = y[i * m + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::direct_cpu_conv(const Dtype* input,
+    const Dtype* weights, Dtype* output) {
+  const int height = this->height_;
+  const int width = this->width_;
+  const int height_out = this->height_out_;
+  const int width_out = this->width_out_;
+  const int kernel_h = this->kernel_h_;
+  const int kernel_w = this->kernel_w_;
+  const int stride_h = this->stride_h_;
+  const int stride_w = this->stride_w_;
+  const int pad_h = this->pad_h_;
+  const int pad_w = this->pad_w_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int o = 0; o < this->num_output_; ++o) {
+    const int g = o / out_channels;
+    Dtype* out = output + o * height_out * width_out;
+    std::fill(out, out + height_out * width_out, Dtype(0));
+    for (int c = 0; c < in_channels; ++c) {
+      const Dtype* im = input + (g * in_channels + c) * height * width;
+      const Dtype* w = weights + (o * in_channels + c) * kernel_h * kernel_w;
+      for (int kh = 0; kh < kernel_h; ++kh) {
+        for (int kw = 0; kw < kernel_w; ++kw) {
+          const Dtype weight = w[kh * kernel_w + kw];
+          // Output columns reading inside the image, as in im2col
+          const int offset = kw - pad_w;
+          const int w_end = width - offset <= 0 ? 0 :
+              std::min(width_out, (width - 1 - offset) / stride_w + 1);
+          const int w_begin = std::min(
+              offset < 0 ? (stride_w - 1 - offset) / stride_w : 0, w_end);
+          for (int h = 0; h < height_out; ++h) {
+            const int y = h * stride_h + kh - pad_h;
+            if (y < 0 || y >= height) {
+              continue;
+            }
+            const Dtype* im_row = im + y * width + offset;
+            Dtype* out_row = out + h * width_out;
+            if (stride_w == 1) {
+              for (int x = w_begin; x < w_end; ++x) {
+                out_row[x] += weight * im_row[x];
+              }
+            } else {
+              for (int x = w_begin; x < w_end; ++x) {
+                out_row[x] += weight * im_row[x * stride_w];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DirectConvolutionLayer);
+
+}  // namespace caffe
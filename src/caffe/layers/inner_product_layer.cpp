@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/blob.hpp"
@@ -9,11 +10,26 @@
 
 namespace caffe {
 
+// Weights unpacked at a time from half precision, as Dtype values
+const int kHalfPanelSize = 1 << 18;
+
 template <typename Dtype>
 void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const int num_output = this->layer_param_.inner_product_param().num_output();
   bias_term_ = this->layer_param_.inner_product_param().bias_term();
+  fused_relu_ = this->layer_param_.has_relu_param();
+  relu_negative_slope_ = this->layer_param_.relu_param().negative_slope();
+  quantized_ = this->layer_param_.has_quantization_param() &&
+      this->phase_ == TEST;
+  if (quantized_) {
+    const float input_max =
+        this->layer_param_.quantization_param().input_max();
+    CHECK_GT(input_max, 0) << "Quantization needs a calibrated input_max";
+    input_scale_ = input_max / 127;
+  }
+  sparsity_threshold_ =
+      this->layer_param_.inner_product_param().sparsity_threshold();
   N_ = num_output;
   const int axis = bottom[0]->CanonicalAxisIndex(
       this->layer_param_.inner_product_param().axis());
@@ -75,6 +91,16 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     bias_multiplier_.Reshape(bias_shape);
     caffe_set(M_, Dtype(1), bias_multiplier_.mutable_cpu_data());
   }
+  if (quantized_) {
+    const size_t input_size = M_ * K_;
+    if (!quantized_input_ || quantized_input_->size() != input_size) {
+      quantized_input_.reset(new SyncedMemory(input_size));
+    }
+    vector<int> output_shape(2);
+    output_shape[0] = M_;
+    output_shape[1] = N_;
+    quantized_output_.Reshape(output_shape);
+  }
 }
 
 template <typename Dtype>
@@ -82,10 +108,77 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
-  if (bias_term_) {
+  if (quantized_) {
+    // Weights loaded or shared after the first Forward are quantized anew.
+    const shared_ptr<SyncedMemory>& weight_data = this->blobs_[0]->data();
+    if (!quantized_weights_ || quantized_source_.lock() != weight_data ||
+        quantized_version_ != weight_data->version()) {
+      quantized_weights_.reset(new SyncedMemory(N_ * K_));
+      weight_scales_.Reshape(vector<int>(1, N_));
+      caffe_cpu_quantize_rows(N_, K_, this->blobs_[0]->cpu_data(),
+          static_cast<int8_t*>(quantized_weights_->mutable_cpu_data()),
+          weight_scales_.mutable_cpu_data());
+      quantized_source_ = weight_data;
+      quantized_version_ = weight_data->version();
+    }
+    int8_t* bottom_q =
+        static_cast<int8_t*>(quantized_input_->mutable_cpu_data());
+    caffe_cpu_quantize(M_ * K_, bottom_data, input_scale_, bottom_q);
+    int* top_q = quantized_output_.mutable_cpu_data();
+    caffe_cpu_gemm_s8(CblasTrans, M_, N_, K_, bottom_q,
+        static_cast<const int8_t*>(quantized_weights_->cpu_data()), top_q);
+    // Back to real values, by the scales of the input and the output
+    const Dtype* weight_scales = weight_scales_.cpu_data();
+    for (int m = 0; m < M_; ++m) {
+      for (int n = 0; n < N_; ++n) {
+        top_data[N_ * m + n] =
+            top_q[N_ * m + n] * (input_scale_ * weight_scales[n]);
+      }
+    }
+  } else if (this->blobs_[0]->stores_half()) {
+    // The rows of the weights are unpacked a panel at a time, and the
+    // columns of the top they give copied in place.
+    const uint16_t* weight = this->blobs_[0]->half_data();
+    const int panel = std::max(1, std::min(N_, kHalfPanelSize / K_));
+    weight_panel_.Reshape(vector<int>(1, panel * K_));
+    Dtype* panel_data = weight_panel_.mutable_cpu_data();
+    Dtype* panel_top = top_data;
+    if (panel < N_) {
+      panel_output_.Reshape(vector<int>(1, M_ * panel));
+      panel_top = panel_output_.mutable_cpu_data();
+    }
+    for (int n0 = 0; n0 < N_; n0 += panel) {
+      const int rows = std::min(panel, N_ - n0);
+      caffe_cpu_from_half(rows * K_, weight + n0 * K_, panel_data);
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, rows, K_,
+          (Dtype)1., bottom_data, panel_data, (Dtype)0., panel_top);
+      if (panel_top != top_data) {
+        for (int m = 0; m < M_; ++m) {
+          caffe_copy(rows, panel_top + rows * m, top_data + N_ * m + n0);
+        }
+      }
+    }
+  } else if (this->phase_ == TEST && sparse_weights_.Update(
+      *this->blobs_[0], N_, sparsity_threshold_)) {
+    // Pruned weights are multiplied in sparse form, outside of training.
+    caffe_cpu_gemm_csr_t(M_, N_, K_, bottom_data, sparse_weights_.row_ptr(),
+        sparse_weights_.col(), sparse_weights_.val(), top_data);
+  } else {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, this->blobs_[0]->cpu_data(), (Dtype)0., top_data);
+  }
+  if (fused_relu_) {
+    // Add the bias and apply the ReLU in one pass
+    const Dtype* bias = bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+    for (int m = 0; m < M_; ++m) {
+      Dtype* out = top_data + N_ * m;
+      for (int n = 0; n < N_; ++n) {
+        const Dtype value = bias ? out[n] + bias[n] : out[n];
+        out[n] = std::max(value, Dtype(0))
+            + relu_negative_slope_ * std::min(value, Dtype(0));
+      }
+    }
+  } else if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
         this->blobs_[1]->cpu_data(), (Dtype)1., top_data);
@@ -96,6 +189,8 @@ template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!fused_relu_) << "Layers with a fused ReLU have no Backward";
+  CHECK(!quantized_) << "Quantized layers have no Backward";
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 #include "caffe/layer.hpp"
@@ -6,6 +8,41 @@
 
 namespace caffe {
 
+// Spatial positions the CPU kernels process at once, across all channels
+static const int kLRNTile = 256;
+
+template <typename Dtype>
+static inline void lrn_accumulate_squares(int n, const Dtype* x, Dtype sign,
+    Dtype* accum) {
+  for (int i = 0; i < n; ++i) {
+    accum[i] += sign * x[i] * x[i];
+  }
+}
+
+template <typename Dtype>
+static inline void lrn_accumulate_ratios(int n, const Dtype* dy,
+    const Dtype* y, const Dtype* scale, Dtype sign, Dtype* accum) {
+  for (int i = 0; i < n; ++i) {
+    accum[i] += sign * dy[i] * y[i] / scale[i];
+  }
+}
+
+// out = x * scale^-beta, with two square roots in place of pow for the
+// usual beta of 0.75
+template <typename Dtype>
+static inline void lrn_scale_output(int n, const Dtype* x, const Dtype* scale,
+    Dtype beta, Dtype* out) {
+  if (beta == Dtype(0.75)) {
+    for (int i = 0; i < n; ++i) {
+      out[i] = x[i] / std::sqrt(scale[i] * std::sqrt(scale[i]));
+    }
+  } else {
+    for (int i = 0; i < n; ++i) {
+      out[i] = x[i] * std::pow(scale[i], -beta);
+    }
+  }
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -111,45 +148,40 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
+  const int spatial_dim = height_ * width_;
+  const int num_tiles = (spatial_dim + kLRNTile - 1) / kLRNTile;
+  const Dtype alpha_over_size = alpha_ / size_;
+  // Slide the window of squares over the channels of one spatial tile at a
+  // time, computing the scale and the output on the way.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int t = 0; t < num_ * num_tiles; ++t) {
+    const int offset = scale_.offset(t / num_tiles) +
+        (t % num_tiles) * kLRNTile;
+    const int tile = std::min(kLRNTile, spatial_dim - offset % spatial_dim);
+    const Dtype* x = bottom_data + offset;
+    Dtype accum[kLRNTile] = {0};
+    for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+      lrn_accumulate_squares(tile, x + spatial_dim * c, Dtype(1), accum);
     }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+    for (int c = 0; c < channels_; ++c) {
+      if (c + pre_pad_ < channels_) {
+        lrn_accumulate_squares(tile, x + spatial_dim * (c + pre_pad_),
+            Dtype(1), accum);
+      }
+      Dtype* scale = scale_data + offset + spatial_dim * c;
+      for (int i = 0; i < tile; ++i) {
+        scale[i] = k_ + alpha_over_size * accum[i];
+      }
+      lrn_scale_output(tile, x + spatial_dim * c, scale, beta_,
+          top_data + offset + spatial_dim * c);
+      if (c >= pre_pad_) {
+        lrn_accumulate_squares(tile, x + spatial_dim * (c - pre_pad_),
+            Dtype(-1), accum);
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -186,48 +218,44 @@ void LRNLayer<Dtype>::CrossChannelBackward_cpu(
   const Dtype* bottom_data = bottom[0]->cpu_data();
   const Dtype* scale_data = scale_.cpu_data();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
-
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+  const int spatial_dim = height_ * width_;
+  const int num_tiles = (spatial_dim + kLRNTile - 1) / kLRNTile;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  // Slide the window of the ratios diff_i * y_i / s_i over the channels of
+  // one spatial tile at a time, like Forward.
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int t = 0; t < num_ * num_tiles; ++t) {
+    const int offset = scale_.offset(t / num_tiles) +
+        (t % num_tiles) * kLRNTile;
+    const int tile = std::min(kLRNTile, spatial_dim - offset % spatial_dim);
+    const Dtype* dy = top_diff + offset;
+    const Dtype* y = top_data + offset;
+    const Dtype* scale = scale_data + offset;
+    Dtype accum[kLRNTile] = {0};
+    for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+      const int i = spatial_dim * c;
+      lrn_accumulate_ratios(tile, dy + i, y + i, scale + i, Dtype(1), accum);
     }
     for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+      if (c + pre_pad_ < channels_) {
+        const int h = spatial_dim * (c + pre_pad_);
+        lrn_accumulate_ratios(tile, dy + h, y + h, scale + h, Dtype(1),
+            accum);
+      }
+      const int i = spatial_dim * c;
+      const Dtype* x = bottom_data + offset + i;
+      Dtype* dx = bottom_diff + offset + i;
+      lrn_scale_output(tile, dy + i, scale + i, beta_, dx);
+      for (int j = 0; j < tile; ++j) {
+        dx[j] -= cache_ratio_value * x[j] * accum[j];
+      }
+      if (c >= pre_pad_) {
+        const int p = spatial_dim * (c - pre_pad_);
+        lrn_accumulate_ratios(tile, dy + p, y + p, scale + p, Dtype(-1),
+            accum);
+      }
     }
   }
 }
@@ -125,100 +125,155 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// Shape of the planes pooled by the CPU kernels
+struct PoolingGeometry {
+  int height, width, pooled_height, pooled_width;
+  int kernel_h, kernel_w, stride_h, stride_w, pad_h, pad_w;
+};
+
+// Max pools one plane, and with MASK writes the argmax to mask or top_mask,
+// and the max to top unless it is NULL. K and S, when not 0, fix a square
+// kernel and stride, so that the windows fully inside the plane unroll.
+template <typename Dtype, int K, int S, bool MASK>
+static void max_pool_plane(const PoolingGeometry& g, const Dtype* bottom,
+    Dtype* top, int* mask, Dtype* top_mask) {
+  const int kernel_h = K ? K : g.kernel_h;
+  const int kernel_w = K ? K : g.kernel_w;
+  const int stride_h = S ? S : g.stride_h;
+  const int stride_w = S ? S : g.stride_w;
+  for (int ph = 0; ph < g.pooled_height; ++ph) {
+    int hstart = ph * stride_h - g.pad_h;
+    const int hend = min(hstart + kernel_h, g.height);
+    hstart = max(hstart, 0);
+    for (int pw = 0; pw < g.pooled_width; ++pw) {
+      int wstart = pw * stride_w - g.pad_w;
+      const int wend = min(wstart + kernel_w, g.width);
+      wstart = max(wstart, 0);
+      Dtype value = -FLT_MAX;
+      int index = -1;
+      if (hend - hstart == kernel_h && wend - wstart == kernel_w) {
+        const Dtype* window = bottom + hstart * g.width + wstart;
+        for (int h = 0; h < kernel_h; ++h) {
+          for (int w = 0; w < kernel_w; ++w) {
+            const Dtype x = window[h * g.width + w];
+            if (MASK && x > value) {
+              index = (hstart + h) * g.width + wstart + w;
+            }
+            value = x > value ? x : value;
+          }
+        }
+      } else {
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const Dtype x = bottom[h * g.width + w];
+            if (MASK && x > value) {
+              index = h * g.width + w;
+            }
+            value = x > value ? x : value;
+          }
+        }
+      }
+      const int pool_index = ph * g.pooled_width + pw;
+      if (!MASK || top) {
+        top[pool_index] = value;
+      }
+      if (MASK && mask) {
+        mask[pool_index] = index;
+      } else if (MASK) {
+        top_mask[pool_index] = static_cast<Dtype>(index);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+struct MaxPoolPlane {
+  typedef void (*Kernel)(const PoolingGeometry&, const Dtype*, Dtype*, int*,
+      Dtype*);
+};
+
+template <typename Dtype, bool MASK>
+static typename MaxPoolPlane<Dtype>::Kernel max_pool_plane_kernel(
+    const PoolingGeometry& g) {
+  if (g.stride_h == 2 && g.stride_w == 2) {
+    if (g.kernel_h == 2 && g.kernel_w == 2) {
+      return max_pool_plane<Dtype, 2, 2, MASK>;
+    } else if (g.kernel_h == 3 && g.kernel_w == 3) {
+      return max_pool_plane<Dtype, 3, 2, MASK>;
+    }
+  }
+  return max_pool_plane<Dtype, 0, 0, MASK>;
+}
+
+template <typename Dtype>
+static void ave_pool_plane(const PoolingGeometry& g, const Dtype* bottom,
+    Dtype* top) {
+  for (int ph = 0; ph < g.pooled_height; ++ph) {
+    for (int pw = 0; pw < g.pooled_width; ++pw) {
+      int hstart = ph * g.stride_h - g.pad_h;
+      int wstart = pw * g.stride_w - g.pad_w;
+      int hend = min(hstart + g.kernel_h, g.height + g.pad_h);
+      int wend = min(wstart + g.kernel_w, g.width + g.pad_w);
+      const int pool_size = (hend - hstart) * (wend - wstart);
+      hstart = max(hstart, 0);
+      wstart = max(wstart, 0);
+      hend = min(hend, g.height);
+      wend = min(wend, g.width);
+      Dtype sum = 0;
+      for (int h = hstart; h < hend; ++h) {
+        for (int w = wstart; w < wend; ++w) {
+          sum += bottom[h * g.width + w];
+        }
+      }
+      top[ph * g.pooled_width + pw] = sum / pool_size;
+    }
+  }
+}
+
+// The planes of all images and channels are pooled in parallel.
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
-  // We'll output the mask to top[1] if it's of size >1.
+  const PoolingGeometry g = {height_, width_, pooled_height_, pooled_width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_};
+  const int num_planes = bottom[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  // We'll output the mask to top[1] if it's of size >1. Otherwise the mask
+  // is only kept in the TRAIN phase, and computed again by a Backward in
+  // the TEST phase.
   const bool use_top_mask = top.size() > 1;
   int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
+  typename MaxPoolPlane<Dtype>::Kernel max_pool = NULL;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
-    } else {
+    } else if (this->phase_ == TRAIN) {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
-            }
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
-      }
+    max_pool = (mask || top_mask) ? max_pool_plane_kernel<Dtype, true>(g) :
+        max_pool_plane_kernel<Dtype, false>(g);
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      max_pool(g, bottom_data + bottom_dim * i, top_data + top_dim * i,
+          mask ? mask + top_dim * i : NULL,
+          top_mask ? top_mask + top_dim * i : NULL);
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
-    }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
-            }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
-          }
-        }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-      }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      ave_pool_plane(g, bottom_data + bottom_dim * i, top_data + top_dim * i);
     }
     break;
   case PoolingParameter_PoolMethod_STOCHASTIC:
@@ -237,6 +292,11 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  const PoolingGeometry g = {height_, width_, pooled_height_, pooled_width_,
+      kernel_h_, kernel_w_, stride_h_, stride_w_, pad_h_, pad_w_};
+  const int num_planes = top[0]->num() * channels_;
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more codes.
   caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
@@ -246,58 +306,62 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const Dtype* top_mask = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
     } else {
+      if (this->phase_ != TRAIN) {
+        // Forward skipped the mask
+        const Dtype* bottom_data = bottom[0]->cpu_data();
+        int* max_idx = max_idx_.mutable_cpu_data();
+        typename MaxPoolPlane<Dtype>::Kernel max_pool =
+            max_pool_plane_kernel<Dtype, true>(g);
+#ifdef _OPENMP
+        #pragma omp parallel for
+#endif
+        for (int i = 0; i < num_planes; ++i) {
+          max_pool(g, bottom_data + bottom_dim * i, NULL,
+              max_idx + top_dim * i, NULL);
+        }
+      }
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      for (int index = top_dim * i; index < top_dim * (i + 1); ++index) {
+        const int bottom_index =
+            use_top_mask ? top_mask[index] : mask[index];
+        bottom_diff[bottom_dim * i + bottom_index] += top_diff[index];
       }
     }
     break;
   case PoolingParameter_PoolMethod_AVE:
     // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int i = 0; i < num_planes; ++i) {
+      const Dtype* plane_top_diff = top_diff + top_dim * i;
+      Dtype* plane_bottom_diff = bottom_diff + bottom_dim * i;
+      for (int ph = 0; ph < pooled_height_; ++ph) {
+        for (int pw = 0; pw < pooled_width_; ++pw) {
+          int hstart = ph * stride_h_ - pad_h_;
+          int wstart = pw * stride_w_ - pad_w_;
+          int hend = min(hstart + kernel_h_, height_ + pad_h_);
+          int wend = min(wstart + kernel_w_, width_ + pad_w_);
+          int pool_size = (hend - hstart) * (wend - wstart);
+          hstart = max(hstart, 0);
+          wstart = max(wstart, 0);
+          hend = min(hend, height_);
+          wend = min(wend, width_);
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              plane_bottom_diff[h * width_ + w] +=
+                plane_top_diff[ph * pooled_width_ + pw] / pool_size;
             }
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
     break;
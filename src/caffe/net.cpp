@@ -11,6 +11,8 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/cpu_tuning.hpp"
+#include "caffe/util/fuse_layers.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/math_functions.hpp"
@@ -46,6 +48,14 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
+  // Fuse layers, with splits inserted, when Backward will not run.
+  const bool fused = param.fuse_layers() && phase_ == TEST &&
+      !param.force_backward() && Caffe::mode() == Caffe::CPU;
+  if (fused) {
+    NetParameter split_param;
+    split_param.Swap(&param);
+    FuseLayers(split_param, &param);
+  }
   // Basically, build all the layers and set up their connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -95,7 +105,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     // Figure out this layer's input and output
     for (int bottom_id = 0; bottom_id < layer_param.bottom_size();
          ++bottom_id) {
-      const int blob_id = AppendBottom(param, layer_id, bottom_id,
+      const int blob_id = AppendBottom(param, layer_id, bottom_id, fused,
                                        &available_blobs, &blob_name_to_idx);
       // If a blob needs backward, this layer should provide it.
       need_backward |= blob_need_backward_[blob_id];
@@ -245,11 +255,352 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
   ShareWeights();
+  // Layers run Backward from the top, so the diff of a param, which the
+  // layers sharing it all add to, is final after the lowest of them.
+  vector<int> last_layer(learnable_params_.size(), 0);
+  for (int i = params_.size() - 1; i >= 0; --i) {
+    const int owner = param_owners_[i] < 0 ? i : param_owners_[i];
+    last_layer[learnable_param_ids_[owner]] = param_layer_indices_[i].first;
+  }
+  params_final_after_.assign(layers_.size(), vector<int>());
+  for (int i = 0; i < last_layer.size(); ++i) {
+    params_final_after_[last_layer[i]].push_back(i);
+  }
   debug_info_ = param.debug_info();
+  if (param.cpu_tuning() && Caffe::mode() == Caffe::CPU) {
+    TuneCPUConvolutions(this, param.cpu_tuning_cache());
+  }
+  if (param.recompute_layer_size() > 0) {
+    InitRecomputation(param);
+  }
+  if (param.reuse_blob_memory()) {
+    ReuseBlobMemory(param);
+  }
+  half_params_ = param.half_params();
+  if (half_params_ && phase_ == TEST && Caffe::mode() == Caffe::CPU) {
+    StoreParamsAsHalf();
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
 }
 
+template <typename Dtype>
+void Net<Dtype>::StoreParamsAsHalf() {
+  vector<bool> shared(params_.size(), false);
+  for (int i = 0; i < params_.size(); ++i) {
+    if (param_owners_[i] >= 0) {
+      shared[i] = true;
+      shared[param_owners_[i]] = true;
+    }
+  }
+  size_t bytes_saved = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int param_id = 0; param_id < param_id_vecs_[layer_id].size();
+         ++param_id) {
+      const int net_param_id = param_id_vecs_[layer_id][param_id];
+      if (shared[net_param_id] ||
+          !layers_[layer_id]->CanStoreParamAsHalf(param_id)) {
+        continue;
+      }
+      Blob<Dtype>* param = params_[net_param_id].get();
+      param->StoreHalf();
+      bytes_saved += param->count() * (sizeof(Dtype) - sizeof(uint16_t));
+    }
+  }
+  LOG(INFO) << "Storing params as half precision saves " << bytes_saved
+      << " bytes";
+}
+
+template <typename Dtype>
+void Net<Dtype>::InitRecomputation(const NetParameter& param) {
+  DataSharingGroups(&blob_group_);
+  vector<bool> recompute(layers_.size(), false);
+  for (int i = 0; i < param.recompute_layer_size(); ++i) {
+    const string& name = param.recompute_layer(i);
+    CHECK(layer_names_index_.count(name))
+        << "Unknown layer " << name << " in recompute_layer";
+    const int layer_id = layer_names_index_[name];
+    CHECK_GT(bottom_vecs_[layer_id].size(), 0)
+        << "Layer " << name << " has no bottoms to be recomputed from";
+    CHECK_NE(string(layers_[layer_id]->type()), "Dropout")
+        << "Dropout layer " << name << " cannot be recomputed";
+    recompute[layer_id] = true;
+  }
+  // The writers of a group are the layers computing its data, as opposed to
+  // the layers aliasing it, like Split and Flatten.
+  group_writers_.assign(blobs_.size(), vector<int>());
+  vector<int> last_use(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      last_use[blob_group_[bottom_id_vecs_[layer_id][i]]] = layer_id;
+    }
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int top = top_id_vecs_[layer_id][i];
+      const int g = blob_group_[top];
+      last_use[g] = layer_id;
+      bool alias = false;
+      for (int j = 0; j < bottom_id_vecs_[layer_id].size(); ++j) {
+        const int bottom = bottom_id_vecs_[layer_id][j];
+        alias |= bottom != top && blob_group_[bottom] == g;
+      }
+      vector<int>& writers = group_writers_[g];
+      if (!alias && (writers.empty() || writers.back() != layer_id)) {
+        writers.push_back(layer_id);
+      }
+    }
+  }
+  // Replaying a layer rewrites its tops, so the layers writing them in
+  // place have to be replayed along with it.
+  for (int g = 0; g < blobs_.size(); ++g) {
+    const vector<int>& writers = group_writers_[g];
+    for (int i = 1; i < writers.size(); ++i) {
+      CHECK_EQ(recompute[writers[0]], recompute[writers[i]])
+          << "Layers " << layer_names_[writers[0]] << " and "
+          << layer_names_[writers[i]] << " both write " << blob_names_[g]
+          << ", so either both or none have to be in recompute_layer";
+    }
+  }
+  group_droppable_.assign(blobs_.size(), false);
+  for (int g = 0; g < blobs_.size(); ++g) {
+    group_droppable_[g] = !group_writers_[g].empty() &&
+        recompute[group_writers_[g][0]];
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count() == 0 || blob_loss_weights_[blob_id] != 0) {
+      group_droppable_[blob_group_[blob_id]] = false;
+    }
+  }
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    group_droppable_[blob_group_[net_input_blob_indices_[i]]] = false;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    group_droppable_[blob_group_[net_output_blob_indices_[i]]] = false;
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(blob_names_index_.count(param.keep_blob(i)))
+        << "Unknown blob " << param.keep_blob(i) << " in keep_blob";
+    group_droppable_[blob_group_[blob_names_index_[param.keep_blob(i)]]] =
+        false;
+  }
+  // Drop the data of a group after its last consumer in Forward, and its
+  // data and diffs after its first writer in Backward.
+  group_written_.resize(blobs_.size());
+  for (int g = 0; g < blobs_.size(); ++g) {
+    group_written_[g] = group_writers_[g].size();
+  }
+  forward_release_.assign(layers_.size(), vector<int>());
+  backward_release_.assign(layers_.size(), vector<int>());
+  int num_dropped = 0;
+  for (int g = 0; g < blobs_.size(); ++g) {
+    if (group_droppable_[g]) {
+      forward_release_[last_use[g]].push_back(g);
+      backward_release_[group_writers_[g][0]].push_back(g);
+      ++num_dropped;
+    }
+  }
+  LOG(INFO) << "Recomputing the data of " << num_dropped
+      << " blob groups in Backward";
+}
+
+template <typename Dtype>
+void Net<Dtype>::Recompute(int group, int end) {
+  // Only the writers before end are replayed, so the group is only up to
+  // date for the layers reading it before the next writer.
+  const int written = GroupWritersBefore(group, end);
+  if (group_written_[group] >= written) {
+    return;
+  }
+  const vector<int>& writers = group_writers_[group];
+  for (int w = group_written_[group]; w < written; ++w) {
+    const int layer_id = writers[w];
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      const int g = blob_group_[bottom_id_vecs_[layer_id][i]];
+      if (g != group) {
+        Recompute(g, layer_id);
+      }
+    }
+    layers_[layer_id]->Forward(bottom_vecs_[layer_id], top_vecs_[layer_id]);
+  }
+  group_written_[group] = written;
+}
+
+template <typename Dtype>
+int Net<Dtype>::GroupWritersBefore(int group, int end) const {
+  const vector<int>& writers = group_writers_[group];
+  return std::lower_bound(writers.begin(), writers.end(), end) -
+      writers.begin();
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseGroup(int group, bool diff) {
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blob_group_[blob_id] == group) {
+      blobs_[blob_id]->data()->Release();
+      if (diff) {
+        blobs_[blob_id]->diff()->Release();
+      }
+    }
+  }
+  group_written_[group] = 0;
+}
+
+template <typename Dtype>
+void Net<Dtype>::DataSharingGroups(vector<int>* group) const {
+  group->resize(blobs_.size());
+  map<const SyncedMemory*, int> memory_group;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    (*group)[blob_id] = blob_id;
+    if (blobs_[blob_id]->count() > 0) {
+      const SyncedMemory* memory = blobs_[blob_id]->data().get();
+      if (memory_group.count(memory)) {
+        (*group)[blob_id] = memory_group[memory];
+      } else {
+        memory_group[memory] = blob_id;
+      }
+    }
+  }
+  // Split layers only share data with their tops in Forward
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (string(layers_[layer_id]->type()) == "Split") {
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        (*group)[top_id_vecs_[layer_id][i]] = bottom_id_vecs_[layer_id][0];
+      }
+    }
+  }
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    (*group)[blob_id] = (*group)[(*group)[blob_id]];
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReuseBlobMemory(const NetParameter& param) {
+  // Blobs sharing data, like the tops of Split and Flatten layers, form one
+  // group that lives as long as any of them.
+  vector<int> group;
+  DataSharingGroups(&group);
+  vector<bool> pinned(blobs_.size(), false);
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (blobs_[blob_id]->count() == 0) {
+      pinned[group[blob_id]] = true;
+    }
+  }
+  // Dropped and recomputed groups free their own memory
+  for (int g = 0; g < group_droppable_.size(); ++g) {
+    if (group_droppable_[g]) {
+      pinned[g] = true;
+    }
+  }
+  // Keep the memory of net inputs and outputs, of the blobs the user asked
+  // for, and of the blobs that backward reads.
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    pinned[group[net_input_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+    pinned[group[net_output_blob_indices_[i]]] = true;
+  }
+  for (int i = 0; i < param.keep_blob_size(); ++i) {
+    CHECK(blob_names_index_.count(param.keep_blob(i)))
+        << "Unknown blob " << param.keep_blob(i) << " in keep_blob";
+    pinned[group[blob_names_index_[param.keep_blob(i)]]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layer_need_backward_[layer_id]) {
+      for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+        pinned[group[bottom_id_vecs_[layer_id][i]]] = true;
+      }
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        pinned[group[top_id_vecs_[layer_id][i]]] = true;
+      }
+    }
+  }
+  // Nor may layers that point their tops elsewhere, like prefetching data
+  // layers, take the buffer along.
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (layers_[layer_id]->PointsTopsAtOwnMemory()) {
+      for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+        pinned[group[top_id_vecs_[layer_id][i]]] = true;
+      }
+    }
+  }
+  // Live range of each group, from its first producer to its last consumer
+  vector<int> begin(blobs_.size(), -1);
+  vector<int> end(blobs_.size(), -1);
+  vector<size_t> size(blobs_.size(), 0);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int blob_id = top_id_vecs_[layer_id][i];
+      const int g = group[blob_id];
+      if (begin[g] < 0) {
+        begin[g] = layer_id;
+      }
+      end[g] = layer_id;
+      size[g] = std::max(size[g], blobs_[blob_id]->count() * sizeof(Dtype));
+    }
+    for (int i = 0; i < bottom_id_vecs_[layer_id].size(); ++i) {
+      end[group[bottom_id_vecs_[layer_id][i]]] = layer_id;
+    }
+  }
+  // Assign the groups to buffers in layer order, taking the smallest free
+  // buffer large enough, or else growing the largest one, and freeing them
+  // after their last consumer.
+  vector<int> buffer(blobs_.size(), -1);
+  vector<size_t> buffer_size;
+  vector<int> free_buffers;
+  size_t naive_size = 0;
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int i = 0; i < top_id_vecs_[layer_id].size(); ++i) {
+      const int g = group[top_id_vecs_[layer_id][i]];
+      if (pinned[g] || begin[g] != layer_id || buffer[g] >= 0) {
+        continue;
+      }
+      naive_size += size[g];
+      int best = -1;
+      for (int j = 0; j < free_buffers.size(); ++j) {
+        const size_t candidate = buffer_size[free_buffers[j]];
+        if (best < 0) {
+          best = j;
+          continue;
+        }
+        const size_t current = buffer_size[free_buffers[best]];
+        if (current < size[g] ? candidate > current :
+            (candidate >= size[g] && candidate < current)) {
+          best = j;
+        }
+      }
+      if (best < 0) {
+        buffer[g] = buffer_size.size();
+        buffer_size.push_back(size[g]);
+      } else {
+        buffer[g] = free_buffers[best];
+        free_buffers.erase(free_buffers.begin() + best);
+        buffer_size[buffer[g]] = std::max(buffer_size[buffer[g]], size[g]);
+      }
+    }
+    for (int g = 0; g < blobs_.size(); ++g) {
+      if (buffer[g] >= 0 && end[g] == layer_id) {
+        free_buffers.push_back(buffer[g]);
+      }
+    }
+  }
+  vector<shared_ptr<SyncedMemory> > buffers(buffer_size.size());
+  size_t shared_size = 0;
+  for (int i = 0; i < buffers.size(); ++i) {
+    buffers[i].reset(new SyncedMemory(buffer_size[i]));
+    shared_size += buffer_size[i];
+  }
+  int num_shared = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (buffer[group[blob_id]] >= 0) {
+      blobs_[blob_id]->ShareDataMemory(buffers[buffer[group[blob_id]]]);
+      ++num_shared;
+    }
+  }
+  memory_used_ -= (naive_size - shared_size) / sizeof(Dtype);
+  LOG(INFO) << "Sharing memory of " << num_shared << " blobs in "
+      << buffers.size() << " buffers: " << shared_size << " bytes instead of "
+      << naive_size;
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -400,11 +751,13 @@ void Net<Dtype>::AppendTop(const NetParameter& param, const int layer_id,
 // Helper for Net::Init: add a new bottom blob to the net.
 template <typename Dtype>
 int Net<Dtype>::AppendBottom(const NetParameter& param, const int layer_id,
-    const int bottom_id, set<string>* available_blobs,
+    const int bottom_id, bool fused, set<string>* available_blobs,
     map<string, int>* blob_name_to_idx) {
   const LayerParameter& layer_param = param.layer(layer_id);
   const string& blob_name = layer_param.bottom(bottom_id);
-  if (available_blobs->find(blob_name) == available_blobs->end()) {
+  // Without the splits that FuseLayers removes, consumed blobs are read again
+  if (available_blobs->find(blob_name) == available_blobs->end() &&
+      !(fused && blob_name_to_idx->count(blob_name))) {
     LOG(FATAL) << "Unknown blob input " << blob_name
                << " (at index " << bottom_id << ") to layer " << layer_id;
   }
@@ -485,6 +838,7 @@ void Net<Dtype>::AppendParam(const NetParameter& param, const int layer_id,
       CHECK(this_blob->shape() == owner_blob->shape());
     }
     const int learnable_param_id = learnable_param_ids_[owner_net_param_id];
+    learnable_param_ids_.push_back(learnable_param_id);
     if (param_spec->has_lr_mult()) {
       if (has_params_lr_[learnable_param_id]) {
         CHECK_EQ(param_spec->lr_mult(), params_lr_[learnable_param_id])
@@ -517,11 +871,26 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       InputDebugInfo(i);
     }
   }
+  const bool recompute = !group_droppable_.empty();
   for (int i = start; i <= end; ++i) {
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
+    if (recompute) {
+      for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+        Recompute(blob_group_[bottom_id_vecs_[i][j]], i);
+      }
+    }
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
+    if (recompute) {
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        const int g = blob_group_[top_id_vecs_[i][j]];
+        group_written_[g] = GroupWritersBefore(g, i + 1);
+      }
+      for (int j = 0; j < forward_release_[i].size(); ++j) {
+        ReleaseGroup(forward_release_[i][j], false);
+      }
+    }
   }
   return loss;
 }
@@ -581,12 +950,31 @@ template <typename Dtype>
 void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
+  const bool recompute = !group_droppable_.empty();
   for (int i = start; i >= end; --i) {
     if (layer_need_backward_[i]) {
+      if (recompute) {
+        for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+          Recompute(blob_group_[bottom_id_vecs_[i][j]], layers_.size());
+        }
+        for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+          Recompute(blob_group_[top_id_vecs_[i][j]], layers_.size());
+        }
+      }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
     }
+    if (recompute) {
+      for (int j = 0; j < backward_release_[i].size(); ++j) {
+        ReleaseGroup(backward_release_[i][j], true);
+      }
+    }
+    if (!params_final_after_[i].empty()) {
+      for (int j = 0; j < param_diffs_ready_callbacks_.size(); ++j) {
+        param_diffs_ready_callbacks_[j]->ParamDiffsReady(i);
+      }
+    }
   }
 }
 
@@ -844,7 +1232,7 @@ void Net<Dtype>::ToProto(NetParameter* param, bool write_diff) const {
     for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
       layer_param->add_top(blob_names_[top_id_vecs_[i][j]]);
     }
-    layers_[i]->ToProto(layer_param, write_diff);
+    layers_[i]->ToProto(layer_param, write_diff, half_params_);
   }
 }
 
@@ -885,7 +1273,7 @@ void Net<Dtype>::ToHDF5(const string& filename, bool write_diff) const {
       if (param_owners_[net_param_id] == -1) {
         // Only save params that own themselves
         hdf5_save_nd_dataset<Dtype>(layer_data_hid, dataset_name.str(),
-            *params_[net_param_id]);
+            *params_[net_param_id], false, half_params_);
       }
       if (write_diff) {
         // Write diffs regardless of weight-sharing
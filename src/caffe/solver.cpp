@@ -1,22 +1,184 @@
+#include <boost/thread.hpp>
+
 #include <cstdio>
 
 #include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "hdf5.h"
 #include "hdf5_hl.h"
 
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/hdf5.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
 
+// A copy of the train net, sharing its weights, that computes its share of
+// every iteration on its own thread, as told by the solver.
+template <typename Dtype>
+class Solver<Dtype>::Replica : public InternalThread {
+ public:
+  enum Command { FORWARD_BACKWARD, REDUCE };
+
+  Replica(Solver<Dtype>* solver, const NetParameter& param, int id)
+      : net_(new Net<Dtype>(param)), loss_(0), solver_(solver), id_(id),
+        seed_(caffe_rng_rand()) {
+    net_->ShareTrainedLayersWith(solver->net_.get());
+  }
+  virtual ~Replica() {
+    StopInternalThread();
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+  BlockingQueue<int> todo_;
+  // Receives the id of the replica whenever it is done with a command
+  BlockingQueue<int> done_;
+  // The loss of the last FORWARD_BACKWARD, summed over iter_size
+  Dtype loss_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    Caffe::set_thread_random_seed(seed_);
+    Caffe::set_thread_cpu_threads(solver_->replica_cpu_threads_);
+    OpenMPThreads threads(solver_->replica_threads_);
+    vector<Blob<Dtype>*> bottom_vec;
+    try {
+      while (!must_stop()) {
+        if (todo_.pop() == FORWARD_BACKWARD) {
+          net_->ClearParamDiffs();
+          loss_ = 0;
+          for (int i = 0; i < solver_->param_.iter_size(); ++i) {
+            loss_ += net_->ForwardBackward(bottom_vec);
+          }
+        } else {
+          solver_->ReduceDiffs(id_);
+        }
+        done_.push(id_);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  Solver<Dtype>* solver_;
+  int id_;
+  unsigned int seed_;
+};
+
+// Sums the gradients of each layer of the train net over the ranks as soon as
+// backward is done with them, on its own thread, so that sending them to the
+// other ranks overlaps the backward passes of the layers below.
+template <typename Dtype>
+class Solver<Dtype>::Reducer : public InternalThread,
+    public Net<Dtype>::ParamDiffsReadyCallback {
+ public:
+  explicit Reducer(Solver<Dtype>* solver) : active_(false), solver_(solver) {}
+  virtual ~Reducer() {
+    StopInternalThread();
+  }
+
+  virtual void ParamDiffsReady(int layer_id) {
+    if (active_) {
+      todo_.push(layer_id);
+    }
+  }
+
+  // Whether backward is in the pass whose gradients are final, the last of
+  // iter_size
+  bool active_;
+  // The layers whose params to reduce, and -1 once backward is over
+  BlockingQueue<int> todo_;
+  // Receives a value once all layers before the -1 are reduced
+  BlockingQueue<int> done_;
+
+ protected:
+  virtual void InternalThreadEntry() {
+    try {
+      while (!must_stop()) {
+        const int layer_id = todo_.pop();
+        if (layer_id < 0) {
+          done_.push(0);
+        } else {
+          solver_->AllReduceDiffs(
+              solver_->net_->params_final_after(layer_id), NULL, &buffer_);
+        }
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  Solver<Dtype>* solver_;
+  vector<Dtype> buffer_;
+};
+
+// Writes the files of each snapshot on its own thread, so that training goes
+// on meanwhile. Training stages the protos of the next snapshot while those
+// of the last are written, and waits for them once it has staged all.
+template <typename Dtype>
+class Solver<Dtype>::SnapshotWriter : public InternalThread {
+ public:
+  SnapshotWriter() {
+    done_.push(0);
+  }
+  virtual ~SnapshotWriter() {
+    Wait();
+    StopInternalThread();
+  }
+
+  void Stage(shared_ptr<Message> proto, const string& filename) {
+    staged_.push_back(make_pair(proto, filename));
+  }
+  // Hands the staged protos over to be written, once the last are.
+  void Commit() {
+    done_.pop("Waiting for the previous snapshot to be written");
+    writing_.swap(staged_);
+    staged_.clear();
+    todo_.push(0);
+  }
+  // Returns once the committed protos are written.
+  void Wait() {
+    done_.push(done_.pop());
+  }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    try {
+      while (!must_stop()) {
+        todo_.pop();
+        for (int i = 0; i < writing_.size(); ++i) {
+          // A file is only ever found complete under its own name.
+          const string& filename = writing_[i].second;
+          const string temp_filename = filename + ".tmp";
+          WriteProtoToBinaryFile(*writing_[i].first, temp_filename);
+          CHECK_EQ(0, rename(temp_filename.c_str(), filename.c_str()))
+              << "Couldn't rename " << temp_filename << " to " << filename;
+        }
+        writing_.clear();
+        done_.push(0);
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted exception is expected on shutdown
+    }
+  }
+
+  vector<pair<shared_ptr<Message>, string> > staged_;
+  vector<pair<shared_ptr<Message>, string> > writing_;
+  BlockingQueue<int> todo_;
+  // Holds a value whenever no protos are being written
+  BlockingQueue<int> done_;
+};
+
 template <typename Dtype>
 Solver<Dtype>::Solver(const SolverParameter& param)
     : net_() {
@@ -83,7 +245,26 @@ void Solver<Dtype>::InitTrainNet() {
   net_state.MergeFrom(net_param.state());
   net_state.MergeFrom(param_.train_state());
   net_param.mutable_state()->CopyFrom(net_state);
+  const int replicas = param_.replicas();
+  CHECK_GE(replicas, 1) << "replicas must be positive";
+  replicas_.clear();
+  replica_threads_ = std::max(1, openmp_max_threads() / replicas);
+  replica_cpu_threads_ = replicas > 1 && Caffe::cpu_threads() > 0 ?
+      std::max(1, Caffe::cpu_threads() / replicas) : -1;
+  if (replicas > 1) {
+    CHECK_EQ(Caffe::mode(), Caffe::CPU) << "Replicas train on CPU only.";
+    LOG(INFO) << "Creating " << replicas - 1 << " replicas of the training "
+        << "net, with " << replica_threads_ << " threads each.";
+  }
+  // Tune the convolutions of the nets for the threads they will run on.
+  OpenMPThreads threads(replica_threads_);
   net_.reset(new Net<Dtype>(net_param));
+  for (int i = 1; i < replicas; ++i) {
+    replicas_.push_back(shared_ptr<Replica>(
+        new Replica(this, net_param, i)));
+    CHECK(replicas_.back()->StartInternalThread())
+        << "Thread execution failed";
+  }
 }
 
 template <typename Dtype>
@@ -164,29 +345,27 @@ void Solver<Dtype>::InitTestNets() {
 
 template <typename Dtype>
 void Solver<Dtype>::Step(int iters) {
-  vector<Blob<Dtype>*> bottom_vec;
   const int start_iter = iter_;
   const int stop_iter = iter_ + iters;
   int average_loss = this->param_.average_loss();
   vector<Dtype> losses;
   Dtype smoothed_loss = 0;
+  BroadcastParams();
 
   while (iter_ < stop_iter) {
     // zero-init the params
     net_->ClearParamDiffs();
     if (param_.test_interval() && iter_ % param_.test_interval() == 0
-        && (iter_ > 0 || param_.test_initialization())) {
+        && (iter_ > 0 || param_.test_initialization())
+        && Caffe::root_solver()) {
       TestAll();
     }
 
-    const bool display = param_.display() && iter_ % param_.display() == 0;
+    const bool display = param_.display() && iter_ % param_.display() == 0
+        && Caffe::root_solver();
     net_->set_debug_info(display && param_.debug_info());
     // accumulate the loss and gradient
-    Dtype loss = 0;
-    for (int i = 0; i < param_.iter_size(); ++i) {
-      loss += net_->ForwardBackward(bottom_vec);
-    }
-    loss /= param_.iter_size();
+    Dtype loss = ForwardBackward() / param_.iter_size();
     // average the loss across iterations for smoothed reporting
     if (losses.size() < average_loss) {
       losses.push_back(loss);
@@ -226,12 +405,179 @@ void Solver<Dtype>::Step(int iters) {
     ++iter_;
 
     // Save a snapshot if needed.
-    if (param_.snapshot() && iter_ % param_.snapshot() == 0) {
+    if (param_.snapshot() && iter_ % param_.snapshot() == 0
+        && Caffe::root_solver()) {
       Snapshot();
     }
   }
 }
 
+template <typename Dtype>
+Dtype Solver<Dtype>::ForwardBackward() {
+  vector<Blob<Dtype>*> bottom_vec;
+  Dtype loss = 0;
+  vector<int> param_ids(net_->learnable_params().size());
+  for (int i = 0; i < param_ids.size(); ++i) {
+    param_ids[i] = i;
+  }
+  if (replicas_.empty()) {
+    for (int i = 0; i < param_.iter_size(); ++i) {
+      if (reducer_ && i == param_.iter_size() - 1) {
+        reducer_->active_ = true;
+      }
+      loss += net_->ForwardBackward(bottom_vec);
+    }
+    if (reducer_) {
+      reducer_->active_ = false;
+      reducer_->todo_.push(-1);
+      reducer_->done_.pop();
+      // Only the loss is left
+      param_ids.clear();
+    }
+    AllReduceDiffs(param_ids, &loss, &communicator_buffer_);
+    return loss;
+  }
+  OpenMPThreads threads(replica_threads_);
+  for (int r = 0; r < replicas_.size(); ++r) {
+    replicas_[r]->todo_.push(Replica::FORWARD_BACKWARD);
+  }
+  Caffe::set_thread_cpu_threads(replica_cpu_threads_);
+  for (int i = 0; i < param_.iter_size(); ++i) {
+    loss += net_->ForwardBackward(bottom_vec);
+  }
+  Caffe::set_thread_cpu_threads(-1);
+  for (int r = 0; r < replicas_.size(); ++r) {
+    replicas_[r]->done_.pop();
+    loss += replicas_[r]->loss_;
+  }
+  // All nets are done, so the diffs can be looked up here once and summed
+  // in parallel. The weights are shared, so only net_ needs the sum.
+  const vector<Blob<Dtype>*>& params = net_->learnable_params();
+  diffs_.resize(params.size());
+  replica_diffs_.resize(replicas_.size());
+  for (int r = 0; r < replicas_.size(); ++r) {
+    const vector<Blob<Dtype>*>& replica_params =
+        replicas_[r]->net_->learnable_params();
+    replica_diffs_[r].resize(params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      replica_diffs_[r][i] = replica_params[i]->cpu_diff();
+    }
+  }
+  for (int i = 0; i < params.size(); ++i) {
+    diffs_[i] = params[i]->mutable_cpu_diff();
+  }
+  for (int r = 0; r < replicas_.size(); ++r) {
+    replicas_[r]->todo_.push(Replica::REDUCE);
+  }
+  ReduceDiffs(0);
+  for (int r = 0; r < replicas_.size(); ++r) {
+    replicas_[r]->done_.pop();
+  }
+  loss /= replicas_.size() + 1;
+  AllReduceDiffs(param_ids, &loss, &communicator_buffer_);
+  return loss;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::ReduceDiffs(int piece) {
+  const vector<Blob<Dtype>*>& params = net_->learnable_params();
+  int64_t total = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    total += params[i]->count();
+  }
+  // The piece of the gradients of all params laid end to end
+  const int pieces = replicas_.size() + 1;
+  const int64_t begin = total * piece / pieces;
+  const int64_t end = total * (piece + 1) / pieces;
+  int64_t offset = 0;
+  for (int i = 0; i < params.size() && offset < end; ++i) {
+    const int64_t count = params[i]->count();
+    const int64_t from = std::max(begin, offset);
+    const int64_t to = std::min(end, offset + count);
+    for (int r = 0; from < to && r < replicas_.size(); ++r) {
+      caffe_axpy<Dtype>(to - from, 1, replica_diffs_[r][i] + (from - offset),
+          diffs_[i] + (from - offset));
+    }
+    offset += count;
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::AllReduceDiffs(const vector<int>& param_ids,
+    Dtype* loss, vector<Dtype>* buffer) {
+  if (!communicator_ || communicator_->size() == 1) { return; }
+  // The gradients and the loss, laid end to end, go in one call, so that the
+  // ranks exchange few large messages.
+  const vector<Blob<Dtype>*>& params = net_->learnable_params();
+  int total = loss ? 1 : 0;
+  for (int i = 0; i < param_ids.size(); ++i) {
+    total += params[param_ids[i]]->count();
+  }
+  buffer->resize(total);
+  Dtype* values = &(*buffer)[0];
+  for (int i = 0, offset = 0; i < param_ids.size(); ++i) {
+    const Blob<Dtype>* param = params[param_ids[i]];
+    caffe_copy(param->count(), param->cpu_diff(), values + offset);
+    offset += param->count();
+  }
+  if (loss) {
+    values[total - 1] = *loss;
+  }
+  communicator_->AllReduce(values, total);
+  for (int i = 0, offset = 0; i < param_ids.size(); ++i) {
+    Blob<Dtype>* param = params[param_ids[i]];
+    caffe_copy(param->count(), values + offset, param->mutable_cpu_diff());
+    offset += param->count();
+  }
+  if (loss) {
+    *loss = values[total - 1] / communicator_->size();
+  }
+}
+
+template <typename Dtype>
+vector<shared_ptr<Net<Dtype> > > Solver<Dtype>::replica_nets() {
+  vector<shared_ptr<Net<Dtype> > > nets;
+  for (int r = 0; r < replicas_.size(); ++r) {
+    nets.push_back(replicas_[r]->net_);
+  }
+  return nets;
+}
+
+template <typename Dtype>
+void Solver<Dtype>::set_communicator(shared_ptr<Communicator> communicator) {
+  communicator_ = communicator;
+  // Replicas are summed only after all of backward, and GPU gradients would
+  // need copying on the thread of the reducer, so those reduce afterwards.
+  if (!reducer_ && communicator && communicator->size() > 1 &&
+      replicas_.empty() && Caffe::mode() == Caffe::CPU) {
+    reducer_.reset(new Reducer(this));
+    net_->add_param_diffs_ready_callback(reducer_.get());
+    CHECK(reducer_->StartInternalThread()) << "Thread execution failed";
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::BroadcastParams() {
+  if (!communicator_ || communicator_->size() == 1) { return; }
+  const vector<Blob<Dtype>*>& params = net_->learnable_params();
+  int total = 0;
+  for (int i = 0; i < params.size(); ++i) {
+    total += params[i]->count();
+  }
+  communicator_buffer_.resize(total);
+  Dtype* buffer = &communicator_buffer_[0];
+  for (int i = 0, offset = 0; i < params.size(); ++i) {
+    caffe_copy(params[i]->count(), params[i]->cpu_data(), buffer + offset);
+    offset += params[i]->count();
+  }
+  communicator_->Broadcast(buffer, total * sizeof(Dtype));
+  for (int i = 0, offset = 0; i < params.size(); ++i) {
+    caffe_copy(params[i]->count(), buffer + offset,
+        params[i]->mutable_cpu_data());
+    offset += params[i]->count();
+  }
+}
+
 template <typename Dtype>
 void Solver<Dtype>::Solve(const char* resume_file) {
   LOG(INFO) << "Solving " << net_->name();
@@ -248,7 +594,8 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   // If we haven't already, save a snapshot after optimization, unless
   // overridden by setting snapshot_after_train := false
   if (param_.snapshot_after_train()
-      && (!param_.snapshot() || iter_ % param_.snapshot() != 0)) {
+      && (!param_.snapshot() || iter_ % param_.snapshot() != 0)
+      && Caffe::root_solver()) {
     Snapshot();
   }
   // After the optimization is done, run an additional train and test pass to
@@ -257,6 +604,9 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   // training, for the train net we only run a forward pass as we've already
   // updated the parameters "max_iter" times -- this final pass is only done to
   // display the loss, which is computed in the forward pass.
+  if (!Caffe::root_solver()) {
+    return;
+  }
   if (param_.display() && iter_ % param_.display() == 0) {
     Dtype loss;
     net_->ForwardPrefilled(&loss);
@@ -265,6 +615,9 @@ void Solver<Dtype>::Solve(const char* resume_file) {
   if (param_.test_interval() && iter_ % param_.test_interval() == 0) {
     TestAll();
   }
+  if (snapshot_writer_) {
+    snapshot_writer_->Wait();
+  }
   LOG(INFO) << "Optimization Done.";
 }
 
@@ -335,6 +688,12 @@ void Solver<Dtype>::Test(const int test_net_id) {
 
 template <typename Dtype>
 void Solver<Dtype>::Snapshot() {
+  if (param_.async_snapshot() && !snapshot_writer_ &&
+      param_.snapshot_format() == SolverParameter_SnapshotFormat_BINARYPROTO) {
+    snapshot_writer_.reset(new SnapshotWriter());
+    CHECK(snapshot_writer_->StartInternalThread())
+        << "Thread execution failed";
+  }
   string model_filename;
   switch (param_.snapshot_format()) {
     case caffe::SolverParameter_SnapshotFormat_BINARYPROTO:
@@ -348,6 +707,19 @@ void Solver<Dtype>::Snapshot() {
   }
 
   SnapshotSolverState(model_filename);
+  if (snapshot_writer_) {
+    snapshot_writer_->Commit();
+  }
+}
+
+template <typename Dtype>
+void Solver<Dtype>::WriteSnapshotProto(shared_ptr<Message> proto,
+    const string& filename) {
+  if (snapshot_writer_) {
+    snapshot_writer_->Stage(proto, filename);
+  } else {
+    WriteProtoToBinaryFile(*proto, filename);
+  }
 }
 
 template <typename Dtype>
@@ -363,9 +735,9 @@ template <typename Dtype>
 string Solver<Dtype>::SnapshotToBinaryProto() {
   string model_filename = SnapshotFilename(".caffemodel");
   LOG(INFO) << "Snapshotting to binary proto file " << model_filename;
-  NetParameter net_param;
-  net_->ToProto(&net_param, param_.snapshot_diff());
-  WriteProtoToBinaryFile(net_param, model_filename);
+  shared_ptr<NetParameter> net_param(new NetParameter());
+  net_->ToProto(net_param.get(), param_.snapshot_diff());
+  WriteSnapshotProto(net_param, model_filename);
   return model_filename;
 }
 
@@ -481,25 +853,137 @@ void SGDSolver<Dtype>::ClipGradients() {
 template <typename Dtype>
 void SGDSolver<Dtype>::ApplyUpdate() {
   Dtype rate = GetLearningRate();
-  if (this->param_.display() && this->iter_ % this->param_.display() == 0) {
+  if (this->param_.display() && this->iter_ % this->param_.display() == 0
+      && Caffe::root_solver()) {
     LOG(INFO) << "Iteration " << this->iter_ << ", lr = " << rate;
   }
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  if (this->param_.keep_pruned_weights() && prune_masks_.empty()) {
+    // The weights are only final (trained ones copied, or a state restored)
+    // once solving starts.
+    prune_masks_.resize(net_params.size());
+    for (int i = 0; i < net_params.size(); ++i) {
+      if (net_params[i]->num_axes() <= 1) { continue; }
+      prune_masks_[i].reset(new Blob<Dtype>(net_params[i]->shape()));
+      const Dtype* data = net_params[i]->cpu_data();
+      Dtype* mask = prune_masks_[i]->mutable_cpu_data();
+      for (int j = 0; j < net_params[i]->count(); ++j) {
+        mask[j] = data[j] != 0;
+      }
+    }
+  }
+  // Pruned gradients neither count towards clipping nor enter the history.
+  for (int param_id = 0; param_id < prune_masks_.size(); ++param_id) {
+    MaskPrunedWeights(param_id);
+  }
   ClipGradients();
-  for (int param_id = 0; param_id < this->net_->learnable_params().size();
-       ++param_id) {
+  if (Caffe::mode() == Caffe::CPU && this->param_.fused_update() &&
+      SupportsFusedUpdate()) {
+    ApplyFusedUpdate(rate);
+    return;
+  }
+  for (int param_id = 0; param_id < net_params.size(); ++param_id) {
     Normalize(param_id);
     Regularize(param_id);
     ComputeUpdateValue(param_id, rate);
+    // The update itself is masked too, in case of history from before pruning.
+    if (!prune_masks_.empty()) { MaskPrunedWeights(param_id); }
   }
   this->net_->Update();
 }
 
+template <typename Dtype>
+void SGDSolver<Dtype>::MaskPrunedWeights(int param_id) {
+  const Blob<Dtype>* mask = prune_masks_[param_id].get();
+  if (!mask) { return; }
+  Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+  switch (Caffe::mode()) {
+  case Caffe::CPU: {
+    caffe_mul(param->count(), mask->cpu_data(), param->cpu_diff(),
+        param->mutable_cpu_diff());
+    break;
+  }
+  case Caffe::GPU: {
+#ifndef CPU_ONLY
+    caffe_gpu_mul(param->count(), mask->gpu_data(), param->gpu_diff(),
+        param->mutable_gpu_diff());
+#else
+    NO_GPU;
+#endif
+    break;
+  }
+  default:
+    LOG(FATAL) << "Unknown caffe mode: " << Caffe::mode();
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ApplyFusedUpdate(Dtype rate) {
+  const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
+  const vector<float>& net_params_lr = this->net_->params_lr();
+  const vector<float>& net_params_weight_decay =
+      this->net_->params_weight_decay();
+  const string& regularization_type = this->param_.regularization_type();
+  CHECK(regularization_type == "L1" || regularization_type == "L2")
+      << "Unknown regularization type: " << regularization_type;
+  // Blobs sync their memory on the calling thread, so all pointers are
+  // taken here. The params are cut into pieces of kParallelGrain elements,
+  // which the threads share out: large params are split, and small ones do
+  // not get a thread each.
+  vector<FusedUpdateArgs> args(net_params.size());
+  vector<int> piece_params, piece_begins;
+  int total = 0;
+  for (int i = 0; i < net_params.size(); ++i) {
+    args[i].data = net_params[i]->mutable_cpu_data();
+    args[i].diff = net_params[i]->mutable_cpu_diff();
+    args[i].history = history_[i]->mutable_cpu_data();
+    args[i].mask = i < prune_masks_.size() && prune_masks_[i] ?
+        prune_masks_[i]->cpu_data() : NULL;
+    args[i].scale = AccumulationScale();
+    args[i].decay = this->param_.weight_decay() * net_params_weight_decay[i];
+    args[i].l1 = regularization_type == "L1";
+    args[i].rate = rate * net_params_lr[i];
+    for (int begin = 0; begin < net_params[i]->count();
+         begin += kParallelGrain) {
+      piece_params.push_back(i);
+      piece_begins.push_back(begin);
+    }
+    total += net_params[i]->count();
+  }
+  const int pieces = piece_params.size();
+  CAFFE_PARALLEL_FOR(total)
+  for (int j = 0; j < pieces; ++j) {
+    const int i = piece_params[j];
+    ComputeUpdateFused(args[i], piece_begins[j],
+        std::min(piece_begins[j] + kParallelGrain, net_params[i]->count()));
+  }
+}
+
+template <typename Dtype>
+void SGDSolver<Dtype>::ComputeUpdateFused(const FusedUpdateArgs& args,
+    int begin, int end) {
+  const Dtype momentum = this->param_.momentum();
+  for (int i = begin; i < end; ++i) {
+    const Dtype history =
+        args.rate * FusedGradient(args, i) + momentum * args.history[i];
+    args.history[i] = history;
+    FusedApply(args, i, history);
+  }
+}
+
+template <typename Dtype>
+Dtype SGDSolver<Dtype>::AccumulationScale() {
+  const int accumulated = this->param_.iter_size() * this->param_.replicas()
+      * (this->communicator_ ? this->communicator_->size() : 1);
+  return Dtype(1.) / accumulated;
+}
+
 template <typename Dtype>
 void SGDSolver<Dtype>::Normalize(int param_id) {
-  if (this->param_.iter_size() == 1) { return; }
+  const Dtype accum_normalization = AccumulationScale();
+  if (accum_normalization == 1) { return; }
   // Scale gradient to counterbalance accumulation.
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
-  const Dtype accum_normalization = Dtype(1.) / this->param_.iter_size();
   switch (Caffe::mode()) {
   case Caffe::CPU: {
     caffe_scal(net_params[param_id]->count(), accum_normalization,
@@ -634,20 +1118,20 @@ void SGDSolver<Dtype>::SnapshotSolverState(const string& model_filename) {
 template <typename Dtype>
 void SGDSolver<Dtype>::SnapshotSolverStateToBinaryProto(
     const string& model_filename) {
-  SolverState state;
-  state.set_iter(this->iter_);
-  state.set_learned_net(model_filename);
-  state.set_current_step(this->current_step_);
-  state.clear_history();
+  shared_ptr<SolverState> state(new SolverState());
+  state->set_iter(this->iter_);
+  state->set_learned_net(model_filename);
+  state->set_current_step(this->current_step_);
+  state->clear_history();
   for (int i = 0; i < history_.size(); ++i) {
     // Add history
-    BlobProto* history_blob = state.add_history();
+    BlobProto* history_blob = state->add_history();
     history_[i]->ToProto(history_blob);
   }
   string snapshot_filename = Solver<Dtype>::SnapshotFilename(".solverstate");
   LOG(INFO)
     << "Snapshotting solver state to binary proto file" << snapshot_filename;
-  WriteProtoToBinaryFile(state, snapshot_filename.c_str());
+  this->WriteSnapshotProto(state, snapshot_filename);
 }
 
 template <typename Dtype>
@@ -781,6 +1265,21 @@ void NesterovSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void NesterovSolver<Dtype>::ComputeUpdateFused(
+    const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+    int end) {
+  const Dtype momentum = this->param_.momentum();
+  for (int i = begin; i < end; ++i) {
+    const Dtype previous = args.history[i];
+    const Dtype history =
+        args.rate * this->FusedGradient(args, i) + momentum * previous;
+    args.history[i] = history;
+    // step back then over step
+    this->FusedApply(args, i, (1 + momentum) * history - momentum * previous);
+  }
+}
+
 template <typename Dtype>
 void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   const vector<Blob<Dtype>*>& net_params = this->net_->learnable_params();
@@ -859,6 +1358,20 @@ void AdaGradSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void AdaGradSolver<Dtype>::ComputeUpdateFused(
+    const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+    int end) {
+  const Dtype delta = this->param_.delta();
+  for (int i = begin; i < end; ++i) {
+    const Dtype gradient = this->FusedGradient(args, i);
+    const Dtype history = args.history[i] + gradient * gradient;
+    args.history[i] = history;
+    this->FusedApply(args, i,
+        args.rate * gradient / (std::sqrt(history) + delta));
+  }
+}
+
 template <typename Dtype>
 void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -934,6 +1447,22 @@ void RMSPropSolver<Dtype>::ComputeUpdateValue(int param_id, Dtype rate) {
   }
 }
 
+template <typename Dtype>
+void RMSPropSolver<Dtype>::ComputeUpdateFused(
+    const typename SGDSolver<Dtype>::FusedUpdateArgs& args, int begin,
+    int end) {
+  const Dtype delta = this->param_.delta();
+  const Dtype rms_decay = this->param_.rms_decay();
+  for (int i = begin; i < end; ++i) {
+    const Dtype gradient = this->FusedGradient(args, i);
+    const Dtype history =
+        (1 - rms_decay) * gradient * gradient + rms_decay * args.history[i];
+    args.history[i] = history;
+    this->FusedApply(args, i,
+        args.rate * gradient / (std::sqrt(history) + delta));
+  }
+}
+
 INSTANTIATE_CLASS(Solver);
 INSTANTIATE_CLASS(SGDSolver);
 INSTANTIATE_CLASS(NesterovSolver);
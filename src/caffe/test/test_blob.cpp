@@ -1,3 +1,4 @@
+#include <cmath>
 #include <cstring>
 #include <vector>
 
@@ -6,6 +7,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/half.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -105,6 +107,37 @@ TYPED_TEST(BlobSimpleTest, TestLegacyBlobProtoShapeEquals) {
   EXPECT_FALSE(this->blob_->ShapeEquals(blob_proto));
 }
 
+TYPED_TEST(BlobSimpleTest, TestHalfProto) {
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(this->blob_preshaped_);
+  const int count = this->blob_preshaped_->count();
+  const TypeParam* data = this->blob_preshaped_->cpu_data();
+  BlobProto blob_proto;
+  this->blob_preshaped_->ToProto(&blob_proto, false, true);
+  EXPECT_EQ(0, blob_proto.data_size());
+  EXPECT_EQ(0, blob_proto.double_data_size());
+  EXPECT_EQ(2 * count, blob_proto.half_data().size());
+  // Read back as Dtype, to within half precision
+  this->blob_->FromProto(blob_proto);
+  EXPECT_EQ(this->blob_preshaped_->shape(), this->blob_->shape());
+  for (int i = 0; i < count; ++i) {
+    EXPECT_NEAR(data[i], this->blob_->cpu_data()[i],
+        std::fabs(data[i]) / 1024);
+  }
+  // A blob storing half precision writes and reads the same bits.
+  this->blob_->StoreHalf();
+  EXPECT_TRUE(this->blob_->stores_half());
+  BlobProto half_proto;
+  this->blob_->ToProto(&half_proto);
+  EXPECT_EQ(blob_proto.half_data(), half_proto.half_data());
+  this->blob_preshaped_->ToProto(&blob_proto);
+  this->blob_->FromProto(blob_proto);
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(float_to_half(data[i]), this->blob_->half_data()[i]);
+  }
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
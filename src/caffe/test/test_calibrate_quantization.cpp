@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/calibrate_quantization.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class CalibrateQuantizationTest : public CPUDeviceTest<float> {
+ protected:
+  // A chain of InnerProduct layers over random data. Each blob is read only
+  // by the next layer, so with reuse_blob_memory the later ones take the
+  // memory of the earlier.
+  string ChainProto() {
+    string proto =
+        "name: 'chain' "
+        "reuse_blob_memory: true "
+        "layer { "
+        "  name: 'data' type: 'DummyData' top: 'data' "
+        "  dummy_data_param { "
+        "    shape { dim: 4 dim: 8 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "} ";
+    const char* names[] = { "data", "ip1", "ip2", "ip3", "ip4" };
+    for (int i = 1; i < 5; ++i) {
+      proto += string("layer { name: '") + names[i] + "' "
+          "type: 'InnerProduct' bottom: '" + names[i - 1] + "' "
+          "top: '" + names[i] + "' "
+          "inner_product_param { num_output: 8 "
+          "  weight_filler { type: 'gaussian' std: 2 } } } ";
+    }
+    return proto;
+  }
+};
+
+TEST_F(CalibrateQuantizationTest, TestReuseBlobMemory) {
+  const int kIterations = 3;
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(ChainProto(), &param));
+  // The largest input of each layer, from the same batches run through the
+  // net without memory reuse
+  NetParameter reference_param(param);
+  reference_param.set_reuse_blob_memory(false);
+  reference_param.mutable_state()->set_phase(TEST);
+  Caffe::set_random_seed(1701);
+  vector<float> expected(5, 0);
+  {
+    Net<float> net(reference_param);
+    for (int iter = 0; iter < kIterations; ++iter) {
+      net.ForwardPrefilled();
+      for (int i = 1; i < 5; ++i) {
+        const Blob<float>& bottom = *net.bottom_vecs()[i][0];
+        for (int k = 0; k < bottom.count(); ++k) {
+          expected[i] = std::max(expected[i], std::fabs(bottom.cpu_data()[k]));
+        }
+      }
+    }
+  }
+  Caffe::set_random_seed(1701);
+  std::set<string> exclude;
+  exclude.insert("ip4");
+  CalibrateQuantization("", kIterations, exclude, &param);
+  for (int i = 1; i < 4; ++i) {
+    ASSERT_TRUE(param.layer(i).has_quantization_param());
+    EXPECT_FLOAT_EQ(expected[i],
+        param.layer(i).quantization_param().input_max())
+        << "layer " << param.layer(i).name();
+  }
+  EXPECT_FALSE(param.layer(4).has_quantization_param());
+  // The calibrated net keeps reusing memory.
+  EXPECT_TRUE(param.reuse_blob_memory());
+}
+
+}  // namespace caffe
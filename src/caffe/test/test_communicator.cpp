@@ -0,0 +1,314 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "boost/bind.hpp"
+#include "boost/lexical_cast.hpp"
+#include "boost/thread.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/communicator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+// A port of its own for each test of each run, and a token of the run
+string TCPURI() {
+  static int test = 0;
+  return "tcp://127.0.0.1:" + boost::lexical_cast<string>(
+      20000 + (getpid() * 8 + test++) % 40000) + "/caffe-test-" +
+      boost::lexical_cast<string>(getpid());
+}
+
+string SharedMemoryURI() {
+  return "shm://caffe-test-" + boost::lexical_cast<string>(getpid());
+}
+
+// Numbers of values to reduce at once
+vector<int> Counts(size_t value_size) {
+  vector<int> counts;
+  counts.push_back(1);
+  counts.push_back(2);
+  counts.push_back(100);
+  // More than a chunk of shared memory, and not divisible by the ranks
+  counts.push_back((4 << 20) / value_size * 2 + 5);
+  return counts;
+}
+
+// Joins uri as rank of size, reduces and broadcasts counts values, and
+// returns whether all of them came out right.
+template <typename Dtype>
+bool RunRank(const string& uri, int rank, int size,
+    const vector<int>& counts) {
+  shared_ptr<Communicator> communicator =
+      Communicator::Create(uri, rank, size);
+  EXPECT_EQ(rank, communicator->rank());
+  EXPECT_EQ(size, communicator->size());
+  bool all_equal = true;
+  for (int c = 0; c < counts.size(); ++c) {
+    vector<Dtype> data(counts[c]);
+    for (int i = 0; i < counts[c]; ++i) {
+      data[i] = rank + i % 7;
+    }
+    communicator->AllReduce(data.empty() ? NULL : &data[0], counts[c]);
+    // The sum of rank + i % 7 over the ranks
+    for (int i = 0; i < counts[c]; ++i) {
+      all_equal &= data[i] == Dtype(size * (size - 1) / 2 + size * (i % 7));
+    }
+    vector<char> bytes(counts[c] + 1, 0);
+    if (rank == 0) {
+      for (int i = 0; i < bytes.size(); ++i) {
+        bytes[i] = i % 127;
+      }
+    }
+    communicator->Broadcast(&bytes[0], bytes.size());
+    for (int i = 0; i < bytes.size(); ++i) {
+      all_equal &= bytes[i] == i % 127;
+    }
+  }
+  communicator->Barrier();
+  return all_equal;
+}
+
+// Runs each rank on a thread of its own, which the communicators do not mind
+// as long as every rank makes the same calls.
+template <typename Dtype>
+class CommunicatorTest : public ::testing::Test {
+ protected:
+  CommunicatorTest() : size_(3), ok_(size_, 0) {}
+
+  void Run(const string& uri, int rank) {
+    ok_[rank] = RunRank<Dtype>(uri, rank, size_, Counts(sizeof(Dtype)));
+  }
+
+  // Starts ranks [first, last) on threads_.
+  void Start(const string& uri, int first, int last) {
+    for (int rank = first; rank < last; ++rank) {
+      threads_.create_thread(boost::bind(&CommunicatorTest::Run, this, uri,
+          rank));
+    }
+  }
+
+  void JoinAll() {
+    threads_.join_all();
+    for (int rank = 0; rank < size_; ++rank) {
+      EXPECT_TRUE(ok_[rank]) << "Rank " << rank;
+    }
+  }
+
+  void RunAll(const string& uri) {
+    Start(uri, 0, size_);
+    JoinAll();
+  }
+
+  const int size_;
+  vector<int> ok_;
+  boost::thread_group threads_;
+};
+
+TYPED_TEST_CASE(CommunicatorTest, TestDtypes);
+
+TYPED_TEST(CommunicatorTest, TestTCP) {
+  this->RunAll(TCPURI());
+}
+
+TYPED_TEST(CommunicatorTest, TestTCPStranger) {
+  const string uri = TCPURI();
+  const int port = boost::lexical_cast<int>(
+      uri.substr(uri.rfind(':') + 1, uri.find('/', 6) - uri.rfind(':') - 1));
+  this->Start(uri, 0, 1);
+  // Say hello as rank 1 of the run, with a token of another one
+  sockaddr_in addr = sockaddr_in();
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  int fd = -1;
+  for (int tries = 0; fd < 0 && tries < 1000; ++tries) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd, 0);
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      close(fd);
+      fd = -1;
+      usleep(10000);
+    }
+  }
+  ASSERT_GE(fd, 0) << "Rank 0 does not listen on " << uri;
+  const string token(uri.size() - uri.find('/', 6) - 1, 'x');
+  const int32_t hello[5] = {0x43414646, this->size_, 1, 1,
+      static_cast<int32_t>(token.size())};
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(hello)),
+      send(fd, hello, sizeof(hello), 0));
+  ASSERT_EQ(static_cast<ssize_t>(token.size()),
+      send(fd, token.data(), token.size(), 0));
+  // Rank 0 hangs up instead of counting it as rank 1.
+  char reply;
+  EXPECT_EQ(0, recv(fd, &reply, 1, 0));
+  close(fd);
+  this->Start(uri, 1, this->size_);
+  this->JoinAll();
+}
+
+TYPED_TEST(CommunicatorTest, TestSharedMemory) {
+  this->RunAll(SharedMemoryURI());
+}
+
+TYPED_TEST(CommunicatorTest, TestSingleRank) {
+  shared_ptr<Communicator> communicator =
+      Communicator::Create(TCPURI(), 0, 1);
+  TypeParam data[2] = {1, 2};
+  communicator->AllReduce(data, 2);
+  EXPECT_EQ(1, data[0]);
+  EXPECT_EQ(2, data[1]);
+}
+
+// Runs ranks 1... as processes of their own, which run this test binary
+// again for CommunicatorProcessTest.Rank, told their rank through the
+// environment, while the test runs rank 0.
+class CommunicatorProcessTest : public ::testing::Test {
+ protected:
+  CommunicatorProcessTest() : size_(3) {}
+
+  // Starts a process joining uri as rank, or as rank only to exit right
+  // after joining if exit.
+  pid_t StartRank(const string& uri, int rank, bool exit) {
+    vector<string> env;
+    for (char** e = environ; *e; ++e) {
+      if (string(*e).compare(0, 15, "CAFFE_TEST_COMM") != 0) {
+        env.push_back(*e);
+      }
+    }
+    env.push_back("CAFFE_TEST_COMM_URI=" + uri);
+    env.push_back("CAFFE_TEST_COMM_RANK=" + boost::lexical_cast<string>(rank));
+    env.push_back("CAFFE_TEST_COMM_SIZE=" +
+        boost::lexical_cast<string>(size_));
+    if (exit) {
+      env.push_back("CAFFE_TEST_COMM_EXIT=1");
+    }
+    vector<char*> envp;
+    for (int i = 0; i < env.size(); ++i) {
+      envp.push_back(const_cast<char*>(env[i].c_str()));
+    }
+    envp.push_back(NULL);
+    char argv0[] = "test.testbin";
+    char filter[] = "--gtest_filter=CommunicatorProcessTest.Rank";
+    char* argv[] = {argv0, filter, NULL};
+    const pid_t pid = fork();
+    if (pid == 0) {
+      execve("/proc/self/exe", argv, &envp[0]);
+      _exit(127);
+    }
+    EXPECT_GT(pid, 0) << "fork: " << strerror(errno);
+    return pid;
+  }
+
+  // Waits up to timeout seconds for pid to exit, or kills it, and returns
+  // whether it exited with status 0.
+  bool Wait(pid_t pid, int timeout) {
+    int status = 0;
+    for (int waited = 0; waitpid(pid, &status, WNOHANG) == 0; ++waited) {
+      if (waited == timeout * 100) {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+        ADD_FAILURE() << "Process " << pid << " hung";
+        return false;
+      }
+      usleep(10000);
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+
+  void RunAll(const string& uri) {
+    vector<pid_t> pids;
+    for (int rank = 1; rank < size_; ++rank) {
+      pids.push_back(StartRank(uri, rank, false));
+    }
+    EXPECT_TRUE(RunRank<float>(uri, 0, size_, Counts(sizeof(float))));
+    for (int i = 0; i < pids.size(); ++i) {
+      EXPECT_TRUE(Wait(pids[i], 60)) << "Rank " << i + 1;
+    }
+  }
+
+  const int size_;
+};
+
+// What the ranks the other tests start run; nothing to do when run with the
+// other tests.
+TEST_F(CommunicatorProcessTest, Rank) {
+  const char* uri = getenv("CAFFE_TEST_COMM_URI");
+  if (!uri) {
+    return;
+  }
+  const int rank = atoi(getenv("CAFFE_TEST_COMM_RANK"));
+  const int size = atoi(getenv("CAFFE_TEST_COMM_SIZE"));
+  if (getenv("CAFFE_TEST_COMM_EXIT")) {
+    Communicator::Create(uri, rank, size);
+    _exit(0);
+  }
+  EXPECT_TRUE(RunRank<float>(uri, rank, size, Counts(sizeof(float))));
+}
+
+TEST_F(CommunicatorProcessTest, TestTCP) {
+  this->RunAll(TCPURI());
+}
+
+TEST_F(CommunicatorProcessTest, TestSharedMemory) {
+  this->RunAll(SharedMemoryURI());
+}
+
+TEST_F(CommunicatorProcessTest, TestSharedMemoryStale) {
+  // Leave the segment of a run whose rank 0 died while the others joined
+  const string uri = SharedMemoryURI();
+  const string path = "/" + uri.substr(6);
+  const pid_t crashed = StartRank(uri, 0, false);
+  struct stat st = {};
+  for (int waited = 0; waited < 1000 && st.st_size == 0; ++waited) {
+    const int fd = shm_open(path.c_str(), O_RDONLY, 0600);
+    if (fd >= 0) {
+      fstat(fd, &st);
+      close(fd);
+    }
+    usleep(10000);
+  }
+  ASSERT_GT(st.st_size, 0) << "Rank 0 did not create " << path;
+  usleep(100000);
+  kill(crashed, SIGKILL);
+  EXPECT_FALSE(Wait(crashed, 60));
+  // The ranks of the next run find it before rank 0 replaces it.
+  vector<pid_t> pids;
+  for (int rank = 1; rank < size_; ++rank) {
+    pids.push_back(StartRank(uri, rank, false));
+  }
+  usleep(500000);
+  EXPECT_TRUE(RunRank<float>(uri, 0, size_, Counts(sizeof(float))));
+  for (int i = 0; i < pids.size(); ++i) {
+    EXPECT_TRUE(Wait(pids[i], 60)) << "Rank " << i + 1;
+  }
+}
+
+TEST_F(CommunicatorProcessTest, TestSharedMemoryRankExits) {
+  // The others fail instead of waiting for the last rank forever.
+  const string uri = SharedMemoryURI();
+  vector<pid_t> pids;
+  for (int rank = 0; rank < size_; ++rank) {
+    pids.push_back(StartRank(uri, rank, rank == size_ - 1));
+  }
+  EXPECT_TRUE(Wait(pids[size_ - 1], 60));
+  for (int rank = 0; rank < size_ - 1; ++rank) {
+    EXPECT_FALSE(Wait(pids[rank], 60)) << "Rank " << rank;
+  }
+}
+
+}  // namespace caffe
@@ -66,7 +66,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     db->Close();
   }
 
-  void TestRead() {
+  void TestRead(int transform_threads = 1) {
     const Dtype scale = 3;
     LayerParameter param;
     param.set_phase(TRAIN);
@@ -74,6 +74,7 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     data_param->set_batch_size(5);
     data_param->set_source(filename_->c_str());
     data_param->set_backend(backend_);
+    data_param->set_transform_threads(transform_threads);
 
     TransformationParameter* transform_param =
         param.mutable_transform_param();
@@ -104,6 +105,149 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  void TestReadShard() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(4);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shard_id(1);
+    data_param->set_num_shards(2);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    // Of the 5 records, shard 1 of 2 holds records 1 and 3 only.
+    for (int iter = 0; iter < 10; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      for (int i = 0; i < 4; ++i) {
+        const int label = 1 + 2 * (i % 2);
+        EXPECT_EQ(label, blob_top_label_->cpu_data()[i]);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j]);
+        }
+      }
+    }
+  }
+
+  void TestReadSharedReader() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    param.set_name("data");
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+
+    // Both layers pull from a single reader and get distinct records, so
+    // only check that each data item matches its label.
+    DataLayer<Dtype> layer1(param);
+    DataLayer<Dtype> layer2(param);
+    layer1.SetUp(blob_bottom_vec_, blob_top_vec_);
+    Blob<Dtype> top_data2, top_label2;
+    vector<Blob<Dtype>*> top_vec2;
+    top_vec2.push_back(&top_data2);
+    top_vec2.push_back(&top_label2);
+    layer2.SetUp(blob_bottom_vec_, top_vec2);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer1.Forward(blob_bottom_vec_, blob_top_vec_);
+      layer2.Forward(blob_bottom_vec_, top_vec2);
+      for (int i = 0; i < 5; ++i) {
+        const Dtype label1 = blob_top_label_->cpu_data()[i];
+        const Dtype label2 = top_label2.cpu_data()[i];
+        EXPECT_GE(label1, 0);
+        EXPECT_LT(label1, 5);
+        EXPECT_GE(label2, 0);
+        EXPECT_LT(label2, 5);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label1, blob_top_data_->cpu_data()[i * 24 + j]);
+          EXPECT_EQ(label2, top_data2.cpu_data()[i * 24 + j]);
+        }
+      }
+    }
+  }
+
+  void TestReadSharedSourceShards() {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    param.set_name("data");
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(4);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_num_shards(2);
+
+    // Same name and source, but different shards: each layer reads its own.
+    data_param->set_shard_id(0);
+    DataLayer<Dtype> layer0(param);
+    data_param->set_shard_id(1);
+    DataLayer<Dtype> layer1(param);
+    layer0.SetUp(blob_bottom_vec_, blob_top_vec_);
+    Blob<Dtype> top_data1, top_label1;
+    vector<Blob<Dtype>*> top_vec1;
+    top_vec1.push_back(&top_data1);
+    top_vec1.push_back(&top_label1);
+    layer1.SetUp(blob_bottom_vec_, top_vec1);
+    for (int iter = 0; iter < 10; ++iter) {
+      layer0.Forward(blob_bottom_vec_, blob_top_vec_);
+      layer1.Forward(blob_bottom_vec_, top_vec1);
+      for (int i = 0; i < 4; ++i) {
+        const int label0 = blob_top_label_->cpu_data()[i];
+        EXPECT_EQ(0, label0 % 2);
+        EXPECT_EQ(1 + 2 * (i % 2), top_label1.cpu_data()[i]);
+      }
+    }
+  }
+
+  void TestReadShuffle(int shuffle_block) {
+    Caffe::set_random_seed(seed_);
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    data_param->set_shuffle(true);
+    data_param->set_shuffle_block(shuffle_block);
+    data_param->set_key_index(*filename_ + ".keys");
+
+    // The first layer lists the keys and saves them, the second one loads
+    // them. Each batch is a whole epoch, so it holds every record once.
+    for (int run = 0; run < 2; ++run) {
+      DataLayer<Dtype> layer(param);
+      layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+      bool reordered = false;
+      vector<int> first_order;
+      for (int iter = 0; iter < 20; ++iter) {
+        layer.Forward(blob_bottom_vec_, blob_top_vec_);
+        vector<int> order;
+        vector<bool> seen(5, false);
+        for (int i = 0; i < 5; ++i) {
+          const int label = blob_top_label_->cpu_data()[i];
+          ASSERT_GE(label, 0);
+          ASSERT_LT(label, 5);
+          EXPECT_FALSE(seen[label]);
+          seen[label] = true;
+          order.push_back(label);
+          for (int j = 0; j < 24; ++j) {
+            EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j]);
+          }
+          // Blocks keep consecutive records together
+          if (label % shuffle_block != 0) {
+            ASSERT_GT(i, 0);
+            EXPECT_EQ(label - 1, blob_top_label_->cpu_data()[i - 1]);
+          }
+        }
+        if (iter == 0) {
+          first_order = order;
+        } else if (order != first_order) {
+          reordered = true;
+        }
+      }
+      EXPECT_TRUE(reordered);
+    }
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -354,6 +498,42 @@ TYPED_TEST(DataLayerTest, TestReadLevelDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadTransformThreadsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestRead(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadShard();
+}
+
+TYPED_TEST(DataLayerTest, TestReadSharedReaderLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadSharedReader();
+}
+
+TYPED_TEST(DataLayerTest, TestReadSharedSourceShardsLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadSharedSourceShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadShuffle(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadBlockShuffleLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadShuffle(2);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLevelDB) {
   this->TestReshape(DataParameter_DB_LEVELDB);
 }
@@ -392,10 +572,58 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadTransformThreadsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestRead(3);
+}
+
+TYPED_TEST(DataLayerTest, TestReadShardLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShard();
+}
+
+TYPED_TEST(DataLayerTest, TestReadSharedReaderLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadSharedReader();
+}
+
+TYPED_TEST(DataLayerTest, TestReadSharedSourceShardsLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadSharedSourceShards();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShuffle(1);
+}
+
+TYPED_TEST(DataLayerTest, TestReadBlockShuffleLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShuffle(2);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
 
+TYPED_TEST(DataLayerTest, TestReadPacked) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_PACKED);
+  this->TestRead();
+}
+
+TYPED_TEST(DataLayerTest, TestReadShufflePacked) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_PACKED);
+  this->TestReadShuffle(2);
+}
+
 TYPED_TEST(DataLayerTest, TestReadCropTrainLMDB) {
   const bool unique_pixels = true;  // all images the same; pixels different
   this->Fill(unique_pixels, DataParameter_DB_LMDB);
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <string>
 
 #include "boost/scoped_ptr.hpp"
@@ -6,6 +7,7 @@
 #include "caffe/common.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
+#include "caffe/util/db_packed.hpp"
 #include "caffe/util/io.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -116,6 +118,35 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestValueView) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (; cursor->valid(); cursor->Next()) {
+    const string value = cursor->value();
+    ASSERT_EQ(value.size(), cursor->value_size());
+    EXPECT_EQ(0, memcmp(value.data(), cursor->value_data(), value.size()));
+  }
+}
+
+TYPED_TEST(DBTest, TestSeek) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->Seek("fish-bike.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->Seek("cat.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  // A missing key moves to the next one
+  cursor->Seek("dog.jpg");
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  cursor->Seek("zebra.jpg");
+  EXPECT_FALSE(cursor->valid());
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -131,4 +162,79 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+class PackedDBTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/db";
+  }
+
+  void Put(db::Transaction* txn, int i) {
+    Datum datum;
+    datum.set_channels(1);
+    datum.set_height(2);
+    datum.set_width(3);
+    datum.set_label(i);
+    for (int j = 0; j < 6; ++j) {
+      datum.add_float_data(i + j / 10.);
+    }
+    stringstream ss;
+    ss << "key" << i;
+    string out;
+    CHECK(datum.SerializeToString(&out));
+    txn->Put(ss.str(), out);
+  }
+
+  string source_;
+};
+
+TEST_F(PackedDBTest, TestWriteAppendRead) {
+  scoped_ptr<db::DB> db(db::GetDB("packed"));
+  db->Open(source_, db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  for (int i = 0; i < 3; ++i) {
+    Put(txn.get(), i);
+  }
+  txn->Commit();
+  db->Close();
+  // Append to the existing records
+  db->Open(source_, db::WRITE);
+  txn.reset(db->NewTransaction());
+  for (int i = 3; i < 5; ++i) {
+    Put(txn.get(), i);
+  }
+  txn->Commit();
+  db->Close();
+
+  db->Open(source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (int i = 0; i < 5; ++i, cursor->Next()) {
+    ASSERT_TRUE(cursor->valid());
+    stringstream ss;
+    ss << "key" << i;
+    EXPECT_EQ(ss.str(), cursor->key());
+    Datum datum;
+    cursor->ReadDatum(&datum);
+    EXPECT_EQ(i, datum.label());
+    EXPECT_EQ(1, datum.channels());
+    EXPECT_EQ(2, datum.height());
+    EXPECT_EQ(3, datum.width());
+    ASSERT_EQ(6, datum.float_data_size());
+    for (int j = 0; j < 6; ++j) {
+      EXPECT_FLOAT_EQ(i + j / 10., datum.float_data(j));
+    }
+    // Values are the same records as Datums
+    Datum value;
+    value.ParseFromArray(cursor->value_data(), cursor->value_size());
+    EXPECT_EQ(datum.SerializeAsString(), value.SerializeAsString());
+  }
+  EXPECT_FALSE(cursor->valid());
+  cursor->Seek("key3");
+  EXPECT_EQ("key3", cursor->key());
+  cursor->Seek("key25");
+  EXPECT_EQ("key3", cursor->key());
+  cursor->Seek("key5");
+  EXPECT_FALSE(cursor->valid());
+}
+
 }  // namespace caffe
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/factorize.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FactorizeTest : public ::testing::Test {
+ protected:
+  FactorizeTest() {
+    Caffe::set_random_seed(1701);
+  }
+
+  // The squared Frobenius norm of W - U * L
+  double ReconstructionError(int N, int K, int rank, const vector<float>& W,
+      const vector<float>& U, const vector<float>& L) {
+    vector<float> UL(N * K);
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, N, K, rank, 1., &U[0],
+        &L[0], 0., &UL[0]);
+    double error = 0;
+    for (int i = 0; i < N * K; ++i) {
+      error += (W[i] - UL[i]) * (W[i] - UL[i]);
+    }
+    return error;
+  }
+};
+
+TEST_F(FactorizeTest, TestOrthonormalizeRows) {
+  const int rows = 6;
+  const int cols = 40;
+  vector<float> A(rows * cols);
+  caffe_rng_gaussian<float>(A.size(), 0, 1, &A[0]);
+  // The last row depends on the first two.
+  for (int j = 0; j < cols; ++j) {
+    A[(rows - 1) * cols + j] = A[j] - 2 * A[cols + j];
+  }
+  OrthonormalizeRows(rows, cols, &A[0]);
+  for (int i = 0; i < rows - 1; ++i) {
+    for (int j = 0; j < rows - 1; ++j) {
+      EXPECT_NEAR(i == j ? 1 : 0,
+          caffe_cpu_dot(cols, &A[i * cols], &A[j * cols]), 1e-5);
+    }
+  }
+  for (int j = 0; j < cols; ++j) {
+    EXPECT_EQ(0, A[(rows - 1) * cols + j]);
+  }
+}
+
+TEST_F(FactorizeTest, TestSymmetricEigenKnown) {
+  // Eigenvalues 1, 3 and 5, with eigenvectors (1, -1, 0) / sqrt(2),
+  // (1, 1, 0) / sqrt(2) and (0, 0, 1)
+  const double values[] = { 2, 1, 0, 1, 2, 0, 0, 0, 5 };
+  const double s = 1 / std::sqrt(2.);
+  const double vectors[3][3] = { { s, -s, 0 }, { s, s, 0 }, { 0, 0, 1 } };
+  vector<double> A(values, values + 9), d;
+  SymmetricEigen(3, &A, &d);
+  ASSERT_EQ(3, d.size());
+  for (int i = 0; i < 3; ++i) {
+    // Eigenvalue 2 * k + 1 goes with vectors[k], up to sign.
+    const int k = static_cast<int>(std::floor((d[i] - 1) / 2 + 0.5));
+    ASSERT_GE(k, 0);
+    ASSERT_LT(k, 3);
+    EXPECT_NEAR(2 * k + 1, d[i], 1e-12);
+    const double* v = &A[i * 3];
+    const double dot = v[0] * vectors[k][0] + v[1] * vectors[k][1] +
+        v[2] * vectors[k][2];
+    EXPECT_NEAR(1, std::fabs(dot), 1e-12);
+  }
+}
+
+TEST_F(FactorizeTest, TestSymmetricEigenRandom) {
+  const int n = 12;
+  vector<float> B(n * n);
+  caffe_rng_gaussian<float>(B.size(), 0, 1, &B[0]);
+  vector<double> A(n * n);
+  for (int i = 0; i < n; ++i) {
+    for (int j = 0; j < n; ++j) {
+      A[i * n + j] = B[i * n + j] + B[j * n + i];
+    }
+  }
+  const vector<double> original(A);
+  vector<double> d;
+  SymmetricEigen(n, &A, &d);
+  // A v = d v for each eigenpair, and the eigenvectors are orthonormal.
+  for (int e = 0; e < n; ++e) {
+    const double* v = &A[e * n];
+    for (int i = 0; i < n; ++i) {
+      double Av = 0;
+      for (int j = 0; j < n; ++j) {
+        Av += original[i * n + j] * v[j];
+      }
+      EXPECT_NEAR(d[e] * v[i], Av, 1e-10);
+    }
+    for (int f = 0; f < n; ++f) {
+      double dot = 0;
+      for (int j = 0; j < n; ++j) {
+        dot += v[j] * A[f * n + j];
+      }
+      EXPECT_NEAR(e == f ? 1 : 0, dot, 1e-10);
+    }
+  }
+}
+
+TEST_F(FactorizeTest, TestFactorizeErrorDecreasesWithRank) {
+  const int N = 24;
+  const int K = 32;
+  vector<float> W(N * K);
+  caffe_rng_gaussian<float>(W.size(), 0, 1, &W[0]);
+  const double total = caffe_cpu_dot<float>(N * K, &W[0], &W[0]);
+  double last_error = total;
+  for (int rank = 1; rank <= N; ++rank) {
+    vector<float> U(N * rank), L(rank * K);
+    const double kept = Factorize(N, K, rank, 10, 2, &W[0], &U[0], &L[0]);
+    const double error = ReconstructionError(N, K, rank, W, U, L);
+    EXPECT_LT(error, last_error) << "rank " << rank;
+    // The energy not kept is the error of the projection.
+    EXPECT_NEAR(1 - kept, error / total, 1e-3) << "rank " << rank;
+    last_error = error;
+  }
+}
+
+TEST_F(FactorizeTest, TestFactorizeFullRank) {
+  const int N = 20;
+  const int K = 12;
+  vector<float> W(N * K), U(N * K), L(K * K);
+  caffe_rng_gaussian<float>(W.size(), 0, 1, &W[0]);
+  const double kept = Factorize(N, K, K, 10, 2, &W[0], &U[0], &L[0]);
+  EXPECT_NEAR(1, kept, 1e-5);
+  vector<float> UL(N * K);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, N, K, K, 1., &U[0],
+      &L[0], 0., &UL[0]);
+  for (int i = 0; i < N * K; ++i) {
+    EXPECT_NEAR(W[i], UL[i], 1e-4);
+  }
+}
+
+}  // namespace caffe
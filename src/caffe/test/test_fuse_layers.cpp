@@ -0,0 +1,380 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/fuse_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class FuseLayersTest : public ::testing::Test {
+ protected:
+  void RunFusionTest(
+      const string& input_param_string, const string& output_param_string) {
+    // Test that FuseLayers called on the proto specified by
+    // input_param_string results in the proto specified by
+    // output_param_string.
+    NetParameter input_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        input_param_string, &input_param));
+    NetParameter expected_output_param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(
+        output_param_string, &expected_output_param));
+    NetParameter actual_output_param;
+    FuseLayers(input_param, &actual_output_param);
+    EXPECT_EQ(expected_output_param.DebugString(),
+        actual_output_param.DebugString());
+    // Also test idempotence.
+    NetParameter double_fused_param;
+    FuseLayers(actual_output_param, &double_fused_param);
+    EXPECT_EQ(actual_output_param.DebugString(),
+        double_fused_param.DebugString());
+  }
+};
+
+TEST_F(FuseLayersTest, TestFuseInPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "  relu_param { "
+      "    negative_slope: 0.1 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'drop' "
+      "  type: 'Dropout' "
+      "  bottom: 'ip' "
+      "  top: 'ip' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  relu_param { "
+      "    negative_slope: 0.1 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseLayersTest, TestFuseOutOfPlace) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'relu1' "
+      "  top: 'drop1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'drop1' "
+      "  top: 'ip2' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'relu1' "
+      "  relu_param { "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'relu1' "
+      "  top: 'ip2' "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+TEST_F(FuseLayersTest, TestNoFusionOfReadTop) {
+  // The ReLU is not the first consumer of the convolution, and the Split
+  // feeding an in-place ReLU stays.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'conv_conv_0_split' "
+      "  type: 'Split' "
+      "  bottom: 'conv' "
+      "  top: 'conv_conv_0_split_0' "
+      "  top: 'conv_conv_0_split_1' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv_conv_0_split_0' "
+      "  top: 'conv_conv_0_split_0' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'conv_conv_0_split_0' "
+      "  bottom: 'conv_conv_0_split_1' "
+      "  top: 'sum' "
+      "} ";
+  this->RunFusionTest(input_proto, input_proto);
+}
+
+TEST_F(FuseLayersTest, TestRemoveReadOnlySplit) {
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'data_data_0_split' "
+      "  type: 'Split' "
+      "  bottom: 'data' "
+      "  top: 'data_data_0_split_0' "
+      "  top: 'data_data_0_split_1' "
+      "} "
+      "layer { "
+      "  name: 'pool' "
+      "  type: 'Pooling' "
+      "  bottom: 'data_data_0_split_0' "
+      "  top: 'pool' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data_data_0_split_1' "
+      "  top: 'conv' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "} "
+      "layer { "
+      "  name: 'pool' "
+      "  type: 'Pooling' "
+      "  bottom: 'data' "
+      "  top: 'pool' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} ";
+  this->RunFusionTest(input_proto, expected_output_proto);
+}
+
+template <typename TypeParam>
+class FuseLayersNetTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // Runs the net on data, with the layers fused or not, and returns the
+  // number of layers.
+  int Run(const string& proto, const Blob<Dtype>& data, bool fuse,
+      Blob<Dtype>* output) {
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    param.set_fuse_layers(fuse);
+    param.mutable_state()->set_phase(TEST);
+    Caffe::set_random_seed(1701);
+    Net<Dtype> net(param);
+    net.input_blobs()[0]->CopyFrom(data);
+    net.ForwardPrefilled();
+    output->CopyFrom(*net.output_blobs()[0], false, true);
+    return net.layers().size();
+  }
+};
+
+TYPED_TEST_CASE(FuseLayersNetTest, TestDtypesAndDevices);
+
+TYPED_TEST(FuseLayersNetTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  const string proto =
+      "name: 'FuseNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'pool' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv' "
+      "  top: 'pool' "
+      "  pooling_param { "
+      "    pool: MAX "
+      "    kernel_size: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'relu1' "
+      "  relu_param { "
+      "    negative_slope: 0.5 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'drop1' "
+      "  type: 'Dropout' "
+      "  bottom: 'relu1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'pool' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'relu1' "
+      "  bottom: 'ip2' "
+      "  top: 'sum' "
+      "} ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 6, 6);
+  filler.Fill(&data);
+  Blob<Dtype> reference, output;
+  const int num_layers = this->Run(proto, data, false, &reference);
+  const int num_fused_layers = this->Run(proto, data, true, &output);
+  if (Caffe::mode() == Caffe::CPU) {
+    // relu, relu1, drop1 and the split of conv go
+    EXPECT_EQ(num_layers - 4, num_fused_layers);
+  } else {
+    EXPECT_EQ(num_layers, num_fused_layers);
+  }
+  ASSERT_EQ(reference.count(), output.count());
+  for (int i = 0; i < output.count(); ++i) {
+    EXPECT_EQ(reference.cpu_data()[i], output.cpu_data()[i]);
+  }
+}
+
+}  // namespace caffe
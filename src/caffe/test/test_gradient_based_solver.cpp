@@ -25,13 +25,13 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
  protected:
   GradientBasedSolverTest() :
       seed_(1701), num_(4), channels_(3), height_(10), width_(10),
-      constant_data_(false), share_(false) {}
+      constant_data_(false), share_(false), fused_update_(true) {}
 
   string snapshot_prefix_;
   shared_ptr<SGDSolver<Dtype> > solver_;
   int seed_;
   int num_, channels_, height_, width_;
-  bool constant_data_, share_;
+  bool constant_data_, share_, fused_update_;
   Dtype delta_;  // Stability constant for AdaGrad.
 
   virtual SolverParameter_SolverType solver_type() = 0;
@@ -174,6 +174,9 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
     if (momentum != 0) {
       proto << "momentum: " << momentum << " ";
     }
+    if (!fused_update_) {
+      proto << "fused_update: false ";
+    }
     MakeTempDir(&snapshot_prefix_);
     proto << "snapshot_prefix: '" << snapshot_prefix_ << "/' ";
     if (snapshot) {
@@ -499,6 +502,58 @@ class GradientBasedSolverTest : public MultiDeviceTest<TypeParam> {
       }
     }
   }
+
+  // The fused update rounds differently, so only nearly matches.
+  ::testing::AssertionResult FusedNear(Dtype expected, Dtype actual) {
+    const double kPrecision = 1e-5;
+    const double margin = std::max(kPrecision, kPrecision * fabs(expected));
+    if (fabs(expected - actual) <= margin) {
+      return ::testing::AssertionSuccess();
+    }
+    return ::testing::AssertionFailure() << expected << " vs " << actual;
+  }
+
+  // Checks that the fused CPU update leaves the params, their updates and
+  // the history as the separate steps do.
+  void TestFusedUpdate(const Dtype learning_rate, const Dtype weight_decay,
+      const Dtype momentum, const int num_iters) {
+    if (Caffe::mode() != Caffe::CPU) { return; }
+    // Weights of more than one piece, with accumulation and sharing
+    height_ = width_ = 100;
+    share_ = true;
+    const int kIterSize = 2;
+    fused_update_ = false;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        kIterSize);
+    vector<shared_ptr<Blob<Dtype> > > param_copies, history_copies;
+    const vector<Blob<Dtype>*>& orig_params =
+        solver_->net()->learnable_params();
+    for (int i = 0; i < orig_params.size(); ++i) {
+      param_copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      param_copies[i]->CopyFrom(*orig_params[i], false, true);
+      param_copies[i]->CopyFrom(*orig_params[i], true, true);
+      history_copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      history_copies[i]->CopyFrom(*solver_->history()[i], false, true);
+    }
+    fused_update_ = true;
+    RunLeastSquaresSolver(learning_rate, weight_decay, momentum, num_iters,
+        kIterSize);
+    const vector<Blob<Dtype>*>& params = solver_->net()->learnable_params();
+    ASSERT_EQ(param_copies.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_TRUE(FusedNear(param_copies[i]->cpu_data()[j],
+            params[i]->cpu_data()[j]))
+            << "param " << i << " data differed at dim " << j;
+        EXPECT_TRUE(FusedNear(param_copies[i]->cpu_diff()[j],
+            params[i]->cpu_diff()[j]))
+            << "param " << i << " diff differed at dim " << j;
+        EXPECT_TRUE(FusedNear(history_copies[i]->cpu_data()[j],
+            solver_->history()[i]->cpu_data()[j]))
+            << "history blob " << i << " data differed at dim " << j;
+      }
+    }
+  }
 };
 
 
@@ -641,6 +696,63 @@ TYPED_TEST(SGDSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(SGDSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
+TYPED_TEST(SGDSolverTest, TestKeepPrunedWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitSolverFromProtoString(
+      "base_lr: 0.01 lr_policy: 'fixed' weight_decay: 0.5 momentum: 0.9 "
+      "keep_pruned_weights: true "
+      "net_param { "
+      "  layer { "
+      "    name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+      "    dummy_data_param { "
+      "      shape { dim: 4 dim: 6 } shape { dim: 4 dim: 2 } "
+      "      data_filler { type: 'gaussian' } "
+      "      data_filler { type: 'gaussian' } "
+      "    } "
+      "  } "
+      "  layer { "
+      "    name: 'innerprod' type: 'InnerProduct' "
+      "    bottom: 'data' top: 'innerprod' "
+      "    inner_product_param { "
+      "      num_output: 2 "
+      "      weight_filler { type: 'gaussian' } "
+      "      bias_filler { type: 'constant' } "
+      "    } "
+      "  } "
+      "  layer { "
+      "    name: 'loss' type: 'EuclideanLoss' "
+      "    bottom: 'innerprod' bottom: 'targets' "
+      "  } "
+      "} ");
+  // Prune half the weights. The biases start at zero too, but have one axis
+  // so are not masked.
+  const vector<Blob<Dtype>*>& params = this->solver_->net()->learnable_params();
+  Dtype* weights = params[0]->mutable_cpu_data();
+  for (int i = 0; i < params[0]->count(); i += 2) {
+    weights[i] = 0;
+  }
+  Blob<Dtype> pruned;
+  pruned.CopyFrom(*params[0], false, true);
+  this->solver_->Step(3);
+  for (int i = 0; i < params[0]->count(); ++i) {
+    if (i % 2 == 0) {
+      EXPECT_EQ(0, params[0]->cpu_data()[i]);
+    } else {
+      EXPECT_NE(pruned.cpu_data()[i], params[0]->cpu_data()[i]);
+    }
+  }
+  EXPECT_NE(0, params[1]->cpu_data()[0]);
+}
+
 
 template <typename TypeParam>
 class AdaGradSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -744,6 +856,15 @@ TYPED_TEST(AdaGradSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(AdaGradSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 
 template <typename TypeParam>
 class NesterovSolverTest : public GradientBasedSolverTest<TypeParam> {
@@ -881,6 +1002,15 @@ TYPED_TEST(NesterovSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(NesterovSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0.9;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 template <typename TypeParam>
 class RMSPropSolverTest : public GradientBasedSolverTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -987,4 +1117,13 @@ TYPED_TEST(RMSPropSolverTest, TestSnapshotShare) {
   }
 }
 
+TYPED_TEST(RMSPropSolverTest, TestFusedUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  const Dtype kLearningRate = 0.01;
+  const Dtype kWeightDecay = 0.5;
+  const Dtype kMomentum = 0;
+  const int kNumIters = 4;
+  this->TestFusedUpdate(kLearningRate, kWeightDecay, kMomentum, kNumIters);
+}
+
 }  // namespace caffe
@@ -115,4 +115,51 @@ TYPED_TEST(Im2colLayerTest, TestRectGradient) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(Im2colLayerTest, TestPad) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int strides[] = {1, 2};
+  for (int i = 0; i < 2; ++i) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_h(3);
+    convolution_param->set_kernel_w(4);
+    convolution_param->set_pad_h(1);
+    convolution_param->set_pad_w(2);
+    convolution_param->set_stride(strides[i]);
+    Im2colLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Check every column against the padded input
+    for (int n = 0; n < 2; ++n) {
+      for (int c = 0; c < 36; ++c) {
+        for (int h = 0; h < this->blob_top_->height(); ++h) {
+          for (int w = 0; w < this->blob_top_->width(); ++w) {
+            const int h_im = h * strides[i] - 1 + (c / 4) % 3;
+            const int w_im = w * strides[i] - 2 + c % 4;
+            const Dtype expected = (h_im < 0 || h_im >= 6 || w_im < 0 ||
+                w_im >= 5) ? 0 :
+                this->blob_bottom_->data_at(n, c / 12, h_im, w_im);
+            EXPECT_EQ(expected, this->blob_top_->data_at(n, c, h, w));
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(Im2colLayerTest, TestPadGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_stride(1);
+  Im2colLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 }  // namespace caffe
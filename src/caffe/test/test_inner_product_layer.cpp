@@ -6,6 +6,8 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -110,4 +112,162 @@ TYPED_TEST(InnerProductLayerTest, TestGradient) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantized) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  layer_param.mutable_quantization_param()->set_input_max(1);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // On CPU, check against the inner product of the values the int8 inputs
+  // and weights stand for. GPU mode computes in floating point.
+  const int M = this->blob_bottom_->num();
+  const int K = this->blob_bottom_->count(1);
+  const int N = 10;
+  vector<Dtype> bottom(this->blob_bottom_->cpu_data(),
+      this->blob_bottom_->cpu_data() + M * K);
+  vector<Dtype> weight(layer->blobs()[0]->cpu_data(),
+      layer->blobs()[0]->cpu_data() + N * K);
+  if (Caffe::mode() == Caffe::CPU) {
+    vector<int8_t> quantized(N * K);
+    vector<Dtype> scales(N);
+    caffe_cpu_quantize_rows(N, K, &weight[0], &quantized[0], &scales[0]);
+    for (int i = 0; i < N * K; ++i) {
+      weight[i] = quantized[i] * scales[i / K];
+    }
+    caffe_cpu_quantize(M * K, &bottom[0], Dtype(1) / 127, &quantized[0]);
+    for (int i = 0; i < M * K; ++i) {
+      bottom[i] = quantized[i] * (Dtype(1) / 127);
+    }
+  }
+  const Dtype* bias = layer->blobs()[1]->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int m = 0; m < M; ++m) {
+    for (int n = 0; n < N; ++n) {
+      Dtype expected = bias[n];
+      for (int k = 0; k < K; ++k) {
+        expected += bottom[m * K + k] * weight[n * K + k];
+      }
+      EXPECT_NEAR(expected, top_data[m * N + n], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantizedNewWeights) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  layer_param.mutable_quantization_param()->set_input_max(1);
+  shared_ptr<InnerProductLayer<Dtype> > layer(
+      new InnerProductLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  vector<Dtype> top(this->blob_top_->cpu_data(),
+      this->blob_top_->cpu_data() + this->blob_top_->count());
+  // Negated weights quantize to the negated int8 values, so the product
+  // changes sign once the layer picks up the new weights.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  caffe_scal(weights->count(), Dtype(-1), weights->mutable_cpu_data());
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int N = 10;
+  const Dtype* bias = layer->blobs()[1]->cpu_data();
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(2 * bias[i % N] - top[i], top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardHalf) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  // Wide enough that the weights are unpacked in more than one panel
+  Blob<Dtype> bottom(2, 1024, 1, 1);
+  FillerParameter filler_param;
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(300);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(bottom_vec, this->blob_top_vec_);
+  EXPECT_TRUE(layer.CanStoreParamAsHalf(0));
+  EXPECT_FALSE(layer.CanStoreParamAsHalf(1));
+  // The reference runs on the weights rounded to half precision.
+  Blob<Dtype>* weights = layer.blobs()[0].get();
+  Dtype* weight_data = weights->mutable_cpu_data();
+  for (int i = 0; i < weights->count(); ++i) {
+    weight_data[i] = half_to_float(float_to_half(weight_data[i]));
+  }
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  Blob<Dtype> reference;
+  reference.CopyFrom(*this->blob_top_, false, true);
+  weights->StoreHalf();
+  layer.Forward(bottom_vec, this->blob_top_vec_);
+  for (int i = 0; i < reference.count(); ++i) {
+    EXPECT_NEAR(reference.cpu_data()[i], this->blob_top_->cpu_data()[i],
+        1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparse) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("gaussian");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int M = this->blob_bottom_->num();
+  const int K = this->blob_bottom_->count(1);
+  const int N = 10;
+  // Run once with weights 80% zero, then with others, which the layer must
+  // notice.
+  for (int pass = 0; pass < 2; ++pass) {
+    Dtype* weight_data = layer.blobs()[0]->mutable_cpu_data();
+    for (int i = 0; i < N * K; ++i) {
+      if ((i + pass) % 5) {
+        weight_data[i] = 0;
+      } else if (pass) {
+        weight_data[i] = i % 7 - Dtype(3);
+      }
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const Dtype* bottom = this->blob_bottom_->cpu_data();
+    const Dtype* weight = layer.blobs()[0]->cpu_data();
+    const Dtype* bias = layer.blobs()[1]->cpu_data();
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    for (int m = 0; m < M; ++m) {
+      for (int n = 0; n < N; ++n) {
+        Dtype expected = bias[n];
+        for (int k = 0; k < K; ++k) {
+          expected += bottom[m * K + k] * weight[n * K + k];
+        }
+        EXPECT_NEAR(expected, top_data[m * N + n], 1e-4);
+      }
+    }
+  }
+}
+
 }  // namespace caffe
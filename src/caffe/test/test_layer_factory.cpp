@@ -8,6 +8,7 @@
 #include "caffe/layer_factory.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_data_util.hpp"
 
 namespace caffe {
 
@@ -21,11 +22,15 @@ TYPED_TEST(LayerFactoryTest, TestCreateLayer) {
   typename LayerRegistry<Dtype>::CreatorRegistry& registry =
       LayerRegistry<Dtype>::Registry();
   shared_ptr<Layer<Dtype> > layer;
-  LayerParameter layer_param;
   for (typename LayerRegistry<Dtype>::CreatorRegistry::iterator iter =
        registry.begin(); iter != registry.end(); ++iter) {
     // Special case: PythonLayer is checked by pytest
     if (iter->first == "Python") { continue; }
+    LayerParameter layer_param;
+    // Data layers start reading their database as they are created
+    if (iter->first == "Data") {
+      SetUpSingleRecordSource(layer_param.mutable_data_param());
+    }
     layer_param.set_type(iter->first);
     layer = LayerRegistry<Dtype>::CreateLayer(layer_param);
     EXPECT_EQ(iter->first, layer->type());
@@ -1,15 +1,22 @@
 #include <stdint.h>  // for uint32_t & uint64_t
 #include <time.h>
+#include <algorithm>
 #include <climits>
 #include <cmath>  // for std::fabs
 #include <cstdlib>  // for rand_r
+#include <limits>
+#include <vector>
 
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/csr_matrix.hpp"
+#include "caffe/util/fast_math.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -150,6 +157,169 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestExpLog) {
+  // Over several threads, as the blob holds more than kParallelGrain values
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_exp<TypeParam>(n, x, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], std::exp(x[i]), 1e-6 * std::exp(x[i]));
+  }
+  caffe_log<TypeParam>(n, y, y);
+  for (int i = 0; i < n; ++i) {
+    EXPECT_NEAR(y[i], x[i], 1e-6 * std::max(TypeParam(1), std::fabs(x[i])));
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestFastMath) {
+  const TypeParam inf = std::numeric_limits<TypeParam>::infinity();
+  // Denormal results differ by their last bit at most
+  const TypeParam denorm_min = std::numeric_limits<TypeParam>::denorm_min();
+  for (TypeParam x = -120; x <= 88; x += 0.0625) {
+    const TypeParam y = fast_exp(x);
+    EXPECT_NEAR(y, std::exp(x), 1e-6 * std::exp(x) + denorm_min);
+    EXPECT_NEAR(fast_tanh(x), std::tanh(x), 1e-6);
+    if (y > 0) {
+      EXPECT_NEAR(fast_log(y), std::log(y),
+          1e-6 * std::max(TypeParam(1), std::fabs(std::log(y))));
+    }
+  }
+  EXPECT_EQ(0, fast_exp(-inf));
+  EXPECT_EQ(inf, fast_exp(inf));
+  EXPECT_EQ(-inf, fast_log(TypeParam(0)));
+  EXPECT_EQ(inf, fast_log(inf));
+  EXPECT_NE(fast_log(TypeParam(-1)), fast_log(TypeParam(-1)));
+  const TypeParam denormal = std::numeric_limits<TypeParam>::min() / 1000;
+  EXPECT_NEAR(fast_log(denormal), std::log(denormal),
+      1e-6 * std::fabs(std::log(denormal)));
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestQuantize) {
+  const TypeParam x[] = {-3, -1, -0.7, -0.5, 0, 0.2, 0.5, 1.24, 1.26, 3};
+  const int8_t expected[] = {-127, -100, -70, -50, 0, 20, 50, 124, 126, 127};
+  int8_t y[10];
+  caffe_cpu_quantize<TypeParam>(10, x, 0.01, y);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(expected[i], y[i]);
+  }
+  TypeParam scales[2];
+  caffe_cpu_quantize_rows<TypeParam>(2, 5, x, y, scales);
+  EXPECT_NEAR(scales[0], 3. / 127, 1e-7);
+  EXPECT_NEAR(scales[1], 3. / 127, 1e-7);
+  EXPECT_EQ(-127, y[0]);
+  EXPECT_EQ(0, y[4]);
+  EXPECT_EQ(127, y[9]);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestGemmS8) {
+  // Wider than a block of columns, and with the extreme values
+  const int M = 3, N = 2500, K = 7;
+  vector<int8_t> A(M * K), B(K * N);
+  for (int i = 0; i < A.size(); ++i) {
+    A[i] = i % 2 ? -127 : static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  for (int i = 0; i < B.size(); ++i) {
+    B[i] = i % 3 ? 127 : static_cast<int8_t>(caffe_rng_rand() % 255 - 127);
+  }
+  vector<int8_t> B_t(N * K);
+  for (int k = 0; k < K; ++k) {
+    for (int j = 0; j < N; ++j) {
+      B_t[j * K + k] = B[k * N + j];
+    }
+  }
+  vector<int> C(M * N), C_t(M * N);
+  caffe_cpu_gemm_s8(CblasNoTrans, M, N, K, &A[0], &B[0], &C[0]);
+  caffe_cpu_gemm_s8(CblasTrans, M, N, K, &A[0], &B_t[0], &C_t[0]);
+  for (int i = 0; i < M; ++i) {
+    for (int j = 0; j < N; ++j) {
+      int expected = 0;
+      for (int k = 0; k < K; ++k) {
+        expected += A[i * K + k] * B[k * N + j];
+      }
+      EXPECT_EQ(expected, C[i * N + j]);
+      EXPECT_EQ(expected, C_t[i * N + j]);
+    }
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestCSRGemm) {
+  // A sparse matrix with an empty row, multiplied from either side
+  const int M = 5, N = 7, K = 9;
+  Blob<TypeParam> sparse(M, K, 1, 1);
+  TypeParam* sparse_data = sparse.mutable_cpu_data();
+  for (int i = 0; i < sparse.count(); ++i) {
+    sparse_data[i] = i / K == 2 || i % 3 ? 0 : i - TypeParam(20);
+  }
+  CSRMatrix<TypeParam> csr;
+  EXPECT_FALSE(csr.Update(sparse, M, 0.9));
+  EXPECT_TRUE(csr.Update(sparse, M, 0.6));
+  EXPECT_EQ(M, csr.rows());
+  EXPECT_EQ(K, csr.cols());
+  EXPECT_EQ(12, csr.nnz());
+  EXPECT_EQ(csr.row_ptr()[2], csr.row_ptr()[3]);
+  Blob<TypeParam> dense(K, N, 1, 1), dense_t(N, K, 1, 1);
+  FillerParameter filler_param;
+  GaussianFiller<TypeParam> filler(filler_param);
+  filler.Fill(&dense);
+  filler.Fill(&dense_t);
+  vector<TypeParam> C(M * N), expected(M * N), C_t(N * M), expected_t(N * M);
+  caffe_cpu_csr_gemm(M, N, csr.row_ptr(), csr.col(), csr.val(),
+      dense.cpu_data(), &C[0]);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasNoTrans, M, N, K, 1.,
+      sparse_data, dense.cpu_data(), 0., &expected[0]);
+  caffe_cpu_gemm_csr_t(N, M, K, dense_t.cpu_data(), csr.row_ptr(), csr.col(),
+      csr.val(), &C_t[0]);
+  caffe_cpu_gemm<TypeParam>(CblasNoTrans, CblasTrans, N, M, K, 1.,
+      dense_t.cpu_data(), sparse_data, 0., &expected_t[0]);
+  for (int i = 0; i < M * N; ++i) {
+    EXPECT_NEAR(expected[i], C[i], 1e-4);
+    EXPECT_NEAR(expected_t[i], C_t[i], 1e-4);
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestHalf) {
+  // 1 + 2^-11 and 1 + 3 * 2^-11 lie halfway between halves and round to
+  // even; 2^-24 is the smallest denormal and 65520 rounds up to infinity.
+  const TypeParam x[] = {0, -2, 1.00048828125, 1.00146484375, 65504, 65520,
+      5.9604644775390625e-8, -6.103515625e-5, 1e-9};
+  const uint16_t expected[] = {0x0000, 0xc000, 0x3c00, 0x3c02, 0x7bff, 0x7c00,
+      0x0001, 0x8400, 0x0000};
+  uint16_t y[9];
+  caffe_cpu_to_half<TypeParam>(9, x, y);
+  for (int i = 0; i < 9; ++i) {
+    EXPECT_EQ(expected[i], y[i]);
+  }
+  EXPECT_EQ(0x7e00, float_to_half(std::numeric_limits<float>::quiet_NaN()));
+  // Every half other than a NaN converts to float and back unchanged.
+  vector<uint16_t> halves;
+  for (int h = 0; h < 65536; ++h) {
+    if ((h & 0x7c00) != 0x7c00 || (h & 0x03ff) == 0) {
+      halves.push_back(h);
+    }
+  }
+  vector<TypeParam> values(halves.size());
+  caffe_cpu_from_half<TypeParam>(halves.size(), &halves[0], &values[0]);
+  EXPECT_EQ(1, values[0x3c00]);
+  EXPECT_EQ(-std::numeric_limits<float>::infinity(), half_to_float(0xfc00));
+  EXPECT_NE(half_to_float(0x7e00), half_to_float(0x7e00));
+  vector<uint16_t> round_trip(halves.size());
+  caffe_cpu_to_half<TypeParam>(values.size(), &values[0], &round_trip[0]);
+  for (int i = 0; i < halves.size(); ++i) {
+    EXPECT_EQ(halves[i], round_trip[i]);
+  }
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestParallelThreads) {
+  Caffe::set_cpu_threads(3);
+  EXPECT_EQ(1, parallel_threads(kParallelGrain - 1));
+  EXPECT_EQ(2, parallel_threads(2 * kParallelGrain));
+  EXPECT_EQ(3, parallel_threads(100 * kParallelGrain));
+  Caffe::set_cpu_threads(0);
+  EXPECT_EQ(std::min(openmp_max_threads(), 100),
+      parallel_threads(100 * kParallelGrain));
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
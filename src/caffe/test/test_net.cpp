@@ -1,7 +1,12 @@
+#include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/lexical_cast.hpp"
+#include "boost/scoped_ptr.hpp"
 #include "google/protobuf/text_format.h"
 
 #include "gtest/gtest.h"
@@ -9,13 +14,19 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
+#include "caffe/util/db.hpp"
+#include "caffe/util/half.hpp"
+#include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
 namespace caffe {
 
+using boost::scoped_ptr;
+
 template <typename TypeParam>
 class NetTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -1098,6 +1109,67 @@ TYPED_TEST(NetTest, TestSharedWeightsDiffNet) {
   }
 }
 
+template <typename Dtype>
+int LayerIndex(const Net<Dtype>& net, const string& name) {
+  const vector<string>& names = net.layer_names();
+  return std::find(names.begin(), names.end(), name) - names.begin();
+}
+
+// Copies the diffs of the params reported ready, to check that Backward
+// leaves them as they were then.
+template <typename Dtype>
+class RecordingCallback : public Net<Dtype>::ParamDiffsReadyCallback {
+ public:
+  explicit RecordingCallback(Net<Dtype>* net) : net_(net) {}
+  virtual void ParamDiffsReady(int layer_id) {
+    layers_.push_back(layer_id);
+    const vector<int>& ids = net_->params_final_after(layer_id);
+    for (int i = 0; i < ids.size(); ++i) {
+      const Blob<Dtype>* param = net_->learnable_params()[ids[i]];
+      diffs_[ids[i]].assign(param->cpu_diff(),
+          param->cpu_diff() + param->count());
+    }
+  }
+
+  Net<Dtype>* net_;
+  vector<int> layers_;
+  map<int, vector<Dtype> > diffs_;
+};
+
+TYPED_TEST(NetTest, TestParamDiffsReadyCallback) {
+  typedef typename TypeParam::Dtype Dtype;
+  vector<Blob<Dtype>*> bottom;
+  // Each layer's params are final right after it
+  this->InitUnsharedWeightsNet(NULL, NULL, false, true);
+  RecordingCallback<Dtype> unshared(this->net_.get());
+  this->net_->add_param_diffs_ready_callback(&unshared);
+  this->net_->ForwardBackward(bottom);
+  const int ip1 = LayerIndex(*this->net_, "innerproduct1");
+  const int ip2 = LayerIndex(*this->net_, "innerproduct2");
+  ASSERT_EQ(2, unshared.layers_.size());
+  EXPECT_EQ(ip2, unshared.layers_[0]);
+  EXPECT_EQ(ip1, unshared.layers_[1]);
+  EXPECT_EQ(2, this->net_->params_final_after(ip1).size());
+  EXPECT_EQ(2, this->net_->params_final_after(ip2).size());
+  ASSERT_EQ(4, unshared.diffs_.size());
+  for (int i = 0; i < this->net_->learnable_params().size(); ++i) {
+    const Blob<Dtype>* param = this->net_->learnable_params()[i];
+    for (int j = 0; j < param->count(); ++j) {
+      EXPECT_EQ(param->cpu_diff()[j], unshared.diffs_[i][j]);
+    }
+  }
+  // A shared param is final only after the lower of its layers
+  this->InitSharedWeightsNet();
+  RecordingCallback<Dtype> shared(this->net_.get());
+  this->net_->add_param_diffs_ready_callback(&shared);
+  this->net_->ForwardBackward(bottom);
+  ASSERT_EQ(1, shared.layers_.size());
+  EXPECT_EQ(LayerIndex(*this->net_, "innerproduct1"),
+      shared.layers_[0]);
+  EXPECT_EQ(0, this->net_->params_final_after(
+      LayerIndex(*this->net_, "innerproduct2")).size());
+}
+
 TYPED_TEST(NetTest, TestSharedWeightsUpdate) {
   typedef typename TypeParam::Dtype Dtype;
   Caffe::set_random_seed(this->seed_);
@@ -2317,6 +2389,569 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestCPUTuning) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  string cache_file;
+  MakeTempFilename(&cache_file);
+  const string proto =
+      "name: 'TuningNetwork' "
+      "input: 'data' "
+      "input_dim: 4 "
+      "input_dim: 8 "
+      "input_dim: 10 "
+      "input_dim: 9 "
+      "force_backward: true "
+      "cpu_tuning: true "
+      "cpu_tuning_cache: '" + cache_file + "' "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 8 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    engine: DIRECT "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'conv1' "
+      "  top: 'conv2' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 2 "
+      "    stride: 2 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(4, 8, 10, 9);
+  filler.Fill(&data);
+  // Tune, then reuse the cached variants with the same weights
+  vector<shared_ptr<Net<Dtype> > > nets(2);
+  for (int i = 0; i < nets.size(); ++i) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitNetFromProtoString(proto);
+    nets[i] = this->net_;
+    Blob<Dtype>* input_blob = nets[i]->input_blobs()[0];
+    caffe_copy(data.count(), data.cpu_data(), input_blob->mutable_cpu_data());
+    nets[i]->ForwardPrefilled();
+  }
+  std::ifstream cache(cache_file.c_str());
+  string line;
+  int lines = 0;
+  while (std::getline(cache, line)) {
+    ++lines;
+  }
+  EXPECT_EQ(lines, 2);
+  for (int i = 0; i < nets[0]->layers().size(); ++i) {
+    const BaseConvolutionLayer<Dtype>* layers[2];
+    for (int j = 0; j < 2; ++j) {
+      layers[j] = dynamic_cast<const BaseConvolutionLayer<Dtype>*>(
+          nets[j]->layers()[i].get());
+    }
+    ASSERT_TRUE(layers[0] != NULL);
+    EXPECT_GE(layers[0]->cpu_variant().algorithm, 0);
+    EXPECT_GT(layers[0]->cpu_variant().batch, 0);
+    EXPECT_EQ(layers[0]->cpu_variant().algorithm,
+        layers[1]->cpu_variant().algorithm);
+    EXPECT_EQ(layers[0]->cpu_variant().batch, layers[1]->cpu_variant().batch);
+    EXPECT_EQ(layers[0]->cpu_variant().threads,
+        layers[1]->cpu_variant().threads);
+  }
+  // Tuning leaves no parameter gradients behind
+  for (int i = 0; i < nets[0]->params().size(); ++i) {
+    const Blob<Dtype>* param = nets[0]->params()[i].get();
+    for (int j = 0; j < param->count(); ++j) {
+      EXPECT_EQ(param->cpu_diff()[j], 0);
+    }
+  }
+  const Blob<Dtype>* outputs[2] = {nets[0]->output_blobs()[0],
+      nets[1]->output_blobs()[0]};
+  for (int i = 0; i < outputs[0]->count(); ++i) {
+    EXPECT_NEAR(outputs[0]->cpu_data()[i], outputs[1]->cpu_data()[i], 1e-4);
+  }
+  remove(cache_file.c_str());
+}
+
+TYPED_TEST(NetTest, TestReuseBlobMemory) {
+  typedef typename TypeParam::Dtype Dtype;
+  // pool1 feeds two branches through a Split, which share the memory of
+  // conv1 and pool1 once those have been consumed.
+  const string proto =
+      "name: 'ReuseNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 10 "
+      "input_dim: 10 "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { "
+      "    pool: MAX "
+      "    kernel_size: 2 "
+      "    stride: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'norm1' "
+      "  type: 'LRN' "
+      "  bottom: 'pool1' "
+      "  top: 'norm1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'norm1' "
+      "  bottom: 'conv2' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'softmax' "
+      "  type: 'Softmax' "
+      "  bottom: 'sum' "
+      "  top: 'softmax' "
+      "} ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 10, 10);
+  filler.Fill(&data);
+  // Reference, with every blob in its own memory
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  Blob<Dtype> reference;
+  reference.CopyFrom(*this->net_->output_blobs()[0], false, true);
+  // Twice, so that reused memory starts out dirty
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto + "reuse_blob_memory: true");
+  for (int i = 0; i < 2; ++i) {
+    caffe_copy(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->mutable_cpu_data());
+    this->net_->ForwardPrefilled();
+    const Blob<Dtype>* output = this->net_->output_blobs()[0];
+    ASSERT_EQ(output->count(), reference.count());
+    for (int j = 0; j < output->count(); ++j) {
+      EXPECT_EQ(output->cpu_data()[j], reference.cpu_data()[j]);
+    }
+  }
+  EXPECT_EQ(this->net_->blob_by_name("conv1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  EXPECT_EQ(this->net_->blob_by_name("pool1")->data(),
+      this->net_->blob_by_name("sum")->data());
+  EXPECT_NE(this->net_->blob_by_name("conv2")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  EXPECT_NE(this->net_->blob_by_name("data")->data(),
+      this->net_->blob_by_name("norm1")->data());
+  // Blobs to keep stay apart
+  this->InitNetFromProtoString(proto + "reuse_blob_memory: true "
+      "keep_blob: 'conv1'");
+  EXPECT_NE(this->net_->blob_by_name("conv1")->data(),
+      this->net_->blob_by_name("norm1")->data());
+}
+
+TYPED_TEST(NetTest, TestReuseBlobMemoryDataLayer) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A Data layer points its top at the prefetched batch, so ip2, which
+  // would otherwise take over the memory of data, must not get it.
+  string source;
+  MakeTempDir(&source);
+  source += "/db";
+  scoped_ptr<db::DB> db(db::GetDB(DataParameter_DB_LEVELDB));
+  db->Open(source, db::NEW);
+  scoped_ptr<db::Transaction> txn(db->NewTransaction());
+  for (int i = 0; i < 4; ++i) {
+    Datum datum;
+    datum.set_label(i);
+    datum.set_channels(1);
+    datum.set_height(2);
+    datum.set_width(2);
+    for (int j = 0; j < 4; ++j) {
+      datum.mutable_data()->push_back(static_cast<uint8_t>(i * 4 + j));
+    }
+    string out;
+    CHECK(datum.SerializeToString(&out));
+    txn->Put(boost::lexical_cast<string>(i), out);
+  }
+  txn->Commit();
+  db->Close();
+  const string proto =
+      "name: 'ReuseDataNetwork' "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "  data_param { "
+      "    source: '" + source + "' "
+      "    backend: LEVELDB "
+      "    batch_size: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "  inner_product_param { "
+      "    num_output: 50 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      "  inner_product_param { "
+      "    num_output: 50 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'ip2' "
+      "  top: 'ip3' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'softmax' "
+      "  type: 'Softmax' "
+      "  bottom: 'ip3' "
+      "  top: 'softmax' "
+      "} ";
+  const int kNumBatches = 3;
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  vector<shared_ptr<Blob<Dtype> > > references;
+  for (int i = 0; i < kNumBatches; ++i) {
+    this->net_->ForwardPrefilled();
+    references.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    references[i]->CopyFrom(*this->net_->output_blobs()[0], false, true);
+  }
+  // Nets reading the same source share its reader, so the new one only
+  // starts from the first record once the old one is gone.
+  this->net_.reset();
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto + "reuse_blob_memory: true");
+  const shared_ptr<Blob<Dtype> > data = this->net_->blob_by_name("data");
+  for (int i = 0; i < kNumBatches; ++i) {
+    this->net_->ForwardPrefilled();
+    const Blob<Dtype>* output = this->net_->output_blobs()[0];
+    ASSERT_EQ(output->count(), references[i]->count());
+    for (int j = 0; j < output->count(); ++j) {
+      EXPECT_EQ(output->cpu_data()[j], references[i]->cpu_data()[j]);
+    }
+    for (int blob_id = 0; blob_id < this->net_->blobs().size(); ++blob_id) {
+      if (this->net_->blobs()[blob_id] != data) {
+        EXPECT_NE(data->data(), this->net_->blobs()[blob_id]->data());
+      }
+    }
+  }
+  // ip3 still takes over the memory of ip1.
+  EXPECT_EQ(this->net_->blob_by_name("ip1")->data(),
+      this->net_->blob_by_name("ip3")->data());
+}
+
+TYPED_TEST(NetTest, TestRecomputeLayers) {
+  typedef typename TypeParam::Dtype Dtype;
+  // conv1, relu1 in place, pool1 and norm1 are dropped after Forward and
+  // recomputed in Backward, while conv2 and sum act as checkpoints.
+  const string proto =
+      "name: 'RecomputeNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 10 "
+      "input_dim: 10 "
+      "input: 'label' "
+      "input_dim: 2 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "input_dim: 1 "
+      "force_backward: true "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'pool1' "
+      "  type: 'Pooling' "
+      "  bottom: 'conv1' "
+      "  top: 'pool1' "
+      "  pooling_param { "
+      "    pool: MAX "
+      "    kernel_size: 2 "
+      "    stride: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'norm1' "
+      "  type: 'LRN' "
+      "  bottom: 'pool1' "
+      "  top: 'norm1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'Convolution' "
+      "  bottom: 'pool1' "
+      "  top: 'conv2' "
+      "  convolution_param { "
+      "    num_output: 5 "
+      "    kernel_size: 1 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'norm1' "
+      "  bottom: 'conv2' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'sum' "
+      "  top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'SoftmaxWithLoss' "
+      "  bottom: 'ip' "
+      "  bottom: 'label' "
+      "  top: 'loss' "
+      "} ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 10, 10);
+  filler.Fill(&data);
+  const Dtype label[] = {1, 3};
+  // Reference, keeping every blob
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  caffe_copy(data.count(), data.cpu_data(),
+      this->net_->input_blobs()[0]->mutable_cpu_data());
+  caffe_copy(2, label, this->net_->input_blobs()[1]->mutable_cpu_data());
+  Dtype reference_loss;
+  this->net_->ForwardPrefilled(&reference_loss);
+  this->net_->Backward();
+  Blob<Dtype> reference_diff;
+  reference_diff.CopyFrom(*this->net_->input_blobs()[0], true, true);
+  const vector<shared_ptr<Blob<Dtype> > > reference_params =
+      this->net_->params();
+  // Twice, so that recomputation starts from released memory
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto + "recompute_layer: 'conv1' "
+      "recompute_layer: 'relu1' recompute_layer: 'pool1' "
+      "recompute_layer: 'norm1'");
+  for (int i = 0; i < 2; ++i) {
+    caffe_copy(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->mutable_cpu_data());
+    caffe_copy(2, label, this->net_->input_blobs()[1]->mutable_cpu_data());
+    this->net_->ClearParamDiffs();
+    Dtype loss;
+    this->net_->ForwardPrefilled(&loss);
+    EXPECT_EQ(loss, reference_loss);
+    EXPECT_EQ(this->net_->blob_by_name("conv1")->data()->head(),
+        SyncedMemory::UNINITIALIZED);
+    EXPECT_EQ(this->net_->blob_by_name("norm1")->data()->head(),
+        SyncedMemory::UNINITIALIZED);
+    EXPECT_NE(this->net_->blob_by_name("conv2")->data()->head(),
+        SyncedMemory::UNINITIALIZED);
+    this->net_->Backward();
+    const Blob<Dtype>* input = this->net_->input_blobs()[0];
+    for (int j = 0; j < input->count(); ++j) {
+      EXPECT_EQ(input->cpu_diff()[j], reference_diff.cpu_diff()[j]);
+    }
+    const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+    ASSERT_EQ(params.size(), reference_params.size());
+    for (int p = 0; p < params.size(); ++p) {
+      const Dtype* reference = reference_params[p]->cpu_diff();
+      for (int j = 0; j < params[p]->count(); ++j) {
+        EXPECT_EQ(params[p]->cpu_diff()[j], reference[j]);
+      }
+    }
+    EXPECT_EQ(this->net_->blob_by_name("pool1")->diff()->head(),
+        SyncedMemory::UNINITIALIZED);
+  }
+}
+
+TYPED_TEST(NetTest, TestRecomputeLayersPartialForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  // branch reads conv1 through split before sig1 changes it in place. Running
+  // branch alone again recomputes conv1 as branch saw it, which Backward of
+  // sig1 must not take for its output.
+  const string proto =
+      "name: 'RecomputeNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 4 "
+      "input_dim: 4 "
+      "force_backward: true "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv1' "
+      "  convolution_param { "
+      "    num_output: 3 "
+      "    kernel_size: 1 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'split' "
+      "  type: 'Split' "
+      "  bottom: 'conv1' "
+      "  top: 'split0' "
+      "  top: 'split1' "
+      "} "
+      "layer { "
+      "  name: 'branch' "
+      "  type: 'Power' "
+      "  bottom: 'split0' "
+      "  top: 'branch' "
+      "  power_param { "
+      "    scale: 2 "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'sig1' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'split1' "
+      "  top: 'split1' "
+      "} "
+      "layer { "
+      "  name: 'sum' "
+      "  type: 'Eltwise' "
+      "  bottom: 'branch' "
+      "  bottom: 'split1' "
+      "  top: 'sum' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'sum' "
+      "  bottom: 'data' "
+      "} "
+      "recompute_layer: 'conv1' "
+      "recompute_layer: 'sig1' ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 4, 4);
+  filler.Fill(&data);
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  const int branch = LayerIndex(*this->net_, "branch");
+  vector<shared_ptr<Blob<Dtype> > > diffs[2];
+  for (int rerun = 0; rerun <= 1; ++rerun) {
+    caffe_copy(data.count(), data.cpu_data(),
+        this->net_->input_blobs()[0]->mutable_cpu_data());
+    this->net_->ClearParamDiffs();
+    this->net_->ForwardPrefilled();
+    if (rerun) {
+      this->net_->ForwardFromTo(branch, branch);
+    }
+    this->net_->Backward();
+    diffs[rerun].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    diffs[rerun].back()->CopyFrom(*this->net_->input_blobs()[0], true, true);
+    const vector<shared_ptr<Blob<Dtype> > >& params = this->net_->params();
+    for (int p = 0; p < params.size(); ++p) {
+      diffs[rerun].push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      diffs[rerun].back()->CopyFrom(*params[p], true, true);
+    }
+  }
+  ASSERT_EQ(diffs[0].size(), diffs[1].size());
+  for (int i = 0; i < diffs[0].size(); ++i) {
+    for (int j = 0; j < diffs[0][i]->count(); ++j) {
+      EXPECT_EQ(diffs[0][i]->cpu_diff()[j], diffs[1][i]->cpu_diff()[j]);
+    }
+  }
+}
+
 TYPED_TEST(NetTest, TestSkipPropagateDown) {
   // check bottom_need_backward if propagate_down is true
   this->InitSkipPropNet(false);
@@ -2365,4 +3000,120 @@ TYPED_TEST(NetTest, TestSkipPropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestHalfParams) {
+  typedef typename TypeParam::Dtype Dtype;
+  Caffe::set_mode(Caffe::CPU);
+  const string proto =
+      "name: 'HalfNetwork' "
+      "input: 'data' "
+      "input_dim: 2 "
+      "input_dim: 3 "
+      "input_dim: 6 "
+      "input_dim: 6 "
+      "state { "
+      "  phase: TEST "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "  convolution_param { "
+      "    num_output: 4 "
+      "    kernel_size: 3 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'conv' "
+      "  top: 'ip' "
+      "  inner_product_param { "
+      "    num_output: 5 "
+      "    weight_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "    bias_filler { "
+      "      type: 'gaussian' "
+      "    } "
+      "  } "
+      "} ";
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 3, 6, 6);
+  filler.Fill(&data);
+  // The reference runs in Dtype on params rounded to half precision.
+  Caffe::set_random_seed(this->seed_);
+  this->InitNetFromProtoString(proto);
+  shared_ptr<Net<Dtype> > float_net = this->net_;
+  for (int i = 0; i < float_net->params().size(); ++i) {
+    Blob<Dtype>* param = float_net->params()[i].get();
+    for (int j = 0; j < param->count(); ++j) {
+      param->mutable_cpu_data()[j] =
+          half_to_float(float_to_half(param->cpu_data()[j]));
+    }
+  }
+  float_net->input_blobs()[0]->CopyFrom(data);
+  float_net->ForwardPrefilled();
+  NetParameter float_param;
+  float_net->ToProto(&float_param);
+  // The weights of both layers are held as half precision, and the net
+  // writes all of its params so.
+  this->InitNetFromProtoString(proto + "half_params: true ");
+  shared_ptr<Net<Dtype> > half_net = this->net_;
+  half_net->CopyTrainedLayersFrom(float_param);
+  for (int i = 0; i < half_net->layers().size(); ++i) {
+    EXPECT_TRUE(half_net->layers()[i]->blobs()[0]->stores_half());
+    EXPECT_FALSE(half_net->layers()[i]->blobs()[1]->stores_half());
+  }
+  half_net->input_blobs()[0]->CopyFrom(data);
+  half_net->ForwardPrefilled();
+  const Blob<Dtype>* output = half_net->output_blobs()[0];
+  const Blob<Dtype>* reference = float_net->output_blobs()[0];
+  for (int i = 0; i < output->count(); ++i) {
+    EXPECT_NEAR(reference->cpu_data()[i], output->cpu_data()[i], 1e-4);
+  }
+  NetParameter half_param;
+  half_net->ToProto(&half_param);
+  for (int i = 0; i < half_param.layer_size(); ++i) {
+    for (int j = 0; j < half_param.layer(i).blobs_size(); ++j) {
+      const BlobProto& blob = half_param.layer(i).blobs(j);
+      EXPECT_EQ(0, blob.data_size());
+      EXPECT_EQ(0, blob.double_data_size());
+      EXPECT_EQ(2 * half_net->layers()[i]->blobs()[j]->count(),
+          blob.half_data().size());
+    }
+  }
+  // Half precision HDF5 weights read back the same into either kind of net
+  string filename;
+  MakeTempFilename(&filename);
+  filename += ".h5";
+  half_net->ToHDF5(filename);
+  this->InitNetFromProtoString(proto);
+  this->net_->CopyTrainedLayersFrom(filename);
+  for (int i = 0; i < float_net->params().size(); ++i) {
+    const Blob<Dtype>* expected = float_net->params()[i].get();
+    const Blob<Dtype>* param = this->net_->params()[i].get();
+    for (int j = 0; j < param->count(); ++j) {
+      EXPECT_EQ(expected->cpu_data()[j], param->cpu_data()[j]);
+    }
+  }
+  this->InitNetFromProtoString(proto + "half_params: true ");
+  this->net_->CopyTrainedLayersFrom(filename);
+  for (int i = 0; i < half_net->layers().size(); ++i) {
+    const Blob<Dtype>* expected = half_net->layers()[i]->blobs()[0].get();
+    const Blob<Dtype>* weights = this->net_->layers()[i]->blobs()[0].get();
+    for (int j = 0; j < weights->count(); ++j) {
+      EXPECT_EQ(expected->half_data()[j], weights->half_data()[j]);
+    }
+  }
+  remove(filename.c_str());
+}
+
 }  // namespace caffe
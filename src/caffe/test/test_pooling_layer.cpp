@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cfloat>
 #include <cstring>
 #include <vector>
 
@@ -472,6 +474,67 @@ TYPED_TEST(PoolingLayerTest, TestGradientMax) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestForwardBackwardMaxStride2) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The common 2x2 and 3x3 kernels of stride 2, with a partial last window,
+  // and without the mask in the TEST phase.
+  this->blob_bottom_->Reshape(2, 3, 7, 8);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int kernel = 2; kernel <= 3; ++kernel) {
+    for (int phase = TRAIN; phase <= TEST; ++phase) {
+      LayerParameter layer_param;
+      layer_param.set_phase(static_cast<Phase>(phase));
+      PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+      pooling_param->set_kernel_size(kernel);
+      pooling_param->set_stride(2);
+      pooling_param->set_pool(PoolingParameter_PoolMethod_MAX);
+      PoolingLayer<Dtype> layer(layer_param);
+      layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+      filler.Fill(this->blob_bottom_);
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      const int height = this->blob_top_->height();
+      const int width = this->blob_top_->width();
+      EXPECT_EQ(height, kernel == 2 ? 4 : 3);
+      EXPECT_EQ(width, 4);
+      for (int i = 0; i < this->blob_top_->count(); ++i) {
+        this->blob_top_->mutable_cpu_diff()[i] = i % 5 - 2;
+      }
+      vector<bool> propagate_down(1, true);
+      layer.Backward(this->blob_top_vec_, propagate_down,
+          this->blob_bottom_vec_);
+      Blob<Dtype> bottom_diff;
+      bottom_diff.ReshapeLike(*this->blob_bottom_);
+      for (int n = 0; n < 2; ++n) {
+        for (int c = 0; c < 3; ++c) {
+          for (int ph = 0; ph < height; ++ph) {
+            for (int pw = 0; pw < width; ++pw) {
+              Dtype value = -FLT_MAX;
+              int argmax_h = -1, argmax_w = -1;
+              for (int h = ph * 2; h < std::min(ph * 2 + kernel, 7); ++h) {
+                for (int w = pw * 2; w < std::min(pw * 2 + kernel, 8); ++w) {
+                  if (this->blob_bottom_->data_at(n, c, h, w) > value) {
+                    value = this->blob_bottom_->data_at(n, c, h, w);
+                    argmax_h = h;
+                    argmax_w = w;
+                  }
+                }
+              }
+              EXPECT_EQ(this->blob_top_->data_at(n, c, ph, pw), value);
+              bottom_diff.mutable_cpu_diff()[
+                  bottom_diff.offset(n, c, argmax_h, argmax_w)] +=
+                  this->blob_top_->diff_at(n, c, ph, pw);
+            }
+          }
+        }
+      }
+      for (int i = 0; i < bottom_diff.count(); ++i) {
+        EXPECT_EQ(bottom_diff.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i]);
+      }
+    }
+  }
+}
+
 TYPED_TEST(PoolingLayerTest, TestForwardMaxPadded) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -1,13 +1,25 @@
+#include <unistd.h>
+
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/lexical_cast.hpp"
+#include "boost/thread.hpp"
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 
 #include "caffe/common.hpp"
+#include "caffe/communicator.hpp"
+#include "caffe/data_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/solver.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+#include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -37,6 +49,119 @@ class SolverTest : public MultiDeviceTest<TypeParam> {
     solver_.reset(new SGDSolver<Dtype>(param));
   }
 
+  // A solver of a net that learns to map the 'data', 4x6, of data_layer to
+  // its 'targets', 4 values.
+  string SolverProto(const string& data_layer) {
+    return
+       "base_lr: 0.01 lr_policy: 'fixed' momentum: 0.9 weight_decay: 0.01 "
+       "random_seed: 1701 "
+       "net_param { " + data_layer +
+       "  layer { "
+       "    name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+       "    inner_product_param { "
+       "      num_output: 5 "
+       "      weight_filler { type: 'gaussian' } "
+       "      bias_filler { type: 'gaussian' } "
+       "    } "
+       "  } "
+       "  layer { "
+       "    name: 'ip2' type: 'InnerProduct' bottom: 'ip1' top: 'ip2' "
+       "    inner_product_param { "
+       "      num_output: 1 "
+       "      weight_filler { type: 'gaussian' } "
+       "      bias_filler { type: 'gaussian' } "
+       "    } "
+       "  } "
+       "  layer { "
+       "    name: 'loss' type: 'EuclideanLoss' "
+       "    bottom: 'ip2' bottom: 'targets' "
+       "  } "
+       "} ";
+  }
+
+  // The data layer of SolverProto as a DummyData layer with the given
+  // fillers, which refills its tops every batch unless they are constant.
+  string DummyDataLayer(const string& data_filler,
+      const string& targets_filler) {
+    return
+       "  layer { "
+       "    name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+       "    dummy_data_param { "
+       "      shape { dim: 4 dim: 6 } shape { dim: 4 } "
+       "      data_filler { " + data_filler + " } "
+       "      data_filler { " + targets_filler + " } "
+       "    } "
+       "  } ";
+  }
+
+  // A solver of a net that gets the same data in every batch.
+  string ConstantDataProto() {
+    return SolverProto(DummyDataLayer("type: 'constant' value: 0.5",
+        "type: 'constant' value: 0.2"));
+  }
+
+  // A solver of a net that gets the batches last passed to SetMemoryData,
+  // in turn, with iter_size of them per iteration.
+  string MemoryDataProto(int iter_size) {
+    return SolverProto(
+       "  layer { "
+       "    name: 'data' type: 'MemoryData' top: 'data' top: 'targets' "
+       "    memory_data_param { "
+       "      batch_size: 4 channels: 6 height: 1 width: 1 "
+       "    } "
+       "  } ") + "iter_size: " + boost::lexical_cast<string>(iter_size) + " ";
+  }
+
+  // Appends the 'data' and 'targets' the data layer of net last gave to
+  // *data and *targets.
+  void AppendBatch(Net<Dtype>* net, vector<Dtype>* data,
+      vector<Dtype>* targets) {
+    const Blob<Dtype>& data_blob = *net->blob_by_name("data");
+    const Blob<Dtype>& targets_blob = *net->blob_by_name("targets");
+    data->insert(data->end(), data_blob.cpu_data(),
+        data_blob.cpu_data() + data_blob.count());
+    targets->insert(targets->end(), targets_blob.cpu_data(),
+        targets_blob.cpu_data() + targets_blob.count());
+  }
+
+  // Feeds data and targets, which must stay alive, to the MemoryData layer
+  // of the net of solver, and sets its weights to params.
+  void SetMemoryData(vector<Dtype>* data, vector<Dtype>* targets,
+      const vector<shared_ptr<Blob<Dtype> > >& params,
+      Solver<Dtype>* solver) {
+    MemoryDataLayer<Dtype>* layer = dynamic_cast<MemoryDataLayer<Dtype>*>(
+        solver->net()->layer_by_name("data").get());
+    CHECK(layer);
+    layer->Reset(&(*data)[0], &(*targets)[0], targets->size());
+    const vector<Blob<Dtype>*>& net_params = solver->net()->learnable_params();
+    CHECK_EQ(params.size(), net_params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      net_params[i]->CopyFrom(*params[i]);
+    }
+  }
+
+  vector<shared_ptr<Blob<Dtype> > > CopyParams(Solver<Dtype>* solver) {
+    vector<shared_ptr<Blob<Dtype> > > copies;
+    const vector<Blob<Dtype>*>& params = solver->net()->learnable_params();
+    for (int i = 0; i < params.size(); ++i) {
+      copies.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      copies.back()->CopyFrom(*params[i], false, true);
+    }
+    return copies;
+  }
+
+  void ExpectParamsNear(const vector<shared_ptr<Blob<Dtype> > >& expected,
+      Solver<Dtype>* solver) {
+    const vector<Blob<Dtype>*>& params = solver->net()->learnable_params();
+    ASSERT_EQ(expected.size(), params.size());
+    for (int i = 0; i < params.size(); ++i) {
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_NEAR(expected[i]->cpu_data()[j], params[i]->cpu_data()[j],
+            1e-5);
+      }
+    }
+  }
+
   shared_ptr<Solver<Dtype> > solver_;
 };
 
@@ -105,4 +230,204 @@ TYPED_TEST(SolverTest, TestInitTrainTestNets) {
   EXPECT_TRUE(this->solver_->test_nets()[1]->has_layer("accuracy"));
 }
 
+TYPED_TEST(SolverTest, TestReplicas) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  // Each replica draws batches of its own, and must update the weights just
+  // as one net with iter_size the number of nets, given all of them.
+  const int replicas = 3;
+  this->InitSolverFromProtoString(this->SolverProto(this->DummyDataLayer(
+      "type: 'gaussian'", "type: 'gaussian'")) + "replicas: " +
+      boost::lexical_cast<string>(replicas));
+  shared_ptr<Solver<Dtype> > solver = this->solver_;
+  ASSERT_EQ(replicas - 1, solver->replica_nets().size());
+  this->InitSolverFromProtoString(this->MemoryDataProto(replicas));
+  shared_ptr<Solver<Dtype> > expected_solver = this->solver_;
+  for (int iter = 0; iter < 3; ++iter) {
+    const vector<shared_ptr<Blob<Dtype> > > params = this->CopyParams(
+        solver.get());
+    solver->Step(1);
+    vector<Dtype> data;
+    vector<Dtype> targets;
+    this->AppendBatch(solver->net().get(), &data, &targets);
+    for (int r = 0; r < replicas - 1; ++r) {
+      this->AppendBatch(solver->replica_nets()[r].get(), &data, &targets);
+    }
+    this->SetMemoryData(&data, &targets, params, expected_solver.get());
+    expected_solver->Step(1);
+    this->ExpectParamsNear(this->CopyParams(expected_solver.get()),
+        solver.get());
+  }
+}
+
+TYPED_TEST(SolverTest, TestReplicaConvolutionThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  // Every net of the solver tunes its convolutions for its share of the
+  // threads, not for all of them.
+  const int replicas = 2;
+  OpenMPThreads threads(4);
+  const int share = std::max(1, openmp_max_threads() / replicas);
+  this->InitSolverFromProtoString(
+     "base_lr: 0.01 lr_policy: 'fixed' replicas: 2 "
+     "net_param { "
+     "  cpu_tuning: true "
+     "  layer { "
+     "    name: 'data' type: 'DummyData' top: 'data' top: 'targets' "
+     "    dummy_data_param { "
+     "      shape { dim: 2 dim: 3 dim: 6 dim: 6 } shape { dim: 2 dim: 1 } "
+     "      data_filler { type: 'gaussian' } "
+     "      data_filler { type: 'gaussian' } "
+     "    } "
+     "  } "
+     "  layer { "
+     "    name: 'conv' type: 'Convolution' bottom: 'data' top: 'conv' "
+     "    convolution_param { "
+     "      num_output: 4 kernel_size: 3 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "  } "
+     "  layer { "
+     "    name: 'ip' type: 'InnerProduct' bottom: 'conv' top: 'ip' "
+     "    inner_product_param { "
+     "      num_output: 1 "
+     "      weight_filler { type: 'gaussian' } "
+     "    } "
+     "  } "
+     "  layer { "
+     "    name: 'loss' type: 'EuclideanLoss' "
+     "    bottom: 'ip' bottom: 'targets' "
+     "  } "
+     "} ");
+  vector<shared_ptr<Net<Dtype> > > nets = this->solver_->replica_nets();
+  ASSERT_EQ(replicas - 1, nets.size());
+  nets.push_back(this->solver_->net());
+  for (int i = 0; i < nets.size(); ++i) {
+    const BaseConvolutionLayer<Dtype>* conv =
+        dynamic_cast<BaseConvolutionLayer<Dtype>*>(
+            nets[i]->layer_by_name("conv").get());
+    ASSERT_TRUE(conv);
+    EXPECT_GE(conv->cpu_variant().threads, 1);
+    EXPECT_LE(conv->cpu_variant().threads, share);
+  }
+}
+
+template <typename Dtype>
+void StepWithCommunicator(Solver<Dtype>* solver, const string& uri, int rank,
+    int size, int iters) {
+  solver->set_communicator(Communicator::Create(uri, rank, size));
+  solver->Step(iters);
+}
+
+TYPED_TEST(SolverTest, TestCommunicator) {
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  // Two ranks, on threads of their own, each with data of its own, sum the
+  // gradients of each layer while the layers below are still running
+  // backward. They must update the weights just as one net that gets the
+  // batches of both.
+  const int size = 2;
+  const int iter_size = 2;
+  const string uri = "shm://caffe-solver-test-" +
+      boost::lexical_cast<string>(getpid());
+  vector<shared_ptr<Solver<Dtype> > > ranks;
+  vector<Dtype> data;
+  vector<Dtype> targets;
+  for (int rank = 0; rank < size; ++rank) {
+    const Dtype data_value = 0.5 + 0.25 * rank;
+    const Dtype target_value = 0.2 - 0.3 * rank;
+    this->InitSolverFromProtoString(this->SolverProto(this->DummyDataLayer(
+        "type: 'constant' value: " +
+        boost::lexical_cast<string>(data_value),
+        "type: 'constant' value: " +
+        boost::lexical_cast<string>(target_value))) +
+        "iter_size: " + boost::lexical_cast<string>(iter_size));
+    ranks.push_back(this->solver_);
+    data.insert(data.end(), iter_size * 4 * 6, data_value);
+    targets.insert(targets.end(), iter_size * 4, target_value);
+  }
+  this->InitSolverFromProtoString(this->MemoryDataProto(size * iter_size));
+  this->SetMemoryData(&data, &targets, this->CopyParams(ranks[0].get()),
+      this->solver_.get());
+  this->solver_->Step(3);
+  const vector<shared_ptr<Blob<Dtype> > > expected =
+      this->CopyParams(this->solver_.get());
+  boost::thread_group threads;
+  for (int rank = 0; rank < size; ++rank) {
+    threads.create_thread(boost::bind(&StepWithCommunicator<Dtype>,
+        ranks[rank].get(), uri, rank, size, 3));
+  }
+  threads.join_all();
+  for (int rank = 0; rank < size; ++rank) {
+    this->ExpectParamsNear(expected, ranks[rank].get());
+  }
+}
+
+// A solver of its own updates, which leave the weights as they are
+template <typename Dtype>
+class FrozenSGDSolver : public SGDSolver<Dtype> {
+ public:
+  explicit FrozenSGDSolver(const SolverParameter& param)
+      : SGDSolver<Dtype>(param) {}
+
+ protected:
+  virtual void ComputeUpdateValue(int param_id, Dtype rate) {
+    Blob<Dtype>* param = this->net_->learnable_params()[param_id];
+    caffe_set(param->count(), Dtype(0), param->mutable_cpu_diff());
+  }
+};
+
+TYPED_TEST(SolverTest, TestDerivedSolverUnfused) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitSolverFromProtoString(this->ConstantDataProto());
+  const vector<shared_ptr<Blob<Dtype> > > expected =
+      this->CopyParams(this->solver_.get());
+  // fused_update is on by default, but the fused update does not know
+  // this solver's.
+  SolverParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      this->ConstantDataProto(), &param));
+  param.set_solver_mode(Caffe::mode() == Caffe::CPU ?
+      SolverParameter_SolverMode_CPU : SolverParameter_SolverMode_GPU);
+  FrozenSGDSolver<Dtype> solver(param);
+  solver.Step(3);
+  this->ExpectParamsNear(expected, &solver);
+}
+
+TYPED_TEST(SolverTest, TestAsyncSnapshot) {
+  typedef typename TypeParam::Dtype Dtype;
+  string snapshot_prefix;
+  MakeTempDir(&snapshot_prefix);
+  snapshot_prefix += "/";
+  // A snapshot every iteration, each staged while the last is written
+  const int kNumIters = 3;
+  this->InitSolverFromProtoString(this->ConstantDataProto() +
+      "max_iter: " + boost::lexical_cast<string>(kNumIters) + " "
+      "snapshot: 1 async_snapshot: true "
+      "snapshot_prefix: '" + snapshot_prefix + "' ");
+  this->solver_->Solve();
+  const vector<shared_ptr<Blob<Dtype> > > expected =
+      this->CopyParams(this->solver_.get());
+  // Solve returns once all are written, and renamed.
+  for (int iter = 1; iter <= kNumIters; ++iter) {
+    const string filename = snapshot_prefix + "_iter_" +
+        boost::lexical_cast<string>(iter);
+    EXPECT_EQ(0, access((filename + ".caffemodel").c_str(), F_OK));
+    EXPECT_EQ(0, access((filename + ".solverstate").c_str(), F_OK));
+    EXPECT_NE(0, access((filename + ".caffemodel.tmp").c_str(), F_OK));
+    EXPECT_NE(0, access((filename + ".solverstate.tmp").c_str(), F_OK));
+  }
+  this->InitSolverFromProtoString(this->ConstantDataProto());
+  this->solver_->Restore((snapshot_prefix + "_iter_" +
+      boost::lexical_cast<string>(kNumIters) + ".solverstate").c_str());
+  EXPECT_EQ(kNumIters, this->solver_->iter());
+  this->ExpectParamsNear(expected, this->solver_.get());
+}
+
 }  // namespace caffe
@@ -11,6 +11,7 @@
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_data_util.hpp"
 
 namespace caffe {
 
@@ -2890,7 +2891,6 @@ TEST_F(NetUpgradeTest, TestImageNet) {
 }  // NOLINT(readability/fn_size)
 
 TEST_F(NetUpgradeTest, TestUpgradeV1LayerType) {
-  LayerParameter layer_param;
   shared_ptr<Layer<float> > layer;
   for (int i = 0; i < V1LayerParameter_LayerType_LayerType_ARRAYSIZE; ++i) {
     ASSERT_TRUE(V1LayerParameter_LayerType_IsValid(i));
@@ -2900,6 +2900,11 @@ TEST_F(NetUpgradeTest, TestUpgradeV1LayerType) {
       EXPECT_EQ(V1LayerParameter_LayerType_NONE, v1_type);
       continue;  // Empty string isn't actually a valid layer type.
     }
+    LayerParameter layer_param;
+    // Data layers start reading their database as they are created
+    if (v2_layer_type == "Data") {
+      SetUpSingleRecordSource(layer_param.mutable_data_param());
+    }
     layer_param.set_type(v2_layer_type);
     layer = LayerRegistry<float>::CreateLayer(layer_param);
     EXPECT_EQ(v2_layer_type, layer->type());
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/calibrate_quantization.hpp"
+
+namespace caffe {
+
+void CalibrateQuantization(const string& weights_file, int iterations,
+    const std::set<string>& exclude, NetParameter* param) {
+  // Calibrate in floating point. The inputs are read once the whole net has
+  // run, so no blob may give its memory to a later one or be dropped.
+  NetParameter float_param(*param);
+  for (int i = 0; i < float_param.layer_size(); ++i) {
+    float_param.mutable_layer(i)->clear_quantization_param();
+  }
+  float_param.clear_reuse_blob_memory();
+  float_param.clear_keep_blob();
+  float_param.clear_recompute_layer();
+  float_param.mutable_state()->set_phase(TEST);
+  Net<float> net(float_param);
+  if (!weights_file.empty()) {
+    net.CopyTrainedLayersFrom(weights_file);
+  }
+
+  std::map<string, float> input_max;
+  for (int iter = 0; iter < iterations; ++iter) {
+    net.ForwardPrefilled();
+    for (int i = 0; i < net.layers().size(); ++i) {
+      const string& type = net.layers()[i]->type();
+      if ((type != string("Convolution") && type != string("InnerProduct")) ||
+          exclude.count(net.layer_names()[i])) {
+        continue;
+      }
+      float& layer_max = input_max[net.layer_names()[i]];
+      const vector<Blob<float>*>& bottom = net.bottom_vecs()[i];
+      for (int j = 0; j < bottom.size(); ++j) {
+        const float* data = bottom[j]->cpu_data();
+        for (int k = 0; k < bottom[j]->count(); ++k) {
+          layer_max = std::max(layer_max, std::fabs(data[k]));
+        }
+      }
+    }
+    if ((iter + 1) % 10 == 0) {
+      LOG(INFO) << "Calibrated on " << iter + 1 << " batches.";
+    }
+  }
+
+  for (int i = 0; i < param->layer_size(); ++i) {
+    LayerParameter* layer = param->mutable_layer(i);
+    std::map<string, float>::const_iterator it =
+        input_max.find(layer->name());
+    if (it == input_max.end()) {
+      continue;
+    }
+    if (it->second > 0) {
+      layer->mutable_quantization_param()->set_input_max(it->second);
+    } else {
+      layer->clear_quantization_param();
+    }
+  }
+}
+
+}  // namespace caffe
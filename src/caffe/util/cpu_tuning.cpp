@@ -0,0 +1,174 @@
+#include <stdio.h>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/cpu_tuning.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/openmp.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+// Timed iterations per variant, after one to warm up
+const int kTuningIterations = 3;
+
+typedef map<string, ConvolutionCPUVariant> TuningCache;
+
+string CPUModelName() {
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (std::getline(cpuinfo, line)) {
+    if (line.compare(0, 10, "model name") == 0) {
+      const size_t begin = line.find_first_not_of(" \t:", 10);
+      if (begin != string::npos) {
+        return line.substr(begin);
+      }
+    }
+  }
+  return "unknown CPU";
+}
+
+// One variant per line: algorithm batch threads key
+static void ReadTuningCache(const string& filename, TuningCache* cache) {
+  std::ifstream file(filename.c_str());
+  string line;
+  while (std::getline(file, line)) {
+    std::istringstream iss(line);
+    ConvolutionCPUVariant variant;
+    string key;
+    if (iss >> variant.algorithm >> variant.batch >> variant.threads
+        && std::getline(iss >> std::ws, key)) {
+      (*cache)[key] = variant;
+    }
+  }
+}
+
+static void WriteTuningCache(const string& filename,
+    const TuningCache& cache) {
+  // Replace the file atomically, as other processes may be reading it
+  const string temp = filename + ".tmp";
+  std::ofstream file(temp.c_str());
+  CHECK(file) << "Failed to open " << temp;
+  for (TuningCache::const_iterator it = cache.begin(); it != cache.end();
+       ++it) {
+    file << it->second.algorithm << ' ' << it->second.batch << ' '
+        << it->second.threads << ' ' << it->first << '\n';
+  }
+  file.close();
+  CHECK(file) << "Failed to write " << temp;
+  CHECK_EQ(rename(temp.c_str(), filename.c_str()), 0)
+      << "Failed to write " << filename;
+}
+
+template <typename Dtype>
+static string TuningKey(const string& cpu, const Layer<Dtype>& layer,
+    const vector<Blob<Dtype>*>& bottom, bool backward) {
+  ConvolutionParameter param = layer.layer_param().convolution_param();
+  param.clear_weight_filler();
+  param.clear_bias_filler();
+  std::ostringstream key;
+  key << cpu << " | " << layer.type() << " "
+      << (sizeof(Dtype) == sizeof(float) ? "float" : "double") << " "
+      << bottom.size() << " x " << bottom[0]->shape_string() << " { "
+      << param.ShortDebugString() << " }" << (backward ? " backward" : "");
+  return key.str();
+}
+
+template <typename Dtype>
+static float TimeVariant(BaseConvolutionLayer<Dtype>* layer,
+    const ConvolutionCPUVariant& variant, const vector<Blob<Dtype>*>& bottom,
+    const vector<Blob<Dtype>*>& top, bool backward,
+    const vector<bool>& propagate_down) {
+  layer->set_cpu_variant(variant);
+  CPUTimer timer;
+  float time = 0;
+  for (int i = 0; i <= kTuningIterations; ++i) {
+    timer.Start();
+    layer->Forward(bottom, top);
+    if (backward) {
+      layer->Backward(top, propagate_down, bottom);
+    }
+    timer.Stop();
+    if (i > 0) {
+      time += timer.MicroSeconds();
+    }
+  }
+  return time / kTuningIterations;
+}
+
+template <typename Dtype>
+void TuneCPUConvolutions(Net<Dtype>* net, const string& cache_file) {
+  TuningCache cache;
+  if (!cache_file.empty()) {
+    ReadTuningCache(cache_file, &cache);
+  }
+  std::ostringstream cpu;
+  cpu << CPUModelName() << ", " << openmp_max_threads() << " threads";
+  bool updated = false;
+  for (int i = 0; i < net->layers().size(); ++i) {
+    BaseConvolutionLayer<Dtype>* layer =
+        dynamic_cast<BaseConvolutionLayer<Dtype>*>(net->layers()[i].get());
+    // Quantized layers have a single way of running.
+    if (!layer || layer->quantized()) {
+      continue;
+    }
+    const string& name = net->layer_names()[i];
+    const vector<Blob<Dtype>*>& bottom = net->bottom_vecs()[i];
+    const vector<Blob<Dtype>*>& top = net->top_vecs()[i];
+    const bool backward = net->layer_need_backward()[i];
+    const string key = TuningKey(cpu.str(), *layer, bottom, backward);
+    TuningCache::const_iterator cached = cache.find(key);
+    if (cached != cache.end()) {
+      layer->set_cpu_variant(cached->second);
+      layer->Reshape(bottom, top);
+      LOG(INFO) << "Layer " << name << " runs with algorithm "
+          << cached->second.algorithm << ", " << cached->second.batch
+          << " images at once on " << cached->second.threads
+          << " threads (cached)";
+      continue;
+    }
+    const vector<ConvolutionCPUVariant> variants = layer->cpu_variants();
+    int best = 0;
+    float best_time = 0;
+    for (int j = 0; j < variants.size(); ++j) {
+      const float time = TimeVariant(layer, variants[j], bottom, top,
+          backward, net->bottom_need_backward()[i]);
+      DLOG(INFO) << "Layer " << name << " variant (" << variants[j].algorithm
+          << ", " << variants[j].batch << ", " << variants[j].threads
+          << "): " << time / 1000 << " ms";
+      if (j == 0 || time < best_time) {
+        best = j;
+        best_time = time;
+      }
+    }
+    layer->set_cpu_variant(variants[best]);
+    layer->Reshape(bottom, top);
+    // Drop the parameter gradients accumulated while timing
+    for (int j = 0; j < layer->blobs().size(); ++j) {
+      Blob<Dtype>* blob = layer->blobs()[j].get();
+      caffe_set(blob->count(), static_cast<Dtype>(0),
+          blob->mutable_cpu_diff());
+    }
+    LOG(INFO) << "Layer " << name << " runs with algorithm "
+        << variants[best].algorithm << ", " << variants[best].batch
+        << " images at once on " << variants[best].threads << " threads ("
+        << best_time / 1000 << " ms)";
+    cache[key] = variants[best];
+    updated = true;
+  }
+  if (updated && !cache_file.empty()) {
+    WriteTuningCache(cache_file, cache);
+  }
+}
+
+template void TuneCPUConvolutions<float>(Net<float>* net,
+    const string& cache_file);
+template void TuneCPUConvolutions<double>(Net<double>* net,
+    const string& cache_file);
+
+}  // namespace caffe
@@ -0,0 +1,54 @@
+#include <vector>
+
+#include "caffe/util/csr_matrix.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+bool CSRMatrix<Dtype>::Update(const Blob<Dtype>& blob, int rows,
+    float threshold) {
+  const shared_ptr<SyncedMemory>& data = blob.data();
+  if (source_.lock() == data && version_ == data->version() &&
+      threshold_ == threshold && rows_ == rows) {
+    return sparse_;
+  }
+  CHECK_GT(rows, 0);
+  CHECK_EQ(blob.count() % rows, 0);
+  source_ = data;
+  version_ = data->version();
+  threshold_ = threshold;
+  rows_ = rows;
+  cols_ = blob.count() / rows;
+  const Dtype* x = blob.cpu_data();
+  int nnz = 0;
+  for (int i = 0; i < blob.count(); ++i) {
+    nnz += x[i] != 0;
+  }
+  sparse_ = blob.count() - nnz >= threshold * blob.count();
+  // Free whatever an earlier version kept
+  vector<int>().swap(row_ptr_);
+  vector<int>().swap(col_);
+  vector<Dtype>().swap(val_);
+  if (!sparse_) {
+    return false;
+  }
+  row_ptr_.reserve(rows_ + 1);
+  col_.reserve(nnz);
+  val_.reserve(nnz);
+  for (int i = 0; i < rows_; ++i) {
+    row_ptr_.push_back(col_.size());
+    const Dtype* row = x + i * cols_;
+    for (int j = 0; j < cols_; ++j) {
+      if (row[j] != 0) {
+        col_.push_back(j);
+        val_.push_back(row[j]);
+      }
+    }
+  }
+  row_ptr_.push_back(col_.size());
+  return true;
+}
+
+INSTANTIATE_CLASS(CSRMatrix);
+
+}  // namespace caffe
@@ -1,6 +1,7 @@
 #include "caffe/util/db.hpp"
 #include "caffe/util/db_leveldb.hpp"
 #include "caffe/util/db_lmdb.hpp"
+#include "caffe/util/db_packed.hpp"
 
 #include <string>
 
@@ -12,6 +13,8 @@ DB* GetDB(DataParameter::DB backend) {
     return new LevelDB();
   case DataParameter_DB_LMDB:
     return new LMDB();
+  case DataParameter_DB_PACKED:
+    return new Packed();
   default:
     LOG(FATAL) << "Unknown database backend";
   }
@@ -22,6 +25,8 @@ DB* GetDB(const string& backend) {
     return new LevelDB();
   } else if (backend == "lmdb") {
     return new LMDB();
+  } else if (backend == "packed") {
+    return new Packed();
   } else {
     LOG(FATAL) << "Unknown database backend";
   }
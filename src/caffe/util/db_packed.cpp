@@ -0,0 +1,297 @@
+#include "caffe/util/db_packed.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace caffe { namespace db {
+
+static const char kPackedMagic[8] = {'C', 'A', 'F', 'F', 'E', 'P', 'K', 'D'};
+static const uint32_t kPackedVersion = 1;
+
+static void CheckHeader(const PackedHeader& header, const string& source) {
+  CHECK_EQ(memcmp(header.magic, kPackedMagic, sizeof(kPackedMagic)), 0)
+      << source << " is not a packed database";
+  CHECK_EQ(header.version, kPackedVersion)
+      << "Unsupported packed database version in " << source;
+}
+
+static void PWrite(int fd, const void* data, size_t size, off_t offset) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    const ssize_t written = pwrite(fd, p, size, offset);
+    CHECK_GT(written, 0) << "Failed to write packed database: "
+        << strerror(errno);
+    p += written;
+    size -= written;
+    offset += written;
+  }
+}
+
+static void PRead(int fd, void* data, size_t size, off_t offset) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    const ssize_t read = pread(fd, p, size, offset);
+    CHECK_GT(read, 0) << "Failed to read packed database: "
+        << strerror(errno);
+    p += read;
+    size -= read;
+    offset += read;
+  }
+}
+
+void Packed::Open(const string& source, Mode mode) {
+  source_ = source;
+  header_ = PackedHeader();
+  if (mode == READ) {
+    fd_ = open(source.c_str(), O_RDONLY);
+    CHECK_NE(fd_, -1) << "Failed to open packed database " << source;
+    struct stat st;
+    CHECK_EQ(fstat(fd_, &st), 0) << "Failed to stat " << source;
+    map_size_ = st.st_size;
+    CHECK_GE(map_size_, kPackedHeaderSize) << source
+        << " is not a packed database";
+    void* map = mmap(NULL, map_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    CHECK(map != MAP_FAILED) << "Failed to map " << source << ": "
+        << strerror(errno);
+    map_ = static_cast<char*>(map);
+    memcpy(&header_, map_, sizeof(header_));  // NOLINT(caffe/alt_fn)
+    CheckHeader(header_, source);
+    CHECK_LE(header_.index_offset + (header_.num_records + 1) *
+        sizeof(uint64_t), map_size_) << "Truncated packed database " << source;
+    LOG(INFO) << "Opened packed database " << source;
+    return;
+  }
+  int flags = O_RDWR | O_CREAT;
+  if (mode == NEW) {
+    flags |= O_EXCL;
+  }
+  fd_ = open(source.c_str(), flags, 0664);
+  CHECK_NE(fd_, -1) << "Failed to open packed database " << source << ": "
+      << strerror(errno);
+  struct stat st;
+  CHECK_EQ(fstat(fd_, &st), 0) << "Failed to stat " << source;
+  if (st.st_size == 0) {
+    std::copy(kPackedMagic, kPackedMagic + sizeof(kPackedMagic),
+        header_.magic);
+    header_.version = kPackedVersion;
+    header_.index_offset = kPackedHeaderSize;
+    WriteHeaderAndIndex();
+  } else {
+    // Load the keys to append after them
+    PRead(fd_, &header_, sizeof(header_), 0);
+    CheckHeader(header_, source);
+    const size_t index_size = st.st_size - header_.index_offset;
+    vector<char> index(index_size);
+    PRead(fd_, &index[0], index_size, header_.index_offset);
+    const uint64_t* offsets = reinterpret_cast<const uint64_t*>(&index[0]);
+    const char* keys = &index[0] + (header_.num_records + 1) * sizeof(uint64_t);
+    for (uint64_t i = 0; i < header_.num_records; ++i) {
+      keys_.push_back(string(keys + offsets[i], offsets[i + 1] - offsets[i]));
+    }
+  }
+  LOG(INFO) << "Opened packed database " << source;
+}
+
+void Packed::Close() {
+  if (map_ != NULL) {
+    munmap(map_, map_size_);
+    map_ = NULL;
+  }
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+  keys_.clear();
+}
+
+PackedCursor* Packed::NewCursor() {
+  CHECK(map_) << "Packed databases must be opened in READ mode to be read";
+  return new PackedCursor(this);
+}
+
+void Packed::key(uint64_t i, const char** data, size_t* size) const {
+  const char* index = map_ + header_.index_offset;
+  const uint64_t* offsets = reinterpret_cast<const uint64_t*>(index);
+  *data = index + (header_.num_records + 1) * sizeof(uint64_t) + offsets[i];
+  *size = offsets[i + 1] - offsets[i];
+}
+
+uint64_t Packed::LowerBound(const string& key) const {
+  uint64_t first = 0;
+  uint64_t count = header_.num_records;
+  while (count > 0) {
+    const uint64_t step = count / 2;
+    const char* data;
+    size_t size;
+    this->key(first + step, &data, &size);
+    if (key.compare(0, string::npos, data, size) > 0) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+void Packed::PackRecord(const Datum& datum, string* records) {
+  CHECK(!datum.encoded()) << "Packed databases hold decoded records only";
+  const bool is_uint8 = datum.data().size() > 0;
+  const int size = datum.channels() * datum.height() * datum.width();
+  if (header_.record_size == 0) {
+    // The first record defines the shape of all of them
+    header_.type = is_uint8 ? PACKED_UINT8 : PACKED_FLOAT;
+    header_.channels = datum.channels();
+    header_.height = datum.height();
+    header_.width = datum.width();
+    const size_t payload = size * (is_uint8 ? sizeof(uint8_t) : sizeof(float));
+    // Keep labels, float payloads and the index that follows them aligned
+    header_.record_size = (sizeof(int32_t) + payload + 7) / 8 * 8;
+  }
+  CHECK_EQ(header_.type, is_uint8 ? PACKED_UINT8 : PACKED_FLOAT)
+      << "Packed records must all hold either uint8 or float data";
+  CHECK(datum.channels() == header_.channels &&
+        datum.height() == header_.height && datum.width() == header_.width)
+      << "Packed records must all have the same shape";
+  const size_t begin = records->size();
+  records->resize(begin + header_.record_size, 0);
+  char* record = &(*records)[begin];
+  const int32_t label = datum.label();
+  memcpy(record, &label, sizeof(label));  // NOLINT(caffe/alt_fn)
+  if (is_uint8) {
+    CHECK_EQ(datum.data().size(), size) << "Incorrect data field size";
+    std::copy(datum.data().begin(), datum.data().end(),
+        record + sizeof(label));
+  } else {
+    CHECK_EQ(datum.float_data_size(), size) << "Incorrect data field size";
+    const char* data = reinterpret_cast<const char*>(
+        datum.float_data().data());
+    std::copy(data, data + size * sizeof(float), record + sizeof(label));
+  }
+}
+
+const string& Packed::last_key() const {
+  static const string empty;
+  return keys_.empty() ? empty : keys_.back();
+}
+
+void Packed::Append(const vector<string>& keys, const string& records) {
+  CHECK_NE(fd_, -1) << "Packed database is not open";
+  CHECK(map_ == NULL) << "Packed database opened in READ mode";
+  // Records overwrite the index, which is rewritten after them
+  PWrite(fd_, records.data(), records.size(), kPackedHeaderSize +
+      header_.num_records * header_.record_size);
+  keys_.insert(keys_.end(), keys.begin(), keys.end());
+  header_.num_records = keys_.size();
+  header_.index_offset = kPackedHeaderSize +
+      header_.num_records * header_.record_size;
+  WriteHeaderAndIndex();
+}
+
+void Packed::WriteHeaderAndIndex() {
+  vector<uint64_t> offsets(keys_.size() + 1, 0);
+  string keys;
+  for (int i = 0; i < keys_.size(); ++i) {
+    keys += keys_[i];
+    offsets[i + 1] = keys.size();
+  }
+  off_t offset = header_.index_offset;
+  PWrite(fd_, &offsets[0], offsets.size() * sizeof(uint64_t), offset);
+  offset += offsets.size() * sizeof(uint64_t);
+  PWrite(fd_, keys.data(), keys.size(), offset);
+  CHECK_EQ(ftruncate(fd_, offset + keys.size()), 0)
+      << "Failed to truncate " << source_;
+  char header[kPackedHeaderSize] = {0};
+  memcpy(header, &header_, sizeof(header_));  // NOLINT(caffe/alt_fn)
+  PWrite(fd_, header, kPackedHeaderSize, 0);
+}
+
+void PackedTransaction::Put(const string& key, const string& value) {
+  const string& last = keys_.empty() ? db_->last_key() : keys_.back();
+  CHECK(last.empty() || key > last)
+      << "Packed databases need keys in increasing order, got " << key
+      << " after " << last;
+  Datum datum;
+  CHECK(datum.ParseFromString(value)) << "Packed values must be Datums";
+  db_->PackRecord(datum, &records_);
+  keys_.push_back(key);
+}
+
+void PackedTransaction::Commit() {
+  db_->Append(keys_, records_);
+  keys_.clear();
+  records_.clear();
+}
+
+void PackedCursor::Seek(const string& key) {
+  index_ = db_->LowerBound(key);
+}
+
+string PackedCursor::key() {
+  const char* data;
+  size_t size;
+  db_->key(index_, &data, &size);
+  return string(data, size);
+}
+
+string PackedCursor::value() {
+  SerializeValue();
+  return value_;
+}
+
+const void* PackedCursor::value_data() {
+  SerializeValue();
+  return value_.data();
+}
+
+size_t PackedCursor::value_size() {
+  SerializeValue();
+  return value_.size();
+}
+
+bool PackedCursor::valid() {
+  return index_ < db_->header().num_records;
+}
+
+void PackedCursor::ReadDatum(Datum* datum) {
+  const PackedHeader& header = db_->header();
+  const char* record = db_->record(index_);
+  int32_t label;
+  memcpy(&label, record, sizeof(label));  // NOLINT(caffe/alt_fn)
+  datum->set_channels(header.channels);
+  datum->set_height(header.height);
+  datum->set_width(header.width);
+  datum->set_label(label);
+  datum->set_encoded(false);
+  const int size = header.channels * header.height * header.width;
+  if (header.type == PACKED_UINT8) {
+    datum->clear_float_data();
+    datum->set_data(record + sizeof(label), size);
+  } else {
+    datum->clear_data();
+    google::protobuf::RepeatedField<float>* data = datum->mutable_float_data();
+    data->Resize(size, 0);
+    std::copy(record + sizeof(label), record + sizeof(label) +
+        size * sizeof(float), reinterpret_cast<char*>(data->mutable_data()));
+  }
+}
+
+void PackedCursor::SerializeValue() {
+  if (value_index_ != index_) {
+    Datum datum;
+    ReadDatum(&datum);
+    CHECK(datum.SerializeToString(&value_));
+    value_index_ = index_;
+  }
+}
+
+}  // namespace db
+}  // namespace caffe
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/factorize.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+void OrthonormalizeRows(int rows, int cols, float* A) {
+  for (int i = 0; i < rows; ++i) {
+    float* a = A + i * cols;
+    const float norm = std::sqrt(caffe_cpu_dot(cols, a, a));
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int j = 0; j < i; ++j) {
+        const float* b = A + j * cols;
+        caffe_axpy(cols, -caffe_cpu_dot(cols, a, b), b, a);
+      }
+    }
+    const float residual = std::sqrt(caffe_cpu_dot(cols, a, a));
+    caffe_scal(cols, residual > 1e-4f * norm ? 1 / residual : 0.f, a);
+  }
+}
+
+namespace {
+
+// Column-major access to a row-major n x n matrix, so that the loops below
+// over the rows of a column run over contiguous memory
+class Transposed {
+ public:
+  Transposed(int n, double* data) : n_(n), data_(data) {}
+  double& operator()(int row, int col) { return data_[col * n_ + row]; }
+
+ private:
+  int n_;
+  double* data_;
+};
+
+}  // namespace
+
+void SymmetricEigen(int n, vector<double>* A, vector<double>* d_vec) {
+  Transposed V(n, &(*A)[0]);
+  d_vec->resize(n);
+  double* d = &(*d_vec)[0];
+  vector<double> e_vec(n);
+  double* e = &e_vec[0];
+  // Householder reduction, accumulating the transformations in V
+  for (int j = 0; j < n; ++j) {
+    d[j] = V(n - 1, j);
+  }
+  for (int i = n - 1; i > 0; --i) {
+    double scale = 0, h = 0;
+    for (int k = 0; k < i; ++k) {
+      scale += std::fabs(d[k]);
+    }
+    if (scale == 0) {
+      e[i] = d[i - 1];
+      for (int j = 0; j < i; ++j) {
+        d[j] = V(i - 1, j);
+        V(i, j) = 0;
+        V(j, i) = 0;
+      }
+    } else {
+      for (int k = 0; k < i; ++k) {
+        d[k] /= scale;
+        h += d[k] * d[k];
+      }
+      double f = d[i - 1];
+      double g = f > 0 ? -std::sqrt(h) : std::sqrt(h);
+      e[i] = scale * g;
+      h -= f * g;
+      d[i - 1] = f - g;
+      for (int j = 0; j < i; ++j) {
+        e[j] = 0;
+      }
+      for (int j = 0; j < i; ++j) {
+        f = d[j];
+        V(j, i) = f;
+        g = e[j] + V(j, j) * f;
+        for (int k = j + 1; k < i; ++k) {
+          g += V(k, j) * d[k];
+          e[k] += V(k, j) * f;
+        }
+        e[j] = g;
+      }
+      f = 0;
+      for (int j = 0; j < i; ++j) {
+        e[j] /= h;
+        f += e[j] * d[j];
+      }
+      const double hh = f / (h + h);
+      for (int j = 0; j < i; ++j) {
+        e[j] -= hh * d[j];
+      }
+      for (int j = 0; j < i; ++j) {
+        f = d[j];
+        g = e[j];
+        for (int k = j; k < i; ++k) {
+          V(k, j) -= f * e[k] + g * d[k];
+        }
+        d[j] = V(i - 1, j);
+        V(i, j) = 0;
+      }
+    }
+    d[i] = h;
+  }
+  for (int i = 0; i < n - 1; ++i) {
+    V(n - 1, i) = V(i, i);
+    V(i, i) = 1;
+    const double h = d[i + 1];
+    if (h != 0) {
+      for (int k = 0; k <= i; ++k) {
+        d[k] = V(k, i + 1) / h;
+      }
+      for (int j = 0; j <= i; ++j) {
+        double g = 0;
+        for (int k = 0; k <= i; ++k) {
+          g += V(k, i + 1) * V(k, j);
+        }
+        for (int k = 0; k <= i; ++k) {
+          V(k, j) -= g * d[k];
+        }
+      }
+    }
+    for (int k = 0; k <= i; ++k) {
+      V(k, i + 1) = 0;
+    }
+  }
+  for (int j = 0; j < n; ++j) {
+    d[j] = V(n - 1, j);
+    V(n - 1, j) = 0;
+  }
+  V(n - 1, n - 1) = 1;
+  // QL iterations on the tridiagonal matrix, with diagonal d and
+  // subdiagonal e
+  for (int i = 1; i < n; ++i) {
+    e[i - 1] = e[i];
+  }
+  e[n - 1] = 0;
+  const double eps = std::numeric_limits<double>::epsilon();
+  double f = 0, tst1 = 0;
+  for (int l = 0; l < n; ++l) {
+    tst1 = std::max(tst1, std::fabs(d[l]) + std::fabs(e[l]));
+    int m = l;
+    while (std::fabs(e[m]) > eps * tst1) {
+      ++m;
+    }
+    if (m > l) {
+      do {
+        double g = d[l];
+        double p = (d[l + 1] - g) / (2 * e[l]);
+        double r = p < 0 ? -hypot(p, 1.) : hypot(p, 1.);
+        d[l] = e[l] / (p + r);
+        d[l + 1] = e[l] * (p + r);
+        const double dl1 = d[l + 1];
+        double h = g - d[l];
+        for (int i = l + 2; i < n; ++i) {
+          d[i] -= h;
+        }
+        f += h;
+        p = d[m];
+        double c = 1, c2 = 1, c3 = 1, s = 0, s2 = 0;
+        const double el1 = e[l + 1];
+        for (int i = m - 1; i >= l; --i) {
+          c3 = c2;
+          c2 = c;
+          s2 = s;
+          g = c * e[i];
+          h = c * p;
+          r = hypot(p, e[i]);
+          e[i + 1] = s * r;
+          s = e[i] / r;
+          c = p / r;
+          p = c * d[i] - s * g;
+          d[i + 1] = h + s * (c * g + s * d[i]);
+          for (int k = 0; k < n; ++k) {
+            h = V(k, i + 1);
+            V(k, i + 1) = s * V(k, i) + c * h;
+            V(k, i) = c * V(k, i) - s * h;
+          }
+        }
+        p = -s * s2 * c3 * el1 * e[l] / dl1;
+        e[l] = s * p;
+        d[l] = c * p;
+      } while (std::fabs(e[l]) > eps * tst1);
+    }
+    d[l] += f;
+    e[l] = 0;
+  }
+}
+
+double Factorize(int N, int K, int rank, int oversampling,
+    int power_iterations, const float* W, float* U, float* L) {
+  CHECK_GT(rank, 0);
+  CHECK_LE(rank, std::min(N, K)) << "The rank is at most " << std::min(N, K);
+  const int l = std::min(std::min(N, K), rank + oversampling);
+  vector<float> Qt(l * N), Zt(l * K);
+  caffe_rng_gaussian<float>(l * K, 0, 1, &Zt[0]);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, l, N, K, 1., &Zt[0], W, 0.,
+      &Qt[0]);
+  OrthonormalizeRows(l, N, &Qt[0]);
+  for (int i = 0; i < power_iterations; ++i) {
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, K, N, 1., &Qt[0], W,
+        0., &Zt[0]);
+    OrthonormalizeRows(l, K, &Zt[0]);
+    caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, l, N, K, 1., &Zt[0], W,
+        0., &Qt[0]);
+    OrthonormalizeRows(l, N, &Qt[0]);
+  }
+  // B = Q^T W, and B B^T = E S^2 E^T gives the SVD W ~ (Q E) S V^T with
+  // S V^T = E^T B.
+  vector<float>& B = Zt;
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, l, K, N, 1., &Qt[0], W,
+      0., &B[0]);
+  vector<float> BBt(l * l);
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasTrans, l, l, K, 1., &B[0], &B[0],
+      0., &BBt[0]);
+  vector<double> E(BBt.begin(), BBt.end()), S2;
+  SymmetricEigen(l, &E, &S2);
+  vector<pair<double, int> > order(l);
+  for (int i = 0; i < l; ++i) {
+    order[i] = std::make_pair(-S2[i], i);
+  }
+  std::sort(order.begin(), order.end());
+  // The top eigenvectors as rows
+  vector<float> Et(rank * l);
+  double kept = 0;
+  for (int r = 0; r < rank; ++r) {
+    for (int j = 0; j < l; ++j) {
+      Et[r * l + j] = E[order[r].second * l + j];
+    }
+    kept -= order[r].first;
+  }
+  caffe_cpu_gemm<float>(CblasNoTrans, CblasNoTrans, rank, K, l, 1., &Et[0],
+      &B[0], 0., L);
+  caffe_cpu_gemm<float>(CblasTrans, CblasTrans, N, rank, l, 1., &Qt[0],
+      &Et[0], 0., U);
+  double total = 0;
+  for (int i = 0; i < N * K; ++i) {
+    total += static_cast<double>(W[i]) * W[i];
+  }
+  return total > 0 ? kept / total : 1;
+}
+
+}  // namespace caffe
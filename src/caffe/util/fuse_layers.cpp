@@ -0,0 +1,155 @@
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/fuse_layers.hpp"
+
+namespace caffe {
+
+// Whether a layer from first on reads blob_name
+static bool ReadFrom(const vector<LayerParameter>& layers, int first,
+    const string& blob_name) {
+  for (int i = first; i < layers.size(); ++i) {
+    for (int j = 0; j < layers[i].bottom_size(); ++j) {
+      if (layers[i].bottom(j) == blob_name) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Whether a layer from first on writes blob_name, and with in_place_only,
+// whether one does so other than in place
+static bool WrittenFrom(const vector<LayerParameter>& layers, int first,
+    const string& blob_name, bool in_place_only) {
+  for (int i = first; i < layers.size(); ++i) {
+    for (int j = 0; j < layers[i].top_size(); ++j) {
+      if (layers[i].top(j) == blob_name && (!in_place_only ||
+          j >= layers[i].bottom_size() || layers[i].bottom(j) != blob_name)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// The first layer from first on that reads or writes blob_name
+static int NextUse(const vector<LayerParameter>& layers, int first,
+    const string& blob_name) {
+  for (int i = first; i < layers.size(); ++i) {
+    const LayerParameter& layer = layers[i];
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      if (layer.bottom(j) == blob_name) {
+        return i;
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      if (layer.top(j) == blob_name) {
+        return i;
+      }
+    }
+  }
+  return layers.size();
+}
+
+static void RenameFrom(vector<LayerParameter>* layers, int first,
+    const string& blob_name, const string& new_name) {
+  for (int i = first; i < layers->size(); ++i) {
+    LayerParameter& layer = (*layers)[i];
+    for (int j = 0; j < layer.bottom_size(); ++j) {
+      if (layer.bottom(j) == blob_name) {
+        layer.set_bottom(j, new_name);
+      }
+    }
+    for (int j = 0; j < layer.top_size(); ++j) {
+      if (layer.top(j) == blob_name) {
+        layer.set_top(j, new_name);
+      }
+    }
+  }
+}
+
+void FuseLayers(const NetParameter& param, NetParameter* param_fused) {
+  vector<LayerParameter> layers(param.layer().begin(), param.layer().end());
+  // Dropout passes its bottom through outside of training. Its top is
+  // renamed to its bottom, which only it reads with splits inserted, as
+  // long as no later layer writes the top other than in place.
+  for (int i = 0; i < layers.size(); ) {
+    const LayerParameter& layer = layers[i];
+    if (layer.type() == "Dropout" && layer.loss_weight_size() == 0) {
+      const string bottom = layer.bottom(0);
+      const string top = layer.top(0);
+      if (top == bottom || (ReadFrom(layers, i + 1, top) &&
+          !WrittenFrom(layers, i + 1, top, true) &&
+          !ReadFrom(layers, i + 1, bottom) &&
+          !WrittenFrom(layers, i + 1, bottom, false))) {
+        LOG(INFO) << "Removing Dropout layer " << layer.name();
+        RenameFrom(&layers, i + 1, top, bottom);
+        layers.erase(layers.begin() + i);
+        continue;
+      }
+    }
+    ++i;
+  }
+  // Split tops share the data of the bottom, so when only read, the
+  // consumers may as well read the bottom.
+  for (int i = 0; i < layers.size(); ) {
+    const LayerParameter& layer = layers[i];
+    if (layer.type() == "Split" && layer.loss_weight_size() == 0) {
+      bool read_only = !WrittenFrom(layers, i + 1, layer.bottom(0), false);
+      for (int j = 0; j < layer.top_size(); ++j) {
+        read_only &= ReadFrom(layers, i + 1, layer.top(j)) &&
+            !WrittenFrom(layers, i + 1, layer.top(j), false);
+      }
+      if (read_only) {
+        LOG(INFO) << "Removing Split layer " << layer.name();
+        for (int j = 0; j < layer.top_size(); ++j) {
+          RenameFrom(&layers, i + 1, layer.top(j), layer.bottom(0));
+        }
+        layers.erase(layers.begin() + i);
+        continue;
+      }
+    }
+    ++i;
+  }
+  // A ReLU that is the next layer to use the top of a Convolution or
+  // InnerProduct layer is applied by that layer along with its bias.
+  for (int i = 0; i + 1 < layers.size(); ++i) {
+    LayerParameter& layer = layers[i];
+    if ((layer.type() != "Convolution" && layer.type() != "InnerProduct") ||
+        layer.bottom_size() != 1 || layer.top_size() != 1 ||
+        layer.loss_weight_size() > 0 || layer.has_relu_param()) {
+      continue;
+    }
+    const string top = layer.top(0);
+    const int next = NextUse(layers, i + 1, top);
+    if (next == layers.size()) {
+      continue;
+    }
+    const LayerParameter& relu = layers[next];
+    if (relu.type() != "ReLU" || relu.loss_weight_size() > 0 ||
+        relu.bottom(0) != top) {
+      continue;
+    }
+    // Out of place, the ReLU top replaces the one it was the only user of
+    if (relu.top(0) != top) {
+      if (NextUse(layers, next + 1, top) < layers.size() ||
+          NextUse(layers, i + 1, relu.top(0)) < next) {
+        continue;
+      }
+      layer.set_top(0, relu.top(0));
+    }
+    LOG(INFO) << "Fusing ReLU layer " << relu.name() << " into "
+        << layer.name();
+    layer.mutable_relu_param()->CopyFrom(relu.relu_param());
+    layers.erase(layers.begin() + next);
+  }
+  param_fused->CopyFrom(param);
+  param_fused->clear_layer();
+  for (int i = 0; i < layers.size(); ++i) {
+    param_fused->add_layer()->CopyFrom(layers[i]);
+  }
+}
+
+}  // namespace caffe
@@ -5,6 +5,48 @@
 
 namespace caffe {
 
+// The HDF5 type of IEEE half precision values, which the library converts
+// from and to other floating point types
+static hid_t hdf5_half_type() {
+  hid_t type = H5Tcopy(H5T_IEEE_F32LE);
+  CHECK_GE(type, 0) << "Failed to create half precision type";
+  CHECK_GE(H5Tset_fields(type, 15, 10, 5, 0, 10), 0);
+  CHECK_GE(H5Tset_size(type, 2), 0);
+  CHECK_GE(H5Tset_ebias(type, 15), 0);
+  return type;
+}
+
+// Reads the dataset into a blob that stores its data as half precision.
+template <typename Dtype>
+static void hdf5_load_half(hid_t file_id, const char* dataset_name_,
+    Blob<Dtype>* blob) {
+  hid_t type = hdf5_half_type();
+  herr_t status = H5LTread_dataset(file_id, dataset_name_, type,
+      blob->mutable_half_data());
+  CHECK_GE(status, 0) << "Failed to read half dataset " << dataset_name_;
+  H5Tclose(type);
+}
+
+// Writes the data of blob as half precision.
+template <typename Dtype>
+static void hdf5_save_half(hid_t file_id, const string& dataset_name,
+    const Blob<Dtype>& blob, const hsize_t* dims) {
+  vector<uint16_t> converted;
+  const uint16_t* data;
+  if (blob.stores_half()) {
+    data = blob.half_data();
+  } else {
+    converted.resize(blob.count());
+    caffe_cpu_to_half(blob.count(), blob.cpu_data(), converted.data());
+    data = converted.data();
+  }
+  hid_t type = hdf5_half_type();
+  herr_t status = H5LTmake_dataset(file_id, dataset_name.c_str(),
+      blob.num_axes(), dims, type, data);
+  CHECK_GE(status, 0) << "Failed to make half dataset " << dataset_name;
+  H5Tclose(type);
+}
+
 // Verifies format of data stored in HDF5 file and reshapes blob accordingly.
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
@@ -40,6 +82,10 @@ template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
+  if (blob->stores_half()) {
+    hdf5_load_half(file_id, dataset_name_, blob);
+    return;
+  }
   herr_t status = H5LTread_dataset_float(
     file_id, dataset_name_, blob->mutable_cpu_data());
   CHECK_GE(status, 0) << "Failed to read float dataset " << dataset_name_;
@@ -49,6 +95,10 @@ template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob) {
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
+  if (blob->stores_half()) {
+    hdf5_load_half(file_id, dataset_name_, blob);
+    return;
+  }
   herr_t status = H5LTread_dataset_double(
     file_id, dataset_name_, blob->mutable_cpu_data());
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
@@ -57,12 +107,17 @@ void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
 template <>
 void hdf5_save_nd_dataset<float>(
     const hid_t file_id, const string& dataset_name, const Blob<float>& blob,
-    bool write_diff) {
+    bool write_diff, bool write_half) {
   int num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int i = 0; i < num_axes; ++i) {
     dims[i] = blob.shape(i);
   }
+  if (!write_diff && (write_half || blob.stores_half())) {
+    hdf5_save_half(file_id, dataset_name, blob, dims);
+    delete[] dims;
+    return;
+  }
   const float* data;
   if (write_diff) {
     data = blob.cpu_diff();
@@ -78,12 +133,17 @@ void hdf5_save_nd_dataset<float>(
 template <>
 void hdf5_save_nd_dataset<double>(
     hid_t file_id, const string& dataset_name, const Blob<double>& blob,
-    bool write_diff) {
+    bool write_diff, bool write_half) {
   int num_axes = blob.num_axes();
   hsize_t *dims = new hsize_t[num_axes];
   for (int i = 0; i < num_axes; ++i) {
     dims[i] = blob.shape(i);
   }
+  if (!write_diff && (write_half || blob.stores_half())) {
+    hdf5_save_half(file_id, dataset_name, blob, dims);
+    delete[] dims;
+    return;
+  }
   const double* data;
   if (write_diff) {
     data = blob.cpu_diff();
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -7,33 +8,70 @@
 
 namespace caffe {
 
+// Output positions o whose input position o * stride + offset falls within
+// [0, size) form the range [*begin, *end); the others read padding.
+inline void valid_range(const int size, const int size_col, const int offset,
+    const int stride, int* begin, int* end) {
+  *end = size - offset <= 0 ? 0 :
+      std::min(size_col, (size - 1 - offset) / stride + 1);
+  *begin = std::min(offset < 0 ? (stride - 1 - offset) / stride : 0, *end);
+}
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
-    const int stride_h, const int stride_w,
+    const int stride_h, const int stride_w, const int col_stride,
     Dtype* data_col) {
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
-  int channels_col = channels * kernel_h * kernel_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % kernel_w;
-    int h_offset = (c / kernel_w) % kernel_h;
-    int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
-            data_im[(c_im * height + h_pad) * width + w_pad];
-        else
-          data_col[(c * height_col + h) * width_col + w] = 0;
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int size_col = height_col * width_col;
+  // Each image channel fills kernel_h * kernel_w rows of its own
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    const Dtype* im = data_im + c_im * height * width;
+    Dtype* col = data_col + c_im * kernel_h * kernel_w * col_stride;
+    for (int kh = 0; kh < kernel_h; ++kh) {
+      int h_begin, h_end;
+      valid_range(height, height_col, kh - pad_h, stride_h, &h_begin, &h_end);
+      for (int kw = 0; kw < kernel_w; ++kw, col += col_stride) {
+        int w_begin, w_end;
+        valid_range(width, width_col, kw - pad_w, stride_w, &w_begin, &w_end);
+        std::fill(col, col + h_begin * width_col, Dtype(0));
+        for (int h = h_begin; h < h_end; ++h) {
+          const Dtype* im_row = im + (h * stride_h + kh - pad_h) * width;
+          Dtype* col_row = col + h * width_col;
+          std::fill(col_row, col_row + w_begin, Dtype(0));
+          if (stride_w == 1) {
+            const Dtype* im_run = im_row + kw - pad_w;
+            std::copy(im_run + w_begin, im_run + w_end, col_row + w_begin);
+          } else {
+            for (int w = w_begin; w < w_end; ++w) {
+              col_row[w] = im_row[w * stride_w + kw - pad_w];
+            }
+          }
+          std::fill(col_row + w_end, col_row + width_col, Dtype(0));
+        }
+        std::fill(col + h_end * width_col, col + size_col, Dtype(0));
       }
     }
   }
 }
 
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    Dtype* data_col) {
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w, pad_h,
+      pad_w, stride_h, stride_w, height_col * width_col, data_col);
+}
+
 // Explicit instantiation
 template void im2col_cpu<float>(const float* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -43,6 +81,18 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_col);
+template void im2col_cpu<int8_t>(const int8_t* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, int8_t* data_col);
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_stride, float* data_col);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int col_stride, double* data_col);
 
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
@@ -50,21 +100,37 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
-  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
-  int channels_col = channels * patch_h * patch_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % patch_w;
-    int h_offset = (c / patch_w) % patch_h;
-    int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
+  const int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  const int size_col = height_col * width_col;
+  // Each image channel only accumulates its own patch_h * patch_w rows
+#ifdef _OPENMP
+  #pragma omp parallel for
+#endif
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    Dtype* im = data_im + c_im * height * width;
+    const Dtype* col = data_col + c_im * patch_h * patch_w * size_col;
+    std::fill(im, im + height * width, Dtype(0));
+    for (int kh = 0; kh < patch_h; ++kh) {
+      int h_begin, h_end;
+      valid_range(height, height_col, kh - pad_h, stride_h, &h_begin, &h_end);
+      for (int kw = 0; kw < patch_w; ++kw, col += size_col) {
+        int w_begin, w_end;
+        valid_range(width, width_col, kw - pad_w, stride_w, &w_begin, &w_end);
+        for (int h = h_begin; h < h_end; ++h) {
+          Dtype* im_row = im + (h * stride_h + kh - pad_h) * width;
+          const Dtype* col_row = col + h * width_col;
+          if (stride_w == 1) {
+            Dtype* im_run = im_row + kw - pad_w;
+            for (int w = w_begin; w < w_end; ++w) {
+              im_run[w] += col_row[w];
+            }
+          } else {
+            for (int w = w_begin; w < w_end; ++w) {
+              im_row[w * stride_w + kw - pad_w] += col_row[w];
+            }
+          }
+        }
       }
     }
   }
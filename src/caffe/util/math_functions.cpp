@@ -1,9 +1,12 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <algorithm>
+#include <climits>
 #include <limits>
 
 #include "caffe/common.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
 
@@ -59,6 +62,7 @@ void caffe_set(const int N, const Dtype alpha, Dtype* Y) {
     memset(Y, 0, sizeof(Dtype) * N);  // NOLINT(caffe/alt_fn)
     return;
   }
+  CAFFE_PARALLEL_FOR(N)
   for (int i = 0; i < N; ++i) {
     Y[i] = alpha;
   }
@@ -70,6 +74,7 @@ template void caffe_set<double>(const int N, const double alpha, double* Y);
 
 template <>
 void caffe_add_scalar(const int N, const float alpha, float* Y) {
+  CAFFE_PARALLEL_FOR(N)
   for (int i = 0; i < N; ++i) {
     Y[i] += alpha;
   }
@@ -77,6 +82,7 @@ void caffe_add_scalar(const int N, const float alpha, float* Y) {
 
 template <>
 void caffe_add_scalar(const int N, const double alpha, double* Y) {
+  CAFFE_PARALLEL_FOR(N)
   for (int i = 0; i < N; ++i) {
     Y[i] += alpha;
   }
@@ -394,4 +400,181 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+template <typename Dtype>
+void caffe_cpu_quantize(const int n, const Dtype* x, const Dtype scale,
+    int8_t* y) {
+  CHECK_GT(scale, 0);
+  const Dtype inv_scale = Dtype(1) / scale;
+  CAFFE_PARALLEL_FOR(n)
+  for (int i = 0; i < n; ++i) {
+    const Dtype v = std::min(std::max(x[i] * inv_scale, Dtype(-127)),
+        Dtype(127));
+    y[i] = static_cast<int8_t>(v < 0 ? v - Dtype(0.5) : v + Dtype(0.5));
+  }
+}
+
+template
+void caffe_cpu_quantize<float>(const int n, const float* x, const float scale,
+    int8_t* y);
+template
+void caffe_cpu_quantize<double>(const int n, const double* x,
+    const double scale, int8_t* y);
+
+template <typename Dtype>
+void caffe_cpu_quantize_rows(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scales) {
+  for (int r = 0; r < rows; ++r) {
+    const Dtype* row = x + r * cols;
+    Dtype max_abs = 0;
+    for (int c = 0; c < cols; ++c) {
+      max_abs = std::max(max_abs, std::fabs(row[c]));
+    }
+    // All zero rows quantize to zeros whatever the scale
+    scales[r] = max_abs > 0 ? max_abs / 127 : Dtype(1);
+    caffe_cpu_quantize(cols, row, scales[r], y + r * cols);
+  }
+}
+
+template
+void caffe_cpu_quantize_rows<float>(const int rows, const int cols,
+    const float* x, int8_t* y, float* scales);
+template
+void caffe_cpu_quantize_rows<double>(const int rows, const int cols,
+    const double* x, int8_t* y, double* scales);
+
+// Columns of C that one row accumulates at a time, within L1
+const int kGemmS8Block = 2048;
+
+void caffe_cpu_gemm_s8(const CBLAS_TRANSPOSE TransB, const int M, const int N,
+    const int K, const int8_t* A, const int8_t* B, int* C) {
+  CHECK_LE(K, INT_MAX / (127 * 127)) << "int32 accumulators could overflow";
+  if (TransB == CblasNoTrans) {
+    // Each block of a row of C accumulates the rows of B, weighted by the
+    // row of A, with the products widened to int32 in the innermost loop.
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2)
+#endif
+    for (int i = 0; i < M; ++i) {
+      for (int j0 = 0; j0 < N; j0 += kGemmS8Block) {
+        const int j1 = std::min(j0 + kGemmS8Block, N);
+        const int8_t* a = A + i * K;
+        int* c = C + i * N;
+        std::fill(c + j0, c + j1, 0);
+        for (int k = 0; k < K; ++k) {
+          const int a_ik = a[k];
+          if (a_ik == 0) {
+            continue;
+          }
+          const int8_t* b = B + k * N;
+          for (int j = j0; j < j1; ++j) {
+            c[j] += a_ik * b[j];
+          }
+        }
+      }
+    }
+  } else {
+    // Dot products of the rows of A and B
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2)
+#endif
+    for (int i = 0; i < M; ++i) {
+      for (int j = 0; j < N; ++j) {
+        const int8_t* a = A + i * K;
+        const int8_t* b = B + j * K;
+        int sum = 0;
+        for (int k = 0; k < K; ++k) {
+          sum += a[k] * b[k];
+        }
+        C[i * N + j] = sum;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void caffe_cpu_csr_gemm(const int M, const int N, const int* row_ptr,
+    const int* col, const Dtype* val, const Dtype* B, Dtype* C) {
+  // Each row of C accumulates the rows of B that the nonzeros of the row of
+  // A select.
+  const int work = std::min<int64_t>(INT_MAX,
+      static_cast<int64_t>(row_ptr[M]) * N);
+  CAFFE_PARALLEL_FOR(work)
+  for (int i = 0; i < M; ++i) {
+    Dtype* c = C + i * N;
+    for (int j = 0; j < N; ++j) {
+      c[j] = 0;
+    }
+    for (int p = row_ptr[i]; p < row_ptr[i + 1]; ++p) {
+      const Dtype a = val[p];
+      const Dtype* b = B + col[p] * N;
+      for (int j = 0; j < N; ++j) {
+        c[j] += a * b[j];
+      }
+    }
+  }
+}
+
+template
+void caffe_cpu_csr_gemm<float>(const int M, const int N, const int* row_ptr,
+    const int* col, const float* val, const float* B, float* C);
+template
+void caffe_cpu_csr_gemm<double>(const int M, const int N, const int* row_ptr,
+    const int* col, const double* val, const double* B, double* C);
+
+template <typename Dtype>
+void caffe_cpu_gemm_csr_t(const int M, const int N, const int K,
+    const Dtype* A, const int* row_ptr, const int* col, const Dtype* val,
+    Dtype* C) {
+  // Dot products of the rows of A with the sparse rows of B, a row of B at a
+  // time so that its nonzeros stay in cache across the rows of A
+  const int work = std::min<int64_t>(INT_MAX,
+      static_cast<int64_t>(row_ptr[N]) * M);
+  CAFFE_PARALLEL_FOR(work)
+  for (int j = 0; j < N; ++j) {
+    for (int i = 0; i < M; ++i) {
+      const Dtype* a = A + i * K;
+      Dtype sum = 0;
+      for (int p = row_ptr[j]; p < row_ptr[j + 1]; ++p) {
+        sum += val[p] * a[col[p]];
+      }
+      C[i * N + j] = sum;
+    }
+  }
+}
+
+template
+void caffe_cpu_gemm_csr_t<float>(const int M, const int N, const int K,
+    const float* A, const int* row_ptr, const int* col, const float* val,
+    float* C);
+template
+void caffe_cpu_gemm_csr_t<double>(const int M, const int N, const int K,
+    const double* A, const int* row_ptr, const int* col, const double* val,
+    double* C);
+
+template <typename Dtype>
+void caffe_cpu_to_half(const int n, const Dtype* x, uint16_t* y) {
+  CAFFE_PARALLEL_FOR(n)
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_half(static_cast<float>(x[i]));
+  }
+}
+
+template
+void caffe_cpu_to_half<float>(const int n, const float* x, uint16_t* y);
+template
+void caffe_cpu_to_half<double>(const int n, const double* x, uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_from_half(const int n, const uint16_t* x, Dtype* y) {
+  CAFFE_PARALLEL_FOR(n)
+  for (int i = 0; i < n; ++i) {
+    y[i] = half_to_float(x[i]);
+  }
+}
+
+template
+void caffe_cpu_from_half<float>(const int n, const uint16_t* x, float* y);
+template
+void caffe_cpu_from_half<double>(const int n, const uint16_t* x, double* y);
+
 }  // namespace caffe
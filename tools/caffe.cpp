@@ -3,18 +3,26 @@
 namespace bp = boost::python;
 #endif
 
+#include <errno.h>
 #include <glog/logging.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
 #include "caffe/caffe.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
+using caffe::Communicator;
 using caffe::Net;
 using caffe::Layer;
 using caffe::shared_ptr;
@@ -35,6 +43,23 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_int32(cpu_threads, 0,
+    "Optional; the number of threads of elementwise CPU layers and math "
+    "functions, 0 for the OpenMP default.");
+DEFINE_int32(processes, 1,
+    "Optional; the number of processes to train with, which average their "
+    "gradients every iteration. Started on this host unless -rank is set.");
+DEFINE_int32(rank, -1,
+    "Optional; which of the -processes this one is, to start the processes "
+    "yourself, e.g. on several hosts with -comm=tcp://HOST:PORT.");
+DEFINE_string(comm, "",
+    "Optional; how the -processes reach each other: tcp://HOST:PORT[/TOKEN], "
+    "where rank 0 listens and only processes with the same TOKEN may join, "
+    "or shm://NAME for processes on one host. Defaults to shared memory; "
+    "processes started here get a random TOKEN if none is given.");
+
+// The command line, for the processes of train to start with.
+static vector<caffe::string> g_argv;
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -96,6 +121,64 @@ void CopyLayers(caffe::Solver<float>* solver, const std::string& model_list) {
   }
 }
 
+// Starts FLAGS_processes copies of this command, each with a rank, and waits
+// for them. If one fails, the others would wait for it forever, so they are
+// stopped.
+static int launch() {
+  caffe::string comm = FLAGS_comm.size() ? FLAGS_comm :
+      "shm://caffe-" + boost::lexical_cast<caffe::string>(getpid());
+  if (comm.compare(0, 6, "tcp://") == 0 &&
+      comm.find('/', 6) == caffe::string::npos) {
+    comm += "/" + boost::lexical_cast<caffe::string>(caffe::caffe_rng_rand()) +
+        boost::lexical_cast<caffe::string>(caffe::caffe_rng_rand());
+  }
+  LOG(INFO) << "Starting " << FLAGS_processes << " processes on " << comm;
+  vector<pid_t> children;
+  for (int i = 0; i < FLAGS_processes; ++i) {
+    vector<caffe::string> args(g_argv);
+    args.push_back("-rank=" + boost::lexical_cast<caffe::string>(i));
+    args.push_back("-comm=" + comm);
+    vector<char*> argv;
+    for (int j = 0; j < args.size(); ++j) {
+      argv.push_back(const_cast<char*>(args[j].c_str()));
+    }
+    argv.push_back(NULL);
+    const pid_t pid = fork();
+    CHECK_GE(pid, 0) << "fork: " << strerror(errno);
+    if (pid == 0) {
+      // argv[0] need not be a path when caffe was found through PATH
+      execv("/proc/self/exe", &argv[0]);
+      LOG(ERROR) << "Cannot run " << argv[0] << ": " << strerror(errno);
+      _exit(127);
+    }
+    children.push_back(pid);
+  }
+  int result = 0;
+  for (int running = children.size(); running > 0; --running) {
+    int status;
+    const pid_t pid = wait(&status);
+    CHECK_GT(pid, 0) << "wait: " << strerror(errno);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      continue;
+    }
+    if (result == 0) {
+      LOG(ERROR) << "A training process failed; stopping the others.";
+      for (int i = 0; i < children.size(); ++i) {
+        if (children[i] != pid) {
+          kill(children[i], SIGTERM);
+        }
+      }
+    }
+    result = 1;
+  }
+  // Rank 0 removes the shared memory once all have joined, but not if one
+  // failed before that.
+  if (comm.compare(0, 6, "shm://") == 0) {
+    shm_unlink(("/" + comm.substr(6)).c_str());
+  }
+  return result;
+}
+
 // Train / Finetune a model.
 int train() {
   CHECK_GT(FLAGS_solver.size(), 0) << "Need a solver definition to train.";
@@ -103,6 +186,25 @@ int train() {
       << "Give a snapshot to resume training or weights to finetune "
       "but not both.";
 
+  CHECK_GT(FLAGS_processes, 0);
+  if (FLAGS_processes > 1 && FLAGS_rank < 0) {
+    return launch();
+  }
+  shared_ptr<Communicator> communicator;
+  if (FLAGS_processes > 1) {
+    CHECK_LT(FLAGS_rank, FLAGS_processes) << "-rank must be lower than "
+        "-processes.";
+    CHECK_GT(FLAGS_comm.size(), 0) << "Set -comm to start ranks yourself.";
+    if (FLAGS_rank > 0) {
+      // Only rank 0 reports progress
+      FLAGS_minloglevel = std::max(FLAGS_minloglevel, 1);
+    }
+    Caffe::set_solver_count(FLAGS_processes);
+    Caffe::set_solver_rank(FLAGS_rank);
+    communicator = Communicator::Create(FLAGS_comm, FLAGS_rank,
+        FLAGS_processes);
+  }
+
   caffe::SolverParameter solver_param;
   caffe::ReadProtoFromTextFileOrDie(FLAGS_solver, &solver_param);
 
@@ -126,6 +228,7 @@ int train() {
   LOG(INFO) << "Starting Optimization";
   shared_ptr<caffe::Solver<float> >
     solver(caffe::GetSolver<float>(solver_param));
+  solver->set_communicator(communicator);
 
   if (FLAGS_snapshot.size()) {
     LOG(INFO) << "Resuming from " << FLAGS_snapshot;
@@ -306,8 +409,10 @@ int main(int argc, char** argv) {
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
+  g_argv.assign(argv, argv + argc);
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::Caffe::set_cpu_threads(FLAGS_cpu_threads);
   if (argc == 2) {
 #ifdef WITH_PYTHON_LAYER
     try {
@@ -0,0 +1,74 @@
+// This program runs a calibration set through a net to find the largest input
+// magnitude of each of its Convolution and InnerProduct layers, and writes the
+// net with these in quantization_param, so that the layers run as int8 GEMMs
+// on CPU in the TEST phase.
+// Usage:
+//   calibrate_quantization [FLAGS] NET_PROTOTXT WEIGHTS OUTPUT_PROTOTXT
+//
+// The net reads the calibration set in the TEST phase.
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/calibrate_quantization.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::set;
+
+DEFINE_int32(iterations, 50,
+    "The number of batches to calibrate on");
+DEFINE_string(exclude, "",
+    "Optional; comma-separated names of layers to keep in floating point, "
+    "such as the first convolution");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Calibrate a net for int8 inference on CPU\n"
+        "Usage:\n"
+        "    calibrate_quantization [FLAGS] NET_PROTOTXT WEIGHTS "
+        "OUTPUT_PROTOTXT\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/calibrate_quantization");
+    return 1;
+  }
+
+  NetParameter param;
+  ReadNetParamsFromTextFileOrDie(argv[1], &param);
+  vector<string> excluded;
+  boost::split(excluded, FLAGS_exclude, boost::is_any_of(","));
+  const set<string> exclude(excluded.begin(), excluded.end());
+
+  CalibrateQuantization(argv[2], FLAGS_iterations, exclude, &param);
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer = param.layer(i);
+    if ((layer.type() != "Convolution" && layer.type() != "InnerProduct") ||
+        exclude.count(layer.name())) {
+      continue;
+    }
+    if (layer.has_quantization_param()) {
+      LOG(ERROR) << layer.name() << ": input_max "
+          << layer.quantization_param().input_max();
+    } else {
+      LOG(ERROR) << layer.name() << " had only zero inputs; kept in float.";
+    }
+  }
+  WriteProtoToTextFile(param, argv[3]);
+  LOG(ERROR) << "Wrote calibrated NetParameter text proto to " << argv[3];
+  return 0;
+}
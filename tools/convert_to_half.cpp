@@ -0,0 +1,94 @@
+// This program converts the weights in a binary NetParameter, such as a
+// .caffemodel, to half precision, which halves its size, or back to float.
+// Usage:
+//   convert_to_half [FLAGS] INPUT_WEIGHTS OUTPUT_WEIGHTS
+//
+// Nets read either kind of weights; half_params in the net keeps them half
+// precision in memory too.
+
+#include <string>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/half.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+
+DEFINE_bool(to_float, false,
+    "Optional; convert half precision weights back to float");
+
+// Converts the data of blob, keeping its shape and diff, and returns the
+// number of values converted.
+int ConvertBlob(BlobProto* blob) {
+  if (FLAGS_to_float) {
+    if (!blob->has_half_data()) {
+      return 0;
+    }
+    const string& bytes = blob->half_data();
+    const int count = bytes.size() / 2;
+    for (int i = 0; i < count; ++i) {
+      const uint16_t h = static_cast<unsigned char>(bytes[2 * i]) |
+          (static_cast<unsigned char>(bytes[2 * i + 1]) << 8);
+      blob->add_data(half_to_float(h));
+    }
+    blob->clear_half_data();
+    return count;
+  }
+  const int count = blob->data_size() + blob->double_data_size();
+  if (count == 0) {
+    return 0;
+  }
+  string* bytes = blob->mutable_half_data();
+  bytes->resize(2 * count);
+  for (int i = 0; i < count; ++i) {
+    const uint16_t h = float_to_half(blob->data_size() > 0 ? blob->data(i) :
+        static_cast<float>(blob->double_data(i)));
+    (*bytes)[2 * i] = static_cast<char>(h & 0xff);
+    (*bytes)[2 * i + 1] = static_cast<char>(h >> 8);
+  }
+  blob->clear_data();
+  blob->clear_double_data();
+  return count;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert the weights of a net to half precision\n"
+        "Usage:\n"
+        "    convert_to_half [FLAGS] INPUT_WEIGHTS OUTPUT_WEIGHTS\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_to_half");
+    return 1;
+  }
+
+  NetParameter param;
+  ReadProtoFromBinaryFileOrDie(argv[1], &param);
+  int count = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    LayerParameter* layer = param.mutable_layer(i);
+    for (int j = 0; j < layer->blobs_size(); ++j) {
+      count += ConvertBlob(layer->mutable_blobs(j));
+    }
+  }
+  // V1 layers of older models
+  for (int i = 0; i < param.layers_size(); ++i) {
+    V1LayerParameter* layer = param.mutable_layers(i);
+    for (int j = 0; j < layer->blobs_size(); ++j) {
+      count += ConvertBlob(layer->mutable_blobs(j));
+    }
+  }
+  WriteProtoToBinaryFile(param, argv[2]);
+  LOG(ERROR) << "Converted " << count << " weights to "
+      << (FLAGS_to_float ? "float" : "half precision") << " in " << argv[2];
+  return 0;
+}
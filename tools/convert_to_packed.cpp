@@ -0,0 +1,71 @@
+// This program converts a lmdb/leveldb of Datums to a packed database of
+// fixed-size, decoded records, which data layers read without parsing.
+// Usage:
+//   convert_to_packed [FLAGS] INPUT_DB OUTPUT_FILE
+//
+// Encoded images are decoded and must all decode to the same shape.
+
+#include <string>
+
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/db.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using boost::scoped_ptr;
+
+DEFINE_string(backend, "lmdb",
+        "The backend {lmdb, leveldb} of the input db");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Convert a leveldb/lmdb of Datums to a packed db\n"
+        "Usage:\n"
+        "    convert_to_packed [FLAGS] INPUT_DB OUTPUT_FILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/convert_to_packed");
+    return 1;
+  }
+
+  scoped_ptr<db::DB> input(db::GetDB(FLAGS_backend));
+  input->Open(argv[1], db::READ);
+  scoped_ptr<db::Cursor> cursor(input->NewCursor());
+
+  scoped_ptr<db::DB> output(db::GetDB(DataParameter_DB_PACKED));
+  output->Open(argv[2], db::NEW);
+  scoped_ptr<db::Transaction> txn(output->NewTransaction());
+
+  int count = 0;
+  Datum datum;
+  string out;
+  for (; cursor->valid(); cursor->Next()) {
+    cursor->ReadDatum(&datum);
+    if (datum.encoded()) {
+      CHECK(DecodeDatumNative(&datum)) << "Failed to decode " << cursor->key();
+    }
+    CHECK(datum.SerializeToString(&out));
+    txn->Put(cursor->key(), out);
+
+    if (++count % 1000 == 0) {
+      txn->Commit();
+      LOG(ERROR) << "Processed " << count << " files.";
+    }
+  }
+  // write the last batch
+  if (count % 1000 != 0) {
+    txn->Commit();
+    LOG(ERROR) << "Processed " << count << " files.";
+  }
+  return 0;
+}
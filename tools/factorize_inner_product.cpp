@@ -0,0 +1,218 @@
+// This program replaces InnerProduct layers of a net, such as the fc6 and
+// fc7 of a detection head, by two smaller ones from a truncated SVD of their
+// weights: an N x K layer becomes a rank x K one without bias followed by an
+// N x rank one, which is faster when rank * (N + K) < N * K.
+// Usage:
+//   factorize_inner_product [FLAGS] NET_PROTOTXT WEIGHTS OUTPUT_PROTOTXT
+//       OUTPUT_WEIGHTS
+//
+// WEIGHTS is a binary NetParameter (.caffemodel). The outputs of the TEST net
+// (such as accuracy) before and after, averaged over -iterations batches, are
+// reported. Fine-tuning the factorized net recovers most of the difference.
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "boost/lexical_cast.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/factorize.hpp"
+#include "caffe/util/io.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::map;
+
+DEFINE_string(ranks, "",
+    "Comma-separated layer:rank pairs, such as fc6:1024,fc7:256");
+DEFINE_int32(iterations, 50,
+    "The number of TEST batches to compare the nets on; 0 to skip");
+DEFINE_int32(power_iterations, 2,
+    "Optional; subspace iterations, which make the SVD more accurate when "
+    "the singular values decay slowly");
+DEFINE_int32(oversampling, 10,
+    "Optional; extra dimensions the SVD searches beyond the rank");
+
+// Appends the two layers, name_L and name_U, that replace the InnerProduct
+// layer to layers.
+void SplitLayer(const LayerParameter& layer, int rank,
+    google::protobuf::RepeatedPtrField<LayerParameter>* layers) {
+  CHECK_EQ(layer.type(), "InnerProduct")
+      << layer.name() << " is not an InnerProduct layer.";
+  CHECK_EQ(layer.top_size(), 1);
+  const string lower_name = layer.name() + "_L";
+  LayerParameter* lower = layers->Add();
+  lower->CopyFrom(layer);
+  lower->set_name(lower_name);
+  lower->set_top(0, lower_name);
+  lower->clear_blobs();
+  InnerProductParameter* lower_param = lower->mutable_inner_product_param();
+  lower_param->set_num_output(rank);
+  lower_param->set_bias_term(false);
+  lower_param->clear_bias_filler();
+  while (lower->param_size() > 1) {
+    lower->mutable_param()->RemoveLast();
+  }
+  LayerParameter* upper = layers->Add();
+  upper->CopyFrom(layer);
+  upper->set_name(layer.name() + "_U");
+  upper->set_bottom(0, lower_name);
+  upper->clear_blobs();
+  // The rank outputs of the lower layer are its last axis.
+  if (upper->inner_product_param().axis() < 0) {
+    upper->mutable_inner_product_param()->set_axis(-1);
+  }
+  // The weights differ in shape now, so cannot be shared.
+  for (int i = 0; i < lower->param_size(); ++i) {
+    lower->mutable_param(i)->clear_name();
+  }
+  for (int i = 0; i < upper->param_size(); ++i) {
+    upper->mutable_param(i)->clear_name();
+  }
+}
+
+// Runs the TEST net of param on weights for -iterations batches and returns
+// the mean of each output, named in names.
+vector<float> Score(NetParameter param, const NetParameter& weights,
+    vector<string>* names) {
+  param.mutable_state()->set_phase(TEST);
+  Net<float> net(param);
+  net.CopyTrainedLayersFrom(weights);
+  vector<float> score;
+  vector<Blob<float>*> bottom_vec;
+  names->clear();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    const vector<Blob<float>*>& result = net.Forward(bottom_vec);
+    int idx = 0;
+    for (int j = 0; j < result.size(); ++j) {
+      const float* result_vec = result[j]->cpu_data();
+      for (int k = 0; k < result[j]->count(); ++k, ++idx) {
+        if (i == 0) {
+          score.push_back(0);
+          names->push_back(
+              net.blob_names()[net.output_blob_indices()[j]]);
+        }
+        score[idx] += result_vec[k] / FLAGS_iterations;
+      }
+    }
+  }
+  return score;
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Factorize InnerProduct layers by truncated SVD\n"
+        "Usage:\n"
+        "    factorize_inner_product [FLAGS] NET_PROTOTXT WEIGHTS "
+        "OUTPUT_PROTOTXT OUTPUT_WEIGHTS\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 5 || FLAGS_ranks.empty()) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0],
+        "tools/factorize_inner_product");
+    return 1;
+  }
+
+  map<string, int> ranks;
+  vector<string> pairs;
+  boost::split(pairs, FLAGS_ranks, boost::is_any_of(","));
+  for (int i = 0; i < pairs.size(); ++i) {
+    const size_t colon = pairs[i].rfind(':');
+    CHECK_NE(colon, string::npos) << "Expected layer:rank, got " << pairs[i];
+    const int rank = boost::lexical_cast<int>(pairs[i].substr(colon + 1));
+    CHECK_GT(rank, 0) << "Bad rank in " << pairs[i];
+    ranks[pairs[i].substr(0, colon)] = rank;
+  }
+
+  NetParameter param, weights;
+  ReadNetParamsFromTextFileOrDie(argv[1], &param);
+  ReadNetParamsFromBinaryFileOrDie(argv[2], &weights);
+
+  NetParameter factorized(param);
+  factorized.clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    map<string, int>::const_iterator it = ranks.find(param.layer(i).name());
+    if (it == ranks.end()) {
+      factorized.add_layer()->CopyFrom(param.layer(i));
+    } else {
+      SplitLayer(param.layer(i), it->second, factorized.mutable_layer());
+    }
+  }
+
+  NetParameter factorized_weights(weights);
+  factorized_weights.clear_layer();
+  int found = 0;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    const LayerParameter& layer = weights.layer(i);
+    map<string, int>::const_iterator it = ranks.find(layer.name());
+    if (it == ranks.end()) {
+      factorized_weights.add_layer()->CopyFrom(layer);
+      continue;
+    }
+    ++found;
+    CHECK_GE(layer.blobs_size(), 1) << layer.name() << " has no weights.";
+    Blob<float> weight;
+    weight.FromProto(layer.blobs(0));
+    const int N = layer.inner_product_param().num_output();
+    const int K = weight.count() / N;
+    const int rank = it->second;
+    CHECK_LE(rank, std::min(N, K)) << "The rank of " << layer.name()
+        << " is at most " << std::min(N, K) << ".";
+    if (rank * (N + K) >= N * K) {
+      LOG(WARNING) << "Rank " << rank << " does not make " << layer.name()
+          << " (" << N << " x " << K << ") any smaller.";
+    }
+    vector<int> lower_shape(2), upper_shape(2);
+    lower_shape[0] = rank;
+    lower_shape[1] = K;
+    upper_shape[0] = N;
+    upper_shape[1] = rank;
+    Blob<float> lower(lower_shape), upper(upper_shape);
+    const double kept = Factorize(N, K, rank, FLAGS_oversampling,
+        FLAGS_power_iterations, weight.cpu_data(), upper.mutable_cpu_data(),
+        lower.mutable_cpu_data());
+    LOG(ERROR) << layer.name() << ": " << N << " x " << K << " to rank "
+        << rank << ", keeping " << 100 * kept << "% of the energy, "
+        << 100. * rank * (N + K) / (N * K) << "% of the multiplies";
+    const int first = factorized_weights.layer_size();
+    SplitLayer(layer, rank, factorized_weights.mutable_layer());
+    lower.ToProto(factorized_weights.mutable_layer(first)->add_blobs());
+    LayerParameter* upper_layer = factorized_weights.mutable_layer(first + 1);
+    upper.ToProto(upper_layer->add_blobs());
+    for (int j = 1; j < layer.blobs_size(); ++j) {
+      upper_layer->add_blobs()->CopyFrom(layer.blobs(j));
+    }
+  }
+  CHECK_EQ(found, ranks.size()) << "Not all of -ranks are in the weights.";
+
+  WriteProtoToTextFile(factorized, argv[3]);
+  WriteProtoToBinaryFile(factorized_weights, argv[4]);
+  LOG(ERROR) << "Wrote the factorized net to " << argv[3] << " and "
+      << argv[4];
+
+  if (FLAGS_iterations > 0) {
+    vector<string> names, factorized_names;
+    const vector<float> before = Score(param, weights, &names);
+    const vector<float> after = Score(factorized, factorized_weights,
+        &factorized_names);
+    CHECK(names == factorized_names);
+    for (int i = 0; i < names.size(); ++i) {
+      LOG(ERROR) << names[i] << " = " << before[i] << " before, "
+          << after[i] << " after (" << std::showpos << after[i] - before[i]
+          << std::noshowpos << ")";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,98 @@
+// This program prunes a net: it zeroes the weights of its Convolution and
+// InnerProduct layers whose magnitude is below a threshold, and writes the
+// pruned weights.
+// Usage:
+//   prune_net [FLAGS] NET_PROTOTXT WEIGHTS OUTPUT_WEIGHTS
+//
+// Retrain (fine-tune) from the pruned weights with keep_pruned_weights in the
+// solver so that they stay zero. Layers whose weights are at least
+// sparsity_threshold zero multiply them as sparse matrices on CPU in the TEST
+// phase.
+
+#include <cmath>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "boost/algorithm/string.hpp"
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/net.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::set;
+
+DEFINE_double(threshold, 0,
+    "The magnitude below which weights are zeroed");
+DEFINE_string(layers, "",
+    "Optional; comma-separated names of the layers to prune, instead of all "
+    "Convolution and InnerProduct layers");
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Zero the small weights of a net\n"
+        "Usage:\n"
+        "    prune_net [FLAGS] NET_PROTOTXT WEIGHTS OUTPUT_WEIGHTS\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 4) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/prune_net");
+    return 1;
+  }
+  CHECK_GT(FLAGS_threshold, 0) << "Set -threshold to prune.";
+
+  set<string> layers;
+  if (!FLAGS_layers.empty()) {
+    vector<string> names;
+    boost::split(names, FLAGS_layers, boost::is_any_of(","));
+    layers.insert(names.begin(), names.end());
+  }
+
+  Net<float> net(argv[1], TEST);
+  net.CopyTrainedLayersFrom(argv[2]);
+  const float threshold = FLAGS_threshold;
+  int total = 0, total_zeros = 0;
+  for (int i = 0; i < net.layers().size(); ++i) {
+    const string& name = net.layer_names()[i];
+    const string& type = net.layers()[i]->type();
+    if (layers.empty() ? type != string("Convolution") &&
+        type != string("InnerProduct") : !layers.count(name)) {
+      continue;
+    }
+    const vector<shared_ptr<Blob<float> > >& blobs = net.layers()[i]->blobs();
+    int count = 0, zeros = 0;
+    // Only weights; biases are few and not multiplied by anything.
+    for (int j = 0; j < blobs.size(); ++j) {
+      if (blobs[j]->num_axes() <= 1) { continue; }
+      float* data = blobs[j]->mutable_cpu_data();
+      for (int k = 0; k < blobs[j]->count(); ++k) {
+        if (std::fabs(data[k]) < threshold) {
+          data[k] = 0;
+        }
+        zeros += data[k] == 0;
+      }
+      count += blobs[j]->count();
+    }
+    if (count > 0) {
+      LOG(ERROR) << name << ": " << zeros << " of " << count
+          << " weights zero (" << 100. * zeros / count << "%)";
+    }
+    total += count;
+    total_zeros += zeros;
+  }
+  NetParameter param;
+  net.ToProto(&param);
+  WriteProtoToBinaryFile(param, argv[3]);
+  LOG(ERROR) << "Wrote " << total_zeros << " of " << total
+      << " weights zero to " << argv[3];
+  return 0;
+}